@@ -3,7 +3,8 @@
 precision highp float;
 
 uniform sampler2D u_tex0;
-uniform float u_sample_count;
+//Moments of trace target, alpha is per pixel step count since tiles take different numbers of steps
+uniform sampler2D u_tex1;
 
 in vec2 uv;
 
@@ -11,7 +12,6 @@ out vec4 outColor;
 
 void main()
 {
-	vec4 v = texture(u_tex0, uv) / u_sample_count;
-    outColor.rgb = v.rgb; 
-	outColor.a = 1.0;
+	vec4 v = texture(u_tex0, uv) / max(texture(u_tex1, uv).a, 1.0);
+    outColor = v;
 }
\ No newline at end of file
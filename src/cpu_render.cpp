@@ -0,0 +1,451 @@
+#include "cpu_render.h"
+
+#include "scene.h"
+
+namespace app
+{
+	struct CpuRender
+	{
+		CpuRenderSettings settings;
+		glm::ivec2 renderResolution{ 0, 0 };
+		TileGridInfo tileInfo;
+
+		SceneProgram program;
+
+		//Per pixel sum over accumulation steps, rows bottom to top like traceRT
+		std::vector<glm::vec3> traceBuffer;
+		int traceStepsCurrent = 0;
+
+		CpuRenderStats stats;
+	};
+
+	//Mirrors trace_frag.glsl, see TraceRayCycled and main there
+	struct CpuRay
+	{
+		glm::vec2 o;
+		glm::vec2 d;
+	};
+	struct CpuTraceContext
+	{
+		const SceneProgram* program = nullptr;
+		const CpuRenderSettings* settings = nullptr;
+		int channel = 0;
+		float randomSeed = 0.f;
+		uint64_t rays = 0;
+	};
+
+	float CpuRand(glm::vec2 uv)
+	{
+		float v = std::sin(glm::dot(uv, glm::vec2(12.9898f, 78.233f))) * 43758.5453f;
+		return v - std::floor(v);
+	}
+	float CpuReflectance(glm::vec2 i, glm::vec2 normal, float n1n2)
+	{
+		float n1 = 1.f;
+		float n2 = n1n2;
+		float cosI = glm::dot(i, normal);
+		float sinF2 = n1n2 * n1n2 * (1.f - cosI * cosI);
+		if (sinF2 > 1.f)
+		{
+			return 1.f;
+		}
+		float cosF = std::sqrt(1.f - sinF2);
+		cosI = std::abs(cosI);
+		float r1 = (n1 * cosF - n2 * cosI) / (n1 * cosF + n2 * cosI);
+		float r2 = (n2 * cosI - n1 * cosF) / (n2 * cosI + n1 * cosF);
+		return (r1 * r1 + r2 * r2) * 0.5f;
+	}
+	glm::vec2 CpuRefract(glm::vec2 i, glm::vec2 n, float eta)
+	{
+		float ni = glm::dot(n, i);
+		float k = 1.f - eta * eta * (1.f - ni * ni);
+		if (k < 0.f)
+		{
+			return glm::vec2(0.f);
+		}
+		return eta * i - (eta * ni + std::sqrt(k)) * n;
+	}
+	glm::vec2 CpuReflect(glm::vec2 i, glm::vec2 n)
+	{
+		return i - 2.f * glm::dot(n, i) * n;
+	}
+	const SceneProgramMaterial& CpuGetMaterial(const SceneProgram& program, int material)
+	{
+		if (material < 0 || material >= int(program.materials.size()))
+		{
+			material = 0;
+		}
+		return program.materials[material];
+	}
+	//Taps share packets, a single one with 4 or more lanes
+	glm::vec2 CpuSceneNormal(const CpuTraceContext& ctx, glm::vec2 pt)
+	{
+		float eps = 0.0001f;
+		std::array<glm::vec2, 4> taps{ pt + glm::vec2(eps, 0.f), pt - glm::vec2(eps, 0.f), pt + glm::vec2(0.f, eps), pt - glm::vec2(0.f, eps) };
+		std::array<float, 4> tapDst;
+		std::array<float, FloatPack::Width> xs;
+		std::array<float, FloatPack::Width> ys;
+		std::array<float, FloatPack::Width> dst;
+		for (int first = 0; first < int(taps.size()); first += FloatPack::Width)
+		{
+			for (int l = 0; l < FloatPack::Width; ++l)
+			{
+				auto tap = taps[std::min(first + l, int(taps.size()) - 1)];
+				xs[l] = tap.x;
+				ys[l] = tap.y;
+			}
+			auto res = EvaluateSceneProgramPacket(*ctx.program, PackLoad(xs.data()), PackLoad(ys.data()), ctx.settings->rayMissDst);
+			PackStore(dst.data(), res.dst);
+			for (int l = 0; l < FloatPack::Width && first + l < int(taps.size()); ++l)
+			{
+				tapDst[first + l] = dst[l];
+			}
+		}
+		return glm::normalize(glm::vec2(tapDst[0] - tapDst[1], tapDst[2] - tapDst[3]) * 0.5f / eps);
+	}
+
+	//State of TraceRayCycled for one lane of a packet, lanes leave the packet independently
+	struct CpuTraceLane
+	{
+		CpuRay rc;
+		float t = 0.f;
+		float totalEmission = 0.f;
+		float emissionMult = 1.f;
+		int rayIdx = 0;
+		int stepIdx = 0;
+		bool active = false;
+	};
+	using CpuTracePacket = std::array<CpuTraceLane, FloatPack::Width>;
+
+	const int CpuMaxTraceSteps = 10;
+
+	//Outer loop of TraceRayCycled, skips rays that can't march and retires the lane when out of rays
+	void CpuLaneBeginRay(CpuTraceContext& ctx, CpuTraceLane& lane)
+	{
+		while (lane.rayIdx < ctx.settings->maxRaysPerSample)
+		{
+			if (lane.t < ctx.settings->rayMissDst)
+			{
+				ctx.rays++;
+				return;
+			}
+			lane.rayIdx++;
+		}
+		lane.active = false;
+	}
+	void CpuLaneEndRay(CpuTraceContext& ctx, CpuTraceLane& lane)
+	{
+		lane.stepIdx = 0;
+		lane.rayIdx++;
+		CpuLaneBeginRay(ctx, lane);
+	}
+	//Inner loop body of TraceRayCycled
+	void CpuLaneStep(CpuTraceContext& ctx, CpuTraceLane& lane, glm::vec2 cp, SceneProgramResult traceRes)
+	{
+		const float maxTraceDst = ctx.settings->rayMissDst;
+		const float hitEps = ctx.settings->rayHitDst;
+		auto& rc = lane.rc;
+
+		float sdfSign = (traceRes.dst >= 0.f) ? 1.f : -1.f;
+		if (traceRes.dst * sdfSign < hitEps)
+		{
+			const auto& material = CpuGetMaterial(*ctx.program, traceRes.material);
+			float refractionIndex = material.refractionIndex[ctx.channel];
+			lane.totalEmission += material.emission[ctx.channel] * lane.emissionMult;
+			if (sdfSign < 0.f)
+			{
+				lane.emissionMult *= std::exp(-material.absorption[ctx.channel] * (lane.t + traceRes.dst * sdfSign));
+			}
+			if (refractionIndex > 0.f)
+			{
+				auto normal = CpuSceneNormal(ctx, cp) * sdfSign;
+				float n1n2 = (sdfSign > 0.f) ? (1.f / refractionIndex) : refractionIndex;
+				float reflectance = CpuReflectance(rc.d, normal, n1n2);
+				auto refracted = CpuRefract(rc.d, normal, n1n2);
+				bool isRefracted = glm::dot(refracted, refracted) > 0.5f &&
+					CpuRand(rc.o + rc.d + ctx.randomSeed) <= (1.f - reflectance);
+				if (isRefracted)
+				{
+					rc.o = cp;
+					rc.d = refracted;
+					rc.o += -1.f * hitEps * normal * 2.f;
+				}
+				else
+				{
+					rc.o = cp;
+					rc.d = CpuReflect(rc.d, normal);
+					rc.o += rc.d * hitEps * 2.f;
+				}
+				lane.t = 0.f;
+				CpuLaneEndRay(ctx, lane);
+			}
+			else
+			{
+				lane.active = false;
+			}
+		}
+		else
+		{
+			lane.t += traceRes.dst * sdfSign;
+			lane.stepIdx++;
+			if (lane.stepIdx >= CpuMaxTraceSteps || lane.t >= maxTraceDst)
+			{
+				CpuLaneEndRay(ctx, lane);
+			}
+		}
+	}
+	//Marches all active lanes together, finished lanes stay in the packet masked out until the last one is done
+	void CpuTraceRayCycled(CpuTraceContext& ctx, CpuTracePacket& packet)
+	{
+		for (auto& lane : packet)
+		{
+			if (lane.active)
+			{
+				CpuLaneBeginRay(ctx, lane);
+			}
+		}
+
+		std::array<float, FloatPack::Width> xs{};
+		std::array<float, FloatPack::Width> ys{};
+		std::array<float, FloatPack::Width> dst;
+		std::array<float, FloatPack::Width> material;
+		while (true)
+		{
+			bool anyActive = false;
+			for (int i = 0; i < FloatPack::Width; ++i)
+			{
+				const auto& lane = packet[i];
+				if (lane.active)
+				{
+					auto cp = lane.rc.o + lane.rc.d * lane.t;
+					xs[i] = cp.x;
+					ys[i] = cp.y;
+					anyActive = true;
+				}
+			}
+			if (!anyActive)
+			{
+				break;
+			}
+
+			auto res = EvaluateSceneProgramPacket(*ctx.program, PackLoad(xs.data()), PackLoad(ys.data()), ctx.settings->rayMissDst);
+			PackStore(dst.data(), res.dst);
+			PackStore(material.data(), res.material);
+			for (int i = 0; i < FloatPack::Width; ++i)
+			{
+				if (packet[i].active)
+				{
+					CpuLaneStep(ctx, packet[i], { xs[i], ys[i] }, { dst[i], int(material[i]) });
+				}
+			}
+		}
+	}
+	//Main of trace_frag.glsl for laneCount consecutive pixels of a row
+	void CpuTracePixels(CpuTraceContext& ctx, glm::ivec2 firstPixel, int laneCount, glm::vec2 texSize, float* res)
+	{
+		const int numSamples = ctx.settings->samplesPerPixel;
+		const float pi = std::numbers::pi_v<float>;
+		auto texelSize = 1.f / texSize;
+		float ar = texSize.x / texSize.y;
+		float angularStep = pi * 2.f / float(numSamples);
+
+		std::array<glm::vec2, FloatPack::Width> uvc;
+		for (int l = 0; l < laneCount; ++l)
+		{
+			auto fragCoord = glm::vec2(firstPixel.x + l, firstPixel.y) + 0.5f;
+			uvc[l] = fragCoord / texSize;
+			uvc[l] = uvc[l] * 2.f - 1.f;
+			if (ar > 1.f)
+			{
+				uvc[l].x *= ar;
+			}
+			else
+			{
+				uvc[l].y /= ar;
+			}
+			res[l] = 0.f;
+		}
+
+		CpuTracePacket packet;
+		for (int i = 0; i < numSamples; ++i)
+		{
+			glm::vec2 offset{ CpuRand({ ctx.randomSeed + float(i), 0.f }), CpuRand({ ctx.randomSeed + float(i), 1.f }) };
+			offset = offset * 2.f - 1.f;
+			for (int l = 0; l < FloatPack::Width; ++l)
+			{
+				auto& lane = packet[l];
+				lane = CpuTraceLane{};
+				if (l < laneCount)
+				{
+					lane.active = true;
+					lane.rc.o = uvc[l] + offset * texelSize;
+					float angle = angularStep * (float(i) + CpuRand(uvc[l] + ctx.randomSeed));
+					lane.rc.d = glm::vec2(std::cos(angle), std::sin(angle));
+				}
+			}
+			CpuTraceRayCycled(ctx, packet);
+			for (int l = 0; l < laneCount; ++l)
+			{
+				res[l] += packet[l].totalEmission;
+			}
+		}
+		for (int l = 0; l < laneCount; ++l)
+		{
+			res[l] /= float(numSamples);
+		}
+	}
+
+	CpuRender* CpuRenderInit(const CpuRenderSettings& settings)
+	{
+		auto* render = new CpuRender();
+		render->settings = settings;
+		if (render->settings.threadCount <= 0)
+		{
+			render->settings.threadCount = std::max(int(std::thread::hardware_concurrency()), 1);
+		}
+		return render;
+	}
+	void CpuRenderDeinit(CpuRender* render)
+	{
+		delete render;
+	}
+	void CpuRenderSetResolution(CpuRender* render, glm::ivec2 resolution)
+	{
+		if (render->renderResolution != resolution)
+		{
+			render->renderResolution = resolution;
+			render->tileInfo = GenerateTileGrid(resolution, render->settings.tileSize);
+			render->traceBuffer.assign(size_t(resolution.x) * resolution.y, glm::vec3(0.f));
+			CpuRenderInvalidateIntegration(render);
+		}
+	}
+	void CpuRenderSetScene(CpuRender* render, const Scene& scene)
+	{
+		render->program = scene.GetProgram();
+		if (!render->program.IsValid())
+		{
+			render->program = SceneProgram{};
+		}
+		CpuRenderInvalidateIntegration(render);
+	}
+	void CpuRenderInvalidateIntegration(CpuRender* render)
+	{
+		std::fill(render->traceBuffer.begin(), render->traceBuffer.end(), glm::vec3(0.f));
+		render->traceStepsCurrent = 0;
+		render->stats = CpuRenderStats{};
+	}
+	void CpuRenderSteps(CpuRender* render, int stepCount)
+	{
+		const auto& settings = render->settings;
+		auto resolution = render->renderResolution;
+		int stepStart = render->traceStepsCurrent;
+		int stepEnd = std::min(stepStart + stepCount, settings.traceStepsTarget);
+		int totalTileCount = render->tileInfo.tileCount.x * render->tileInfo.tileCount.y;
+		if (resolution.x == 0 || resolution.y == 0 || stepEnd <= stepStart || totalTileCount == 0)
+		{
+			return;
+		}
+
+		//Every tile is owned by a single worker for all steps, so accumulation needs no synchronization
+		std::atomic<int> nextTile{ 0 };
+		std::atomic<uint64_t> totalRays{ 0 };
+		auto worker = [&]()
+		{
+			CpuTraceContext ctx{};
+			ctx.program = &render->program;
+			ctx.settings = &settings;
+			auto texSize = glm::vec2(resolution);
+			std::array<float, FloatPack::Width> values;
+			for (int t = nextTile++; t < totalTileCount; t = nextTile++)
+			{
+				auto tile = GetTile(render->tileInfo, t);
+				int tileEndX = tile.origin.x + tile.size.x;
+				for (int step = stepStart; step < stepEnd; ++step)
+				{
+					ctx.randomSeed = float(step) / settings.traceStepsTarget;
+					for (int y = tile.origin.y; y < tile.origin.y + tile.size.y; ++y)
+					{
+						for (int x = tile.origin.x; x < tileEndX; x += FloatPack::Width)
+						{
+							int laneCount = std::min(FloatPack::Width, tileEndX - x);
+							auto* dst = &render->traceBuffer[size_t(y) * resolution.x + x];
+							for (int c = 0; c < 3; ++c)
+							{
+								ctx.channel = c;
+								CpuTracePixels(ctx, { x, y }, laneCount, texSize, values.data());
+								for (int l = 0; l < laneCount; ++l)
+								{
+									dst[l][c] += values[l];
+								}
+							}
+						}
+					}
+				}
+			}
+			totalRays += ctx.rays;
+		};
+
+		auto timeStart = std::chrono::steady_clock::now();
+		int threadCount = std::min(settings.threadCount, totalTileCount);
+		std::vector<std::thread> threads;
+		for (int i = 1; i < threadCount; ++i)
+		{
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		auto timeEnd = std::chrono::steady_clock::now();
+
+		auto& stats = render->stats;
+		stats.samples += uint64_t(stepEnd - stepStart) * resolution.x * resolution.y * settings.samplesPerPixel * 3;
+		stats.rays += totalRays;
+		stats.seconds += std::chrono::duration<double>(timeEnd - timeStart).count();
+		stats.raysPerSecond = stats.seconds > 0.0 ? double(stats.rays) / stats.seconds : 0.0;
+		stats.threadCount = threadCount;
+		stats.packetWidth = FloatPack::Width;
+		stats.simdName = FloatPack::IsaName;
+		render->traceStepsCurrent = stepEnd;
+	}
+	int CpuRenderGetStepsCurrent(const CpuRender* render)
+	{
+		return render->traceStepsCurrent;
+	}
+	CpuRenderStats CpuRenderGetStats(const CpuRender* render)
+	{
+		return render->stats;
+	}
+	//Same curve as present_tex_frag.glsl
+	glm::vec3 CpuTonemap(glm::vec3 v)
+	{
+		float a = 2.51f;
+		float b = 0.03f;
+		float c = 2.43f;
+		float d = 0.59f;
+		float e = 0.14f;
+		return glm::clamp((v * (a * v + b)) / (v * (c * v + d) + e), glm::vec3(0.f), glm::vec3(1.f));
+	}
+	std::vector<uint8_t> CpuRenderGetImage(const CpuRender* render, float exposure, float gamma)
+	{
+		auto resolution = render->renderResolution;
+		std::vector<uint8_t> res(size_t(resolution.x) * resolution.y * 3);
+		float sampleCount = float(std::max(render->traceStepsCurrent, 1));
+		for (int y = 0; y < resolution.y; ++y)
+		{
+			int srcY = resolution.y - 1 - y;
+			for (int x = 0; x < resolution.x; ++x)
+			{
+				auto v = render->traceBuffer[size_t(srcY) * resolution.x + x] / sampleCount;
+				v = CpuTonemap(v * exposure);
+				auto* dst = &res[(size_t(y) * resolution.x + x) * 3];
+				for (int c = 0; c < 3; ++c)
+				{
+					dst[c] = uint8_t(std::round(std::pow(v[c], 1.f / gamma) * 255.f));
+				}
+			}
+		}
+		return res;
+	}
+}
\ No newline at end of file
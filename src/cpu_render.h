@@ -0,0 +1,45 @@
+#pragma once
+
+#include "render.h"
+
+namespace app
+{
+	struct Scene;
+
+	struct CpuRenderSettings
+	{
+		int maxRaysPerSample = 16;
+		int samplesPerPixel = 2;
+		float rayHitDst = 1e-4f;
+		float rayMissDst = 10.f;
+		int traceStepsTarget = 1024;
+		glm::ivec2 tileSize{ 64, 64 };
+		//0 - use all hardware threads
+		int threadCount = 0;
+	};
+	struct CpuRenderStats
+	{
+		uint64_t samples = 0;
+		uint64_t rays = 0;
+		double seconds = 0.0;
+		double raysPerSecond = 0.0;
+		int threadCount = 0;
+		//Rays marched together per SDF evaluation and instruction set used for it
+		int packetWidth = 0;
+		const char* simdName = "";
+	};
+
+	struct CpuRender;
+	CpuRender* CpuRenderInit(const CpuRenderSettings& settings);
+	void CpuRenderDeinit(CpuRender* render);
+
+	void CpuRenderSetResolution(CpuRender* render, glm::ivec2 resolution);
+	void CpuRenderSetScene(CpuRender* render, const Scene& scene);
+	void CpuRenderInvalidateIntegration(CpuRender* render);
+	//Runs up to stepCount accumulation steps over the whole image, blocks until done
+	void CpuRenderSteps(CpuRender* render, int stepCount);
+	int CpuRenderGetStepsCurrent(const CpuRender* render);
+	CpuRenderStats CpuRenderGetStats(const CpuRender* render);
+	//Tonemapped 8-bit RGB, rows top to bottom
+	std::vector<uint8_t> CpuRenderGetImage(const CpuRender* render, float exposure, float gamma);
+}
\ No newline at end of file
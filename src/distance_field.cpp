@@ -0,0 +1,324 @@
+#include "distance_field.h"
+
+namespace app
+{
+	//Squared distance standing for "no such pixel", finite so envelope intersections stay defined
+	inline constexpr float DistanceFieldFar = 1e20f;
+
+	struct DistanceFieldScratch
+	{
+		std::vector<float> f;
+		std::vector<float> d;
+		std::vector<float> z;
+		std::vector<int> v;
+	};
+	//Felzenszwalb-Huttenlocher lower envelope of parabolas rooted at samples of f, in and out are squared distances
+	void DistanceTransform1D(DistanceFieldScratch& scratch, int n)
+	{
+		const auto* f = scratch.f.data();
+		auto* d = scratch.d.data();
+		auto* z = scratch.z.data();
+		auto* v = scratch.v.data();
+		int k = 0;
+		v[0] = 0;
+		z[0] = -std::numeric_limits<float>::infinity();
+		z[1] = std::numeric_limits<float>::infinity();
+		for (int q = 1; q < n; ++q)
+		{
+			//z[0] is -inf, so the loop always stops at the first parabola
+			auto intersect = [&](int r)
+			{
+				return ((f[q] + float(q * q)) - (f[r] + float(r * r))) / float(2 * (q - r));
+			};
+			float s = intersect(v[k]);
+			while (s <= z[k])
+			{
+				k--;
+				s = intersect(v[k]);
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = std::numeric_limits<float>::infinity();
+		}
+		k = 0;
+		for (int q = 0; q < n; ++q)
+		{
+			while (z[k + 1] < float(q))
+			{
+				k++;
+			}
+			int r = v[k];
+			d[q] = float((q - r) * (q - r)) + f[r];
+		}
+	}
+	//Lines are independent within a pass, workers take them one by one
+	template<class Fn>
+	void ForEachLineParallel(int lineCount, int lineLength, int threadCount, Fn&& fn)
+	{
+		std::atomic<int> nextLine{ 0 };
+		auto worker = [&]()
+		{
+			DistanceFieldScratch scratch;
+			scratch.f.resize(lineLength);
+			scratch.d.resize(lineLength);
+			scratch.z.resize(size_t(lineLength) + 1);
+			scratch.v.resize(lineLength);
+			for (int line = nextLine++; line < lineCount; line = nextLine++)
+			{
+				fn(line, scratch);
+			}
+		};
+#ifdef __EMSCRIPTEN__
+		//Web build runs without pthreads
+		threadCount = 1;
+#endif
+		threadCount = std::clamp(threadCount, 1, lineCount);
+		std::vector<std::thread> threads;
+		for (int i = 1; i < threadCount; ++i)
+		{
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	std::vector<float> BakeDistanceField(const std::vector<uint8_t>& mask, glm::ivec2 size, int threadCount)
+	{
+		if (size.x <= 0 || size.y <= 0)
+		{
+			return {};
+		}
+		//One ring of outside pixels keeps shapes touching the border closed
+		glm::ivec2 padded = size + 2;
+		auto isInside = [&](int x, int y)
+		{
+			x -= 1;
+			y -= 1;
+			if (x < 0 || y < 0 || x >= size.x || y >= size.y)
+			{
+				return false;
+			}
+			size_t idx = size_t(y) * size.x + x;
+			return idx < mask.size() && mask[idx] != 0;
+		};
+		//Squared distances to nearest inside and nearest outside pixel, both transforms share the passes
+		size_t count = size_t(padded.x) * padded.y;
+		std::vector<float> toInside(count);
+		std::vector<float> toOutside(count);
+		ForEachLineParallel(padded.x, padded.y, threadCount, [&](int x, DistanceFieldScratch& scratch)
+		{
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				auto& out = pass ? toOutside : toInside;
+				for (int y = 0; y < padded.y; ++y)
+				{
+					scratch.f[y] = (isInside(x, y) != (pass == 1)) ? 0.f : DistanceFieldFar;
+				}
+				DistanceTransform1D(scratch, padded.y);
+				for (int y = 0; y < padded.y; ++y)
+				{
+					out[size_t(y) * padded.x + x] = scratch.d[y];
+				}
+			}
+		});
+		ForEachLineParallel(padded.y, padded.x, threadCount, [&](int y, DistanceFieldScratch& scratch)
+		{
+			for (auto* field : { &toInside, &toOutside })
+			{
+				auto* row = field->data() + size_t(y) * padded.x;
+				std::copy(row, row + padded.x, scratch.f.begin());
+				DistanceTransform1D(scratch, padded.x);
+				std::copy(scratch.d.begin(), scratch.d.begin() + padded.x, row);
+			}
+		});
+
+		//Empty mask has no inside pixels, distance stays finite to keep half float textures away from inf
+		float far = glm::length(glm::vec2(padded));
+		std::vector<float> res(size_t(size.x) * size.y);
+		for (int y = 0; y < size.y; ++y)
+		{
+			for (int x = 0; x < size.x; ++x)
+			{
+				size_t idx = size_t(y + 1) * padded.x + x + 1;
+				float dst = isInside(x + 1, y + 1) ? -(std::sqrt(toOutside[idx]) - 0.5f) : (std::sqrt(toInside[idx]) - 0.5f);
+				res[size_t(y) * size.x + x] = std::min(dst, far);
+			}
+		}
+		return res;
+	}
+	std::vector<glm::vec4> BuildDistanceField(const std::vector<uint8_t>& mask, glm::ivec2 size, float width, int threadCount)
+	{
+		auto baked = BakeDistanceField(mask, size, threadCount);
+		if (baked.empty())
+		{
+			//Nothing to bake, single far sample keeps readers on their regular path
+			return { glm::vec4(1.f, 1.f, width * 0.5f, width * 0.5f), glm::vec4(1e4f, 1.f, 0.f, 0.f) };
+		}
+		float pixelSize = width / float(size.x);
+		auto halfSize = glm::vec2(size) * pixelSize * 0.5f;
+		std::vector<glm::vec4> res;
+		res.reserve(baked.size() + 1);
+		res.emplace_back(glm::vec2(size), halfSize);
+		//Mask rows go down, scene y goes up
+		auto sample = [&](int x, int y)
+		{
+			x = std::clamp(x, 0, size.x - 1);
+			y = std::clamp(y, 0, size.y - 1);
+			return baked[size_t(size.y - 1 - y) * size.x + x];
+		};
+		for (int y = 0; y < size.y; ++y)
+		{
+			for (int x = 0; x < size.x; ++x)
+			{
+				float spanX = float(std::min(x + 1, size.x - 1) - std::max(x - 1, 0));
+				float spanY = float(std::min(y + 1, size.y - 1) - std::max(y - 1, 0));
+				glm::vec2 grad{
+					(spanX > 0.f) ? (sample(x + 1, y) - sample(x - 1, y)) / spanX : 0.f,
+					(spanY > 0.f) ? (sample(x, y + 1) - sample(x, y - 1)) / spanY : 0.f };
+				float gradLength = glm::length(grad);
+				grad = (gradLength > 0.f) ? grad / gradLength : glm::vec2(0.f);
+				res.emplace_back(sample(x, y) * pixelSize, grad.x, grad.y, 0.f);
+			}
+		}
+		return res;
+	}
+	glm::vec3 DistanceFieldSDFGrad(const glm::vec4* field, glm::vec2 pt)
+	{
+		auto size = glm::ivec2(glm::vec2(field[0]));
+		glm::vec2 halfSize{ field[0].z, field[0].w };
+		//Same sample positions and edge clamp as linear filtering of the object texture
+		auto c = glm::clamp(pt, -halfSize, halfSize);
+		auto t = (c + halfSize) / (2.f * halfSize) * glm::vec2(size) - 0.5f;
+		auto t0 = glm::floor(t);
+		auto w = t - t0;
+		auto i0 = glm::clamp(glm::ivec2(t0), glm::ivec2(0), size - 1);
+		auto i1 = glm::clamp(glm::ivec2(t0) + 1, glm::ivec2(0), size - 1);
+		const auto* texels = field + 1;
+		auto bottom = glm::mix(texels[i0.y * size.x + i0.x], texels[i0.y * size.x + i1.x], w.x);
+		auto top = glm::mix(texels[i1.y * size.x + i0.x], texels[i1.y * size.x + i1.x], w.x);
+		auto s = glm::mix(bottom, top, w.y);
+		glm::vec2 grad{ s.y, s.z };
+		float gradLength = glm::length(grad);
+		grad = (gradLength > 0.f) ? grad / gradLength : glm::vec2(1.f, 0.f);
+		auto q = pt - c;
+		if (q == glm::vec2(0.f))
+		{
+			return glm::vec3(s.x, grad);
+		}
+		//Whole shape is inside the box, so the path to it is at least q long plus orthogonal dst at the border
+		float d = std::max(s.x, 0.f);
+		float l = std::sqrt(glm::dot(q, q) + d * d);
+		return glm::vec3(l, (q + d * grad) / l);
+	}
+	bool ParseMaskImage(std::string_view content, std::vector<uint8_t>& mask, glm::ivec2& size)
+	{
+		size_t pos = 0;
+		//Header fields are separated by whitespace, comments run to the end of the line
+		auto skipSpace = [&]()
+		{
+			while (pos < content.size())
+			{
+				if (content[pos] == '#')
+				{
+					while (pos < content.size() && content[pos] != '\n')
+					{
+						pos++;
+					}
+				}
+				else if (std::isspace(uint8_t(content[pos])))
+				{
+					pos++;
+				}
+				else
+				{
+					break;
+				}
+			}
+		};
+		auto readInt = [&](int maxDigits = 9)
+		{
+			skipSpace();
+			int value = -1;
+			for (int digits = 0; digits < maxDigits && pos < content.size() && std::isdigit(uint8_t(content[pos])); ++digits)
+			{
+				value = std::max(value, 0) * 10 + (content[pos++] - '0');
+			}
+			return value;
+		};
+		if (content.size() < 2 || content[0] != 'P' || content[1] < '1' || content[1] > '6')
+		{
+			return false;
+		}
+		int format = content[1] - '0';
+		pos = 2;
+		glm::ivec2 imageSize{ readInt(), 0 };
+		imageSize.y = readInt();
+		bool isBitmap = format == 1 || format == 4;
+		bool isBinary = format >= 4;
+		int channels = (format == 3 || format == 6) ? 3 : 1;
+		int maxValue = isBitmap ? 1 : readInt();
+		if (imageSize.x <= 0 || imageSize.y <= 0 || maxValue <= 0 || maxValue > 65535)
+		{
+			return false;
+		}
+		if (isBinary)
+		{
+			//Exactly one whitespace character separates header from raster
+			pos++;
+		}
+		size_t pixelCount = size_t(imageSize.x) * imageSize.y;
+		std::vector<uint8_t> res(pixelCount, 0);
+		int sampleBytes = (maxValue > 255) ? 2 : 1;
+		for (size_t i = 0; i < pixelCount; ++i)
+		{
+			if (format == 4)
+			{
+				size_t rowBytes = (size_t(imageSize.x) + 7) / 8;
+				size_t x = i % imageSize.x;
+				size_t byte = pos + (i / imageSize.x) * rowBytes + x / 8;
+				if (byte >= content.size())
+				{
+					return false;
+				}
+				res[i] = (uint8_t(content[byte]) >> (7 - x % 8)) & 1;
+				continue;
+			}
+			int sum = 0;
+			for (int c = 0; c < channels; ++c)
+			{
+				int value = 0;
+				if (isBinary)
+				{
+					if (pos + sampleBytes > content.size())
+					{
+						return false;
+					}
+					value = uint8_t(content[pos++]);
+					if (sampleBytes == 2)
+					{
+						value = value * 256 + uint8_t(content[pos++]);
+					}
+				}
+				else
+				{
+					//Plain bitmaps may pack digits without separators
+					value = readInt(isBitmap ? 1 : 9);
+					if (value < 0)
+					{
+						return false;
+					}
+				}
+				sum += value;
+			}
+			//Bitmaps store ink as 1, grey and color images store brightness
+			res[i] = isBitmap ? uint8_t(sum != 0) : uint8_t(sum * 2 < maxValue * channels);
+		}
+		mask = std::move(res);
+		size = imageSize;
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+namespace app
+{
+	//Exact signed euclidean distance transform of a mask, nonzero bytes are inside, everything past the border is outside
+	//Distances are in pixels, shifted by half a pixel so zero lies between inside and outside pixel centers, negative inside
+	std::vector<float> BakeDistanceField(const std::vector<uint8_t>& mask, glm::ivec2 size, int threadCount);
+	//Flat RGBA32F blob of baked field, read by DistanceFieldSDFGrad in trace_frag.glsl:
+	//0: xy - sample count, zw - half size of covered box centered at origin
+	//1..: one texel per sample, rows from the bottom, x - distance in scene units, yz - gradient
+	//Mask rows go from the top, pixels are square and width of the whole mask is given in scene units
+	std::vector<glm::vec4> BuildDistanceField(const std::vector<uint8_t>& mask, glm::ivec2 size, float width, int threadCount);
+	//Bilinear sample of the blob packed as (dst, grad.xy), lower bound from the box border outside of it
+	glm::vec3 DistanceFieldSDFGrad(const glm::vec4* field, glm::vec2 pt);
+	inline float DistanceFieldSDF(const glm::vec4* field, glm::vec2 pt)
+	{
+		return DistanceFieldSDFGrad(field, pt).x;
+	}
+	//Netpbm image (P1-P6) to mask, dark pixels are inside, false on malformed content
+	bool ParseMaskImage(std::string_view content, std::vector<uint8_t>& mask, glm::ivec2& size);
+}
\ No newline at end of file
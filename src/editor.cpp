@@ -326,7 +326,7 @@ namespace app
 					auto a1 = std::atan2(-dir.y, dir.x);
 					auto a2 = std::atan2(-dir2.y, dir2.x);
 					angle = a2 - a1 + editor->secondaryGizmoParamF;
-					angle = std::fmodf(angle, 2.0 * std::numbers::pi_v<float>);
+					angle = std::fmod(angle, 2.f * std::numbers::pi_v<float>);
 					changed = true;
 				}
 			}
@@ -357,6 +357,12 @@ namespace app
 		auto t = LogicalDistanceToViewport(editor, thickness);
 		_GizmoCircle(editor, o, r, t);
 	}
+	void GizmoLine(Editor* editor, glm::vec2 from, glm::vec2 to, float thickness)
+	{
+		auto* dl = ImGui::GetWindowDrawList();
+		auto t = LogicalDistanceToViewport(editor, thickness);
+		dl->AddLine(LogicalToViewport(editor, from), LogicalToViewport(editor, to), editor->GizmoColors[size_t(GizmoColorId::Line_Normal)], t);
+	}
 	bool _GizmoDragRay(Editor* editor, int id, float& distance, glm::vec2 origin, glm::vec2 direction, float handleSize, float lineThickness)
 	{
 		bool changed = false;
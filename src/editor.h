@@ -16,6 +16,7 @@ namespace app
 	bool GizmoDragPoint(Editor* editor, int id, glm::vec2& origin, float size);
 	bool GizmoRotation(Editor* editor, int id, float& angle, glm::vec2 origin, float size, float radius);
 	void GizmoCircle(Editor* editor, glm::vec2 origin, float radius, float thickness);
+	void GizmoLine(Editor* editor, glm::vec2 from, glm::vec2 to, float thickness);
 	bool GizmoDragRay(Editor* editor, int id, float& distance, glm::vec2 origin, glm::vec2 direction, float handleSize, float lineThickness);
 
 	glm::vec2 LogicalToViewport(Editor* editor, glm::vec2 pt);
@@ -0,0 +1,195 @@
+#include "main.h"
+
+#include "cpu_render.h"
+
+namespace app
+{
+	struct HeadlessArgs
+	{
+		std::string variant = "sandbox";
+		std::string output = "out.ppm";
+		glm::ivec2 resolution{ 1280, 720 };
+		int steps = 64;
+		float exposure = 0.f;
+		float gamma = 2.2f;
+		bool listVariants = false;
+		CpuRenderSettings settings{};
+	};
+
+	Scene* HeadlessScene = nullptr;
+
+	ViewInfo GetViewInfo()
+	{
+		return ViewInfo{};
+	}
+	TimeInfo GetTimeInfo()
+	{
+		return TimeInfo{};
+	}
+	Scene* GetScene()
+	{
+		return HeadlessScene;
+	}
+	Editor* GetEditor()
+	{
+		return nullptr;
+	}
+	Render* GetRender()
+	{
+		return nullptr;
+	}
+
+	std::string PlatformGetFile(const std::string& name)
+	{
+		std::string res{};
+		std::string fullPath = "./res/" + name;
+		if (auto* file = std::fopen(fullPath.c_str(), "rb"))
+		{
+			fseek(file, 0, SEEK_END);
+			auto maxSize = ftell(file);
+			res.resize(maxSize);
+			fseek(file, 0, SEEK_SET);
+			res.resize(fread(res.data(), sizeof(char), maxSize, file));
+			fclose(file);
+		}
+		return res;
+	}
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: AppHeadless [options]\n"
+			"  --variant <name>   scene variant to render (default sandbox)\n"
+			"  --list             print available scene variants\n"
+			"  --output <file>    binary PPM output path (default out.ppm)\n"
+			"  --size <w> <h>     image size in pixels (default 1280 720)\n"
+			"  --steps <n>        accumulation steps (default 64)\n"
+			"  --spp <n>          samples per pixel per step (default 2)\n"
+			"  --rays <n>         max rays per sample (default 16)\n"
+			"  --threads <n>      worker threads, 0 - all cores (default 0)\n"
+			"  --exposure <v>     overrides variant exposure\n"
+			"  --gamma <v>        output gamma (default 2.2)\n");
+	}
+
+	bool ParseArgs(int argc, char** argv, HeadlessArgs& args)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			int remaining = argc - i - 1;
+			if (arg == "--list")
+			{
+				args.listVariants = true;
+			}
+			else if (arg == "--variant" && remaining >= 1)
+			{
+				args.variant = argv[++i];
+			}
+			else if (arg == "--output" && remaining >= 1)
+			{
+				args.output = argv[++i];
+			}
+			else if (arg == "--size" && remaining >= 2)
+			{
+				args.resolution.x = std::atoi(argv[++i]);
+				args.resolution.y = std::atoi(argv[++i]);
+			}
+			else if (arg == "--steps" && remaining >= 1)
+			{
+				args.steps = std::atoi(argv[++i]);
+			}
+			else if (arg == "--spp" && remaining >= 1)
+			{
+				args.settings.samplesPerPixel = std::atoi(argv[++i]);
+			}
+			else if (arg == "--rays" && remaining >= 1)
+			{
+				args.settings.maxRaysPerSample = std::atoi(argv[++i]);
+			}
+			else if (arg == "--threads" && remaining >= 1)
+			{
+				args.settings.threadCount = std::atoi(argv[++i]);
+			}
+			else if (arg == "--exposure" && remaining >= 1)
+			{
+				args.exposure = float(std::atof(argv[++i]));
+			}
+			else if (arg == "--gamma" && remaining >= 1)
+			{
+				args.gamma = float(std::atof(argv[++i]));
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return args.resolution.x > 0 && args.resolution.y > 0 && args.steps > 0 &&
+			args.settings.samplesPerPixel > 0 && args.settings.maxRaysPerSample > 0;
+	}
+
+	bool WritePPM(const std::string& fileName, glm::ivec2 size, const std::vector<uint8_t>& rgb)
+	{
+		if (auto* file = std::fopen(fileName.c_str(), "wb"))
+		{
+			fprintf(file, "P6\n%d %d\n255\n", size.x, size.y);
+			auto written = fwrite(rgb.data(), sizeof(uint8_t), rgb.size(), file);
+			fclose(file);
+			return written == rgb.size();
+		}
+		return false;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	app::HeadlessArgs args{};
+	if (!app::ParseArgs(argc, argv, args))
+	{
+		app::PrintUsage();
+		return 1;
+	}
+
+	auto scene = std::make_unique<app::Scene>();
+	app::HeadlessScene = scene.get();
+	if (args.listVariants)
+	{
+		for (const auto& name : scene->variantNames)
+		{
+			printf("%s\n", name.c_str());
+		}
+		return 0;
+	}
+	if (std::find(scene->variantNames.begin(), scene->variantNames.end(), args.variant) == scene->variantNames.end())
+	{
+		fprintf(stderr, "Unknown variant '%s', use --list\n", args.variant.c_str());
+		return 1;
+	}
+	scene->LoadVariant(args.variant);
+
+	args.settings.traceStepsTarget = args.steps;
+	auto* render = app::CpuRenderInit(args.settings);
+	app::CpuRenderSetResolution(render, args.resolution);
+	app::CpuRenderSetScene(render, *scene);
+	for (int step = 0; step < args.steps; ++step)
+	{
+		app::CpuRenderSteps(render, 1);
+		fprintf(stderr, "\rStep %d/%d", step + 1, args.steps);
+	}
+	fprintf(stderr, "\n");
+
+	auto stats = app::CpuRenderGetStats(render);
+	printf("%s: %dx%d, %d steps, %d threads, %.3f s, %llu rays, %.3f Mrays/s\n",
+		args.variant.c_str(), args.resolution.x, args.resolution.y, args.steps, stats.threadCount,
+		stats.seconds, (unsigned long long)stats.rays, stats.raysPerSecond * 1e-6);
+
+	float exposure = args.exposure > 0.f ? args.exposure : scene->exposure;
+	auto image = app::CpuRenderGetImage(render, exposure, args.gamma);
+	bool written = app::WritePPM(args.output, args.resolution, image);
+	app::CpuRenderDeinit(render);
+	if (!written)
+	{
+		fprintf(stderr, "Failed to write '%s'\n", args.output.c_str());
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "polygon_grid.h"
+
+namespace app
+{
+	//Cells are square, about this many per edge over outline box
+	inline constexpr int PolygonGridCellsPerEdge = 2;
+	inline constexpr int PolygonGridAxisMax = 512;
+	//Lower bound cells stay at least half a cell away from the surface, so cells can't get below hit distance scale
+	inline constexpr float PolygonGridCellMin = 1e-3f;
+
+	struct PolygonGridEdge
+	{
+		glm::vec2 a;
+		glm::vec2 b;
+	};
+	float Cross(glm::vec2 a, glm::vec2 b)
+	{
+		return a.x * b.y - a.y * b.x;
+	}
+	glm::vec2 SegmentPerp(glm::vec2 pt, glm::vec2 a, glm::vec2 b)
+	{
+		auto e = b - a;
+		auto p = pt - a;
+		return p - e * std::clamp(glm::dot(p, e) / glm::dot(e, e), 0.f, 1.f);
+	}
+	//Calls fn with index of every cell at Chebyshev distance k from center cell
+	template<class Fn>
+	void ForEachRingCell(glm::ivec2 res, glm::ivec2 center, int k, Fn&& fn)
+	{
+		auto visit = [&](int x, int y)
+		{
+			if (x >= 0 && y >= 0 && x < res.x && y < res.y)
+			{
+				fn(y * res.x + x);
+			}
+		};
+		if (k == 0)
+		{
+			visit(center.x, center.y);
+			return;
+		}
+		for (int x = center.x - k; x <= center.x + k; ++x)
+		{
+			visit(x, center.y - k);
+			visit(x, center.y + k);
+		}
+		for (int y = center.y - k + 1; y <= center.y + k - 1; ++y)
+		{
+			visit(center.x - k, y);
+			visit(center.x + k, y);
+		}
+	}
+
+	std::vector<glm::vec4> BuildPolygonGrid(const std::vector<glm::vec2>& points, float rounding)
+	{
+		std::vector<PolygonGridEdge> edges;
+		for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i, ++i)
+		{
+			if (points[i] != points[j])
+			{
+				edges.push_back({ points[j], points[i] });
+			}
+		}
+		std::vector<glm::vec4> grid(2, glm::vec4(0.f));
+		grid[1].w = rounding;
+		if (edges.empty())
+		{
+			//No cells, query reports a miss
+			return grid;
+		}
+
+		auto lo = points[0];
+		auto hi = points[0];
+		for (auto pt : points)
+		{
+			lo = glm::min(lo, pt);
+			hi = glm::max(hi, pt);
+		}
+		auto size = hi - lo;
+		auto targetCells = float(std::min(edges.size() * PolygonGridCellsPerEdge, size_t(PolygonGridAxisMax * PolygonGridAxisMax)));
+		float cell = std::sqrt(size.x * size.y / targetCells);
+		cell = std::max({ cell, std::max(size.x, size.y) / PolygonGridAxisMax, PolygonGridCellMin });
+		//One cell of margin past rounding keeps everything outside the grid a whole cell away from the surface
+		float margin = cell + rounding;
+		auto gridMin = lo - margin;
+		auto res = glm::ivec2(glm::ceil((size + 2.f * margin) / cell));
+		int cellCount = res.x * res.y;
+		auto cellCenter = [&](glm::ivec2 c)
+		{
+			return gridMin + (glm::vec2(c) + 0.5f) * cell;
+		};
+
+		//Every edge goes to each cell it passes through, row by row
+		std::vector<std::vector<int>> cellEdges(cellCount);
+		float slack = cell * 1e-4f;
+		for (int e = 0; e < int(edges.size()); ++e)
+		{
+			auto [a, b] = edges[e];
+			int y0 = std::max(int(std::floor((std::min(a.y, b.y) - slack - gridMin.y) / cell)), 0);
+			int y1 = std::min(int(std::floor((std::max(a.y, b.y) + slack - gridMin.y) / cell)), res.y - 1);
+			for (int y = y0; y <= y1; ++y)
+			{
+				float t0 = 0.f;
+				float t1 = 1.f;
+				if (a.y != b.y)
+				{
+					float rowLo = gridMin.y + y * cell - slack;
+					float rowHi = rowLo + cell + 2.f * slack;
+					t0 = (rowLo - a.y) / (b.y - a.y);
+					t1 = (rowHi - a.y) / (b.y - a.y);
+					if (t0 > t1)
+					{
+						std::swap(t0, t1);
+					}
+					t0 = std::max(t0, 0.f);
+					t1 = std::min(t1, 1.f);
+				}
+				float xa = a.x + (b.x - a.x) * t0;
+				float xb = a.x + (b.x - a.x) * t1;
+				int x0 = std::max(int(std::floor((std::min(xa, xb) - slack - gridMin.x) / cell)), 0);
+				int x1 = std::min(int(std::floor((std::max(xa, xb) + slack - gridMin.x) / cell)), res.x - 1);
+				for (int x = x0; x <= x1; ++x)
+				{
+					cellEdges[y * res.x + x].push_back(e);
+				}
+			}
+		}
+
+		//Inside test of cell centers, crossings of each center row with the same half open rule as PolygonSDF
+		std::vector<float> centerSign(cellCount, 1.f);
+		std::vector<float> crossings;
+		for (int y = 0; y < res.y; ++y)
+		{
+			float cy = cellCenter({ 0, y }).y;
+			crossings.clear();
+			for (auto [a, b] : edges)
+			{
+				if ((a.y <= cy) != (b.y <= cy))
+				{
+					crossings.push_back(a.x + (cy - a.y) * (b.x - a.x) / (b.y - a.y));
+				}
+			}
+			std::sort(crossings.begin(), crossings.end());
+			for (int x = 0; x < res.x; ++x)
+			{
+				auto right = crossings.end() - std::upper_bound(crossings.begin(), crossings.end(), cellCenter({ x, y }).x);
+				centerSign[y * res.x + x] = (right % 2) ? -1.f : 1.f;
+			}
+		}
+
+		//Nearest edge of any point in the cell is within center distance plus cell diagonal of the center
+		std::vector<glm::vec4> cells(cellCount);
+		std::vector<float> indices;
+		std::vector<int> stamp(edges.size(), -1);
+		float diagonal = cell * std::numbers::sqrt2_v<float>;
+		int ringMax = std::max(res.x, res.y);
+		for (int y = 0; y < res.y; ++y)
+		{
+			for (int x = 0; x < res.x; ++x)
+			{
+				int idx = y * res.x + x;
+				auto center = cellCenter({ x, y });
+				float best = 1e30f;
+				for (int k = 0; k <= ringMax; ++k)
+				{
+					ForEachRingCell(res, { x, y }, k, [&](int c)
+					{
+						for (int e : cellEdges[c])
+						{
+							auto perp = SegmentPerp(center, edges[e].a, edges[e].b);
+							best = std::min(best, glm::dot(perp, perp));
+						}
+					});
+					float ringDst = (k + 0.5f) * cell;
+					if (best <= ringDst * ringDst)
+					{
+						break;
+					}
+				}
+				float dst = std::sqrt(best);
+				auto& out = cells[idx];
+				out = glm::vec4(float(indices.size()), 0.f, dst, centerSign[idx]);
+				//Far cells give dst - |pt - center| as bound, it has to stay above the rounded surface
+				if (dst > diagonal + rounding)
+				{
+					continue;
+				}
+				float reach = dst + diagonal + slack;
+				int k = int(std::ceil(reach / cell + 0.5f));
+				for (int cy = std::max(y - k, 0); cy <= std::min(y + k, res.y - 1); ++cy)
+				{
+					for (int cx = std::max(x - k, 0); cx <= std::min(x + k, res.x - 1); ++cx)
+					{
+						for (int e : cellEdges[cy * res.x + cx])
+						{
+							if (stamp[e] == idx)
+							{
+								continue;
+							}
+							stamp[e] = idx;
+							auto perp = SegmentPerp(center, edges[e].a, edges[e].b);
+							if (glm::dot(perp, perp) <= reach * reach)
+							{
+								indices.push_back(float(e));
+							}
+						}
+					}
+				}
+				out.y = float(indices.size()) - out.x;
+			}
+		}
+
+		int listsOffset = 2 + cellCount + int(edges.size());
+		grid[0] = glm::vec4(gridMin, cell, cell);
+		grid[1] = glm::vec4(float(res.x), float(res.y), float(listsOffset), rounding);
+		grid.reserve(size_t(listsOffset) + (indices.size() + 3) / 4);
+		grid.insert(grid.end(), cells.begin(), cells.end());
+		for (auto [a, b] : edges)
+		{
+			grid.emplace_back(a, b);
+		}
+		indices.resize((indices.size() + 3) / 4 * 4, 0.f);
+		for (size_t i = 0; i < indices.size(); i += 4)
+		{
+			grid.emplace_back(indices[i], indices[i + 1], indices[i + 2], indices[i + 3]);
+		}
+		return grid;
+	}
+	glm::vec3 PolygonGridSDFGrad(const glm::vec4* grid, glm::vec2 pt)
+	{
+		auto gridMin = glm::vec2(grid[0]);
+		glm::vec2 cellSize{ grid[0].z, grid[0].w };
+		auto res = glm::ivec2(glm::vec2(grid[1]));
+		float rounding = grid[1].w;
+		if (res.x == 0)
+		{
+			return glm::vec3(1e30f, 1.f, 0.f);
+		}
+		auto gridMax = gridMin + glm::vec2(res) * cellSize;
+		auto q = pt - glm::clamp(pt, gridMin, gridMax);
+		if (q != glm::vec2(0.f))
+		{
+			float l = glm::length(q);
+			return glm::vec3(l + cellSize.x, q / l);
+		}
+		auto cell = glm::min(glm::ivec2((pt - gridMin) / cellSize), res - 1);
+		auto c = grid[2 + cell.y * res.x + cell.x];
+		auto center = gridMin + (glm::vec2(cell) + 0.5f) * cellSize;
+		auto path = pt - center;
+		float s = c.w;
+		int count = int(c.y);
+		if (count == 0)
+		{
+			float l = glm::length(path);
+			return glm::vec3(s * (c.z - l) - rounding, (l > 0.f) ? s * path / l : glm::vec2(1.f, 0.f));
+		}
+		const auto* edges = grid + 2 + res.x * res.y;
+		const auto* lists = reinterpret_cast<const float*>(grid + int(grid[1].z));
+		float minDst = 1e30f;
+		glm::vec2 minPerp{ 1.f, 0.f };
+		for (int k = int(c.x), end = int(c.x) + count; k < end; ++k)
+		{
+			auto ab = edges[int(lists[k])];
+			glm::vec2 a{ ab.x, ab.y };
+			glm::vec2 b{ ab.z, ab.w };
+			auto perp = SegmentPerp(pt, a, b);
+			float d = glm::dot(perp, perp);
+			if (d < minDst)
+			{
+				minDst = d;
+				minPerp = perp;
+			}
+			//Every crossing of center to pt path flips the sign known at center
+			bool splitsEdge = (Cross(path, a - center) > 0.f) != (Cross(path, b - center) > 0.f);
+			bool splitsPath = (Cross(b - a, center - a) > 0.f) != (Cross(b - a, pt - a) > 0.f);
+			if (splitsEdge && splitsPath)
+			{
+				s = -s;
+			}
+		}
+		float dst = std::sqrt(minDst);
+		return glm::vec3(s * dst - rounding, (dst > 0.f) ? s * minPerp / dst : glm::vec2(1.f, 0.f));
+	}
+}
\ No newline at end of file
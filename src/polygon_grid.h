@@ -0,0 +1,18 @@
+#pragma once
+
+namespace app
+{
+	//Flat RGBA32F blob describing polygon with uniform edge grid, read by PolygonGridSDFGrad in trace_frag.glsl:
+	//0: xy - grid min, zw - cell size
+	//1: xy - cell count, z - index list offset, w - rounding
+	//2..: per cell x - first list index, y - list length, z - distance from cell center to outline, w - sign at center
+	//then one texel per edge (a.xy, b.xy), then edge indices of cell lists, four per texel
+	//Cells far from outline keep empty list and give lower bound from center distance instead
+	std::vector<glm::vec4> BuildPolygonGrid(const std::vector<glm::vec2>& points, float rounding);
+	//Signed distance with gradient packed as (dst, grad.xy), grid points to blob start
+	glm::vec3 PolygonGridSDFGrad(const glm::vec4* grid, glm::vec2 pt);
+	inline float PolygonGridSDF(const glm::vec4* grid, glm::vec2 pt)
+	{
+		return PolygonGridSDFGrad(grid, pt).x;
+	}
+}
\ No newline at end of file
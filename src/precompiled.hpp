@@ -9,6 +9,11 @@
 #include <fmt/core.h>
 
 #include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <utility>
+#include <algorithm>
 #include <vector>
 #include <array>
 #include <functional>
@@ -19,5 +24,9 @@
 #include <variant>
 #include <type_traits>
 #include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include <stdio.h>
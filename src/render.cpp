@@ -1,9 +1,9 @@
 #include "render.h"
 
-#ifdef _WIN32
-#include <glad/gles2.h>
-#elif defined __EMSCRIPTEN__
+#ifdef __EMSCRIPTEN__
 #include <GLES3/gl3.h>
+#else
+#include <glad/gles2.h>
 #endif
 
 #include "main.h"
@@ -11,23 +11,77 @@
 
 #include "imgui.h"
 
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 namespace app
 {
+	//Values match TRACE_MODE_* in trace_frag.glsl
+	enum class TraceMode
+	{
+		//Separate pass per color channel
+		ChannelPasses,
+		//Channels share one path until first dispersive refraction
+		SharedPath,
+		//Hero wavelength with three companions, materials refract by their dispersion law
+		Spectral
+	};
+	static const char* TraceModeNames[] = { "Channel passes", "Shared path RGB", "Spectral" };
+
 	struct RenderTarget
 	{
 		GLuint texture;
 		GLuint framebuffer;
+		//Trace targets only: per channel sum of squared step values, alpha counts steps
+		GLuint momentsTexture;
+	};
+	//One tile step of an adaptive sampling round, step is where the tile continues its sample sequence
+	struct TileDraw
+	{
+		int tile = 0;
+		int step = 0;
+	};
+	//Noisiest tiles get up to this many steps per round
+	inline constexpr int TileStepsPerRoundMax = 4;
+	struct ProgramCacheEntry
+	{
+		uint64_t key = 0;
+		GLuint program = 0;
+	};
+	struct PendingProgram
+	{
+		uint64_t key = 0;
+		GLuint program = 0;
+		bool isInterpreted = false;
+		TraceMode traceMode = TraceMode::ChannelPasses;
 	};
-	struct Tile
+	struct UniformBinding
 	{
-		glm::ivec2 origin{};
-		glm::ivec2 size{};
+		std::string baseName;
+		uint32_t objectId = 0;
+		GLint location = -1;
 	};
-	struct TileGridInfo
+	//Locations of one program, filled on first use and dropped with the program
+	struct UniformTable
 	{
-		glm::ivec2 tileCount{};
-		glm::ivec2 padTileSize{};
-		glm::ivec2 tileSize{};
+		std::unordered_map<uint64_t, UniformBinding> bindings;
+		std::vector<std::string> boundBlocks;
+		//Texture unit of sampler is its index here plus one, unit zero belongs to pass inputs and the scene program
+		std::vector<std::string> textureUnits;
+	};
+	struct UniformBlockBuffer
+	{
+		std::string name;
+		GLuint buffer = 0;
+	};
+	struct UniformTexture
+	{
+		std::string name;
+		GLuint texture = 0;
+		uint64_t version = 0;
+		//Cleared before first fill of a new trace program, textures left unbound get deleted
+		bool isBound = false;
 	};
 	struct Render
 	{
@@ -35,6 +89,10 @@ namespace app
 		RenderTarget traceRT;
 		RenderTarget accumulateRT;
 		RenderTarget presentRT;
+		//Coarse point sampling of trace target, read back for split rate
+		RenderTarget splitStatsRT;
+		//Texel per tile, relative error of tile mean read back after every round
+		RenderTarget tileStatsRT;
 
 		glm::ivec2 renderResolution{ 0, 0 };
 
@@ -54,6 +112,21 @@ namespace app
 		glm::ivec2 tileSize{ 64, 64 };
 		TileGridInfo tileInfo;
 		int tilesRendered = 0;
+		//Tiles are traced in rounds, adaptive rounds give noisier tiles more steps and drop tiles below noise threshold
+		bool adaptiveSampling = true;
+		//Relative standard error of tile mean
+		float noiseThreshold = 0.02f;
+		//Steps before variance estimate of a tile is trusted
+		int adaptiveMinSteps = 16;
+		//Indexed like GetTile
+		std::vector<int> tileSteps;
+		std::vector<float> tileErrors;
+		//Draws of current round, tilesRendered counts over it
+		std::vector<TileDraw> tileSchedule;
+		int tilesActive = 0;
+		std::chrono::steady_clock::time_point roundStart;
+		float secondsPerTileStep = 0.f;
+		float secondsToConvergence = 0.f;
 #ifdef __EMSCRIPTEN__
 		int tilesPerFrame = 3;
 #else
@@ -61,13 +134,51 @@ namespace app
 #endif
 		int currentColor = 0;
 
+		TraceMode traceMode = TraceMode::SharedPath;
+		//Primary hits also get a shadow ray toward emissive objects, combined with plain hits by balance heuristic
+		bool nextEventEstimation = true;
+		//Fraction of samples split by channel or wavelength during last step, updated only while Render tab is open
+		float splitRate = 0.f;
+		bool splitRateRequested = false;
+		glm::ivec2 splitStatsSize{ 32, 18 };
+
 		GLuint programTrace;
 		GLuint programPresent;
 		GLuint programAccumulate;
+		GLuint programTileStats;
 
 		bool needRebuildTargets = false;
 		bool needRebuildTraceProgram = false;
 
+		//Linked trace programs by source hash, least recently used first
+		std::vector<ProgramCacheEntry> programCache;
+		int programCacheCapacity = 8;
+		bool programBinarySupported = false;
+		uint64_t driverHash = 0;
+
+		//New trace program links in background while programTrace keeps rendering
+		PendingProgram pendingTrace;
+		bool parallelCompileSupported = false;
+		bool programTraceInterpreted = false;
+		TraceMode programTraceMode = TraceMode::ChannelPasses;
+
+		//Scene evaluated from SceneProgram data instead of codegen, edits upload data and don't recompile
+		bool useSceneInterpreter = false;
+		bool needUploadSceneProgram = false;
+		GLuint sceneProgramTexture = 0;
+		int sceneProgramSize = 0;
+		int sceneMaterialsOffset = 0;
+		//Stacks of uploaded program exceed SceneProgramStackMax, interpreter gets no instructions
+		bool sceneProgramTooDeep = false;
+
+		std::unordered_map<GLuint, UniformTable> uniformTables;
+		//Binding point of block is its index here
+		std::vector<UniformBlockBuffer> uniformBlocks;
+		//Textures by uniform name, kept across programs so cached ones don't reupload
+		std::vector<UniformTexture> uniformTextures;
+		bool needPruneUniformTextures = false;
+		GLint maxTextureUnits = 16;
+
 		bool skipFrame = false;
 		bool isInPreview = false;
 		bool needClearTargets = false;
@@ -83,8 +194,47 @@ namespace app
 	{
 		GLuint program;
 		RenderStage stage;
+		Render* render;
+		UniformTable* uniforms;
 	};
 
+	std::string GetUniformName(std::string_view baseName, uint32_t objectId)
+	{
+		if (objectId == UniformNoObject)
+		{
+			return std::string(baseName);
+		}
+		return fmt::format("u_{}_{}", baseName, objectId);
+	}
+	GLint GetUniformLocation(UniformTable& table, GLuint program, std::string_view baseName, uint32_t objectId = UniformNoObject)
+	{
+		auto key = HashString(baseName) ^ (uint64_t(objectId) * 0x9E3779B97F4A7C15ull);
+		auto found = table.bindings.find(key);
+		if (found != table.bindings.end())
+		{
+			const auto& binding = found->second;
+			if (binding.objectId == objectId && binding.baseName == baseName)
+			{
+				return binding.location;
+			}
+			//Hash collision, rare enough to go through GL every time
+			return glGetUniformLocation(program, GetUniformName(baseName, objectId).c_str());
+		}
+		auto location = glGetUniformLocation(program, GetUniformName(baseName, objectId).c_str());
+		table.bindings.emplace(key, UniformBinding{ std::string(baseName), objectId, location });
+		return location;
+	}
+	GLint GetUniformLocation(Render* render, GLuint program, std::string_view name)
+	{
+		return GetUniformLocation(render->uniformTables[program], program, name);
+	}
+	//Program names get reused by GL, so cached locations must go with it
+	void DeleteProgram(Render* render, GLuint program)
+	{
+		render->uniformTables.erase(program);
+		glDeleteProgram(program);
+	}
+
 	GLuint CompileShader(const std::string& src, GLenum type)
 	{
 		auto shader = glCreateShader(type);
@@ -94,17 +244,24 @@ namespace app
 		return shader;
 	}
 
-	GLuint BuildShaderProgram(GLuint* target, GLuint vertexShader, GLuint fragmentShader)
+	GLuint StartShaderProgramLink(GLuint vertexShader, GLuint fragmentShader, bool retrievableBinary)
 	{
-		if (target)
-		{
-			glDeleteProgram(*target);
-		}
 		auto program = glCreateProgram();
 		glAttachShader(program, vertexShader);
 		glAttachShader(program, fragmentShader);
+#ifndef __EMSCRIPTEN__
+		if (retrievableBinary)
+		{
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+#endif
 		glLinkProgram(program);
+		return program;
+	}
 
+	//Blocks until link is done unless GL_COMPLETION_STATUS_KHR reported completion already
+	bool FinishShaderProgramLink(GLuint program)
+	{
 		GLint isLinked = 0;
 		glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
 		if (isLinked == GL_FALSE)
@@ -122,6 +279,17 @@ namespace app
 			}
 #endif
 		}
+		return isLinked == GL_TRUE;
+	}
+
+	GLuint BuildShaderProgram(GLuint* target, GLuint vertexShader, GLuint fragmentShader, bool retrievableBinary = false)
+	{
+		if (target)
+		{
+			glDeleteProgram(*target);
+		}
+		auto program = StartShaderProgramLink(vertexShader, fragmentShader, retrievableBinary);
+		FinishShaderProgramLink(program);
 
 		if (target)
 		{
@@ -175,10 +343,13 @@ namespace app
 
 		glGenFramebuffers(1, &fb);
 		glBindFramebuffer(GL_FRAMEBUFFER, fb);
+		std::vector<GLenum> drawBuffers;
 		for (int i = 0; i < int(textures.size()); ++i)
 		{
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
+			drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
 		}
+		glDrawBuffers(GLsizei(drawBuffers.size()), drawBuffers.data());
 		glClearColor(0, 0, 0, 0);
 		glClear(GL_COLOR_BUFFER_BIT);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -196,11 +367,25 @@ namespace app
 		BuildTexture(&target.texture, dimensions, internalFormat, filterMode);
 		BuildFramebuffer(&target.framebuffer, { target.texture });
 	}
+	//Sum goes to first attachment, moments to second, trace_frag.glsl writes both
+	void BuildTraceRenderTarget(RenderTarget& target, glm::ivec2 dimensions)
+	{
+		BuildTexture(&target.texture, dimensions, GL_RGBA32F, GL_LINEAR);
+		BuildTexture(&target.momentsTexture, dimensions, GL_RGBA32F, GL_LINEAR);
+		BuildFramebuffer(&target.framebuffer, { target.texture, target.momentsTexture });
+	}
 
 	std::string PatchTraceShader(Render* render, std::string src)
 	{
 		static const char* ShaderContentStub = R"xxx(
-TraceResult TraceScene(vec2 pt, vec2 dir)
+void SceneBoundsInit()
+{
+}
+float SceneDistance(vec2 pt, vec2 dir)
+{
+	return MAX_TRACE_DST;
+}
+TraceResult SceneMaterialAt(vec2 pt, vec2 dir)
 {
     TraceResult res;
 	res.dst = MAX_TRACE_DST;
@@ -208,7 +393,24 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
     return res;
 })xxx";
 
-		ReplaceSubstr(src, "{codegen_scene}", render->shaderContent.empty() ? ShaderContentStub : render->shaderContent);
+		if (render->useSceneInterpreter)
+		{
+			ReplaceSubstr(src, "{codegen_scene}", "");
+		}
+		else
+		{
+			ReplaceSubstr(src, "{codegen_scene}", render->shaderContent.empty() ? ShaderContentStub : render->shaderContent);
+		}
+		ReplaceSubstr(src, "{codegen_scene_interpreter}", render->useSceneInterpreter ? "1" : "0");
+		ReplaceSubstr(src, "{codegen_scene_stack_max}", std::to_string(SceneProgramStackMax));
+		ReplaceSubstr(src, "{codegen_trace_mode}", std::to_string(int(render->traceMode)));
+		ReplaceSubstr(src, "{codegen_next_event_estimation}", render->nextEventEstimation ? "1" : "0");
+		ReplaceSubstr(src, "{codegen_lights_max}", std::to_string(SceneLightsMax));
+		{
+			auto m = GetSpectralToRGB();
+			ReplaceSubstr(src, "{codegen_spectral_to_rgb}", fmt::format("mat3({:.9g}, {:.9g}, {:.9g}, {:.9g}, {:.9g}, {:.9g}, {:.9g}, {:.9g}, {:.9g})",
+				m[0][0], m[0][1], m[0][2], m[1][0], m[1][1], m[1][2], m[2][0], m[2][1], m[2][2]));
+		}
 		ReplaceSubstr(src, "{codegen_uniforms}", "");
 		ReplaceSubstr(src, "{codegen_samples_per_pixel}", std::to_string(render->samplesPerPixel));
 		ReplaceSubstr(src, "{codegen_max_rays_per_sample}", std::to_string(render->maxRaysPerSample));
@@ -217,6 +419,279 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 		return src;
 	}
 
+	//Rows of 1024 texels, read with SceneDataFetch in trace_frag.glsl
+	void UploadDataTexture(GLuint texture, std::vector<glm::vec4> texels)
+	{
+		const int textureWidth = 1024;
+		glm::ivec2 size{ textureWidth, std::max((int(texels.size()) + textureWidth - 1) / textureWidth, 1) };
+		texels.resize(size_t(size.x) * size.y, glm::vec4(0.f));
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, texels.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	//Half floats are filterable everywhere, unlike RGBA32F
+	void UploadImageTexture(GLuint texture, glm::ivec2 size, const glm::vec4* texels)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, texels);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	//Texel layout expected by SceneMaterialAt in the SCENE_INTERPRETER part of trace_frag.glsl
+	void UploadSceneProgram(Render* render, const SceneProgram& program)
+	{
+		std::vector<glm::vec4> texels;
+		bool isTooDeep = !program.IsValid();
+#ifdef PROJECT_BUILD_DEV
+		if (isTooDeep && !render->sceneProgramTooDeep)
+		{
+			render->shaderBuildErrors += fmt::format("\nScene program nests deeper than {} levels, interpreter draws nothing", SceneProgramStackMax);
+		}
+#endif
+		render->sceneProgramTooDeep = isTooDeep;
+		if (!render->sceneProgramTooDeep)
+		{
+			int pointsOffset = int(program.instructions.size()) * 2;
+			int dataOffset = pointsOffset + int(program.points.size());
+			for (const auto& ins : program.instructions)
+			{
+				auto params = ins.params;
+				if (ins.op == SceneOp::Polygon || ins.op == SceneOp::Segment || ins.op == SceneOp::Bezier)
+				{
+					params.x += float(pointsOffset);
+				}
+				else if (ins.op == SceneOp::PolygonGrid || ins.op == SceneOp::DistanceField)
+				{
+					params.x += float(dataOffset);
+				}
+				texels.emplace_back(float(ins.op), float(ins.material), float(ins.arg), 0.f);
+				texels.push_back(params);
+			}
+			for (auto pt : program.points)
+			{
+				texels.emplace_back(pt, 0.f, 0.f);
+			}
+			texels.insert(texels.end(), program.data.begin(), program.data.end());
+			render->sceneProgramSize = int(program.instructions.size());
+		}
+		else
+		{
+			render->sceneProgramSize = 0;
+		}
+		render->sceneMaterialsOffset = int(texels.size());
+		for (const auto& material : program.materials)
+		{
+			texels.emplace_back(material.emission, material.cauchy.x);
+			texels.emplace_back(material.refractionIndex, material.cauchy.y);
+			texels.emplace_back(material.absorption, 0.f);
+		}
+
+		if (render->sceneProgramTexture == 0)
+		{
+			glGenTextures(1, &render->sceneProgramTexture);
+		}
+		UploadDataTexture(render->sceneProgramTexture, std::move(texels));
+	}
+
+	bool IsProgramLinked(GLuint program)
+	{
+		GLint isLinked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+		return isLinked == GL_TRUE;
+	}
+	bool IsProgramCached(const Render* render, GLuint program)
+	{
+		return std::any_of(render->programCache.begin(), render->programCache.end(), [program](const auto& entry)
+		{
+			return entry.program == program;
+		});
+	}
+	//Substituted values are part of the source already, they are hashed again so the key never depends on patching details
+	//Both stages are part of the key, fragment source already carries every codegen value
+	uint64_t GetTraceProgramKey(const Render* render, const std::string& vertSrc, const std::string& fragSrc)
+	{
+		auto key = HashString(vertSrc, render->driverHash);
+		key = HashString(fragSrc, key);
+		return HashString(fmt::format("{}|{}|{}|{}", render->samplesPerPixel, render->maxRaysPerSample, render->rayHitDst, render->rayMissDst), key);
+	}
+	std::string GetProgramBinaryPath(uint64_t key)
+	{
+		return fmt::format("./shader_cache/{:016x}.bin", key);
+	}
+	//Binary file is GLenum format followed by driver blob, drivers reject blobs from other versions at link time
+	GLuint LoadProgramBinary(const Render* render, uint64_t key)
+	{
+#ifndef __EMSCRIPTEN__
+		if (!render->programBinarySupported)
+		{
+			return 0;
+		}
+		auto path = GetProgramBinaryPath(key);
+		std::vector<uint8_t> data;
+		GLenum format = 0;
+		if (auto* file = std::fopen(path.c_str(), "rb"))
+		{
+			fseek(file, 0, SEEK_END);
+			auto size = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			if (size > long(sizeof(format)) && fread(&format, sizeof(format), 1, file) == 1)
+			{
+				data.resize(size - sizeof(format));
+				data.resize(fread(data.data(), sizeof(uint8_t), data.size(), file));
+			}
+			fclose(file);
+		}
+		if (data.empty())
+		{
+			return 0;
+		}
+		auto program = glCreateProgram();
+		glProgramBinary(program, format, data.data(), GLsizei(data.size()));
+		if (!IsProgramLinked(program))
+		{
+			glDeleteProgram(program);
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+			return 0;
+		}
+		return program;
+#else
+		return 0;
+#endif
+	}
+	void SaveProgramBinary(const Render* render, uint64_t key, GLuint program)
+	{
+#ifndef __EMSCRIPTEN__
+		if (!render->programBinarySupported)
+		{
+			return;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+		std::vector<uint8_t> data(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, data.data());
+		std::error_code ec;
+		std::filesystem::create_directories("./shader_cache", ec);
+		if (auto* file = std::fopen(GetProgramBinaryPath(key).c_str(), "wb"))
+		{
+			fwrite(&format, sizeof(format), 1, file);
+			fwrite(data.data(), sizeof(uint8_t), size_t(length), file);
+			fclose(file);
+		}
+#endif
+	}
+	void AddCachedTraceProgram(Render* render, uint64_t key, GLuint program)
+	{
+		auto& cache = render->programCache;
+		cache.push_back({ key, program });
+		while (int(cache.size()) > std::max(render->programCacheCapacity, 1))
+		{
+			DeleteProgram(render, cache.front().program);
+			cache.erase(cache.begin());
+		}
+	}
+	//Memory cache, then on-disk binary, 0 if program has to be compiled
+	GLuint FindCachedTraceProgram(Render* render, uint64_t key)
+	{
+		auto& cache = render->programCache;
+		auto found = std::find_if(cache.begin(), cache.end(), [key](const auto& entry)
+		{
+			return entry.key == key;
+		});
+		if (found != cache.end())
+		{
+			auto entry = *found;
+			cache.erase(found);
+			cache.push_back(entry);
+			return entry.program;
+		}
+		auto program = LoadProgramBinary(render, key);
+		if (program != 0)
+		{
+			AddCachedTraceProgram(render, key, program);
+		}
+		return program;
+	}
+	GLuint StartTraceProgramBuild(const std::string& vertSrc, const std::string& fragSrc)
+	{
+		auto fsQuad = CompileShader(vertSrc.c_str(), GL_VERTEX_SHADER);
+		auto traceFrag = CompileShader(fragSrc.c_str(), GL_FRAGMENT_SHADER);
+		auto program = StartShaderProgramLink(fsQuad, traceFrag, true);
+		glDeleteShader(fsQuad);
+		glDeleteShader(traceFrag);
+		return program;
+	}
+	bool IsProgramLinkDone(const Render* render, GLuint program)
+	{
+		if (!render->parallelCompileSupported)
+		{
+			return true;
+		}
+		GLint isDone = GL_FALSE;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &isDone);
+		return isDone == GL_TRUE;
+	}
+	void CancelPendingTraceProgram(Render* render)
+	{
+		DeleteProgram(render, render->pendingTrace.program);
+		render->pendingTrace = PendingProgram{};
+	}
+	//Synchronous path, programs that fail to link are returned uncached
+	GLuint AcquireTraceProgram(Render* render, const std::string& vertSrc, const std::string& fragSrc)
+	{
+		auto key = GetTraceProgramKey(render, vertSrc, fragSrc);
+		if (auto program = FindCachedTraceProgram(render, key))
+		{
+			return program;
+		}
+		auto program = StartTraceProgramBuild(vertSrc, fragSrc);
+		if (FinishShaderProgramLink(program))
+		{
+			SaveProgramBinary(render, key, program);
+			AddCachedTraceProgram(render, key, program);
+		}
+		return program;
+	}
+	void SetTraceProgram(Render* render, GLuint program, bool isInterpreted, TraceMode traceMode)
+	{
+		if (render->programTrace != program && !IsProgramCached(render, render->programTrace))
+		{
+			DeleteProgram(render, render->programTrace);
+		}
+		render->programTrace = program;
+		render->programTraceInterpreted = isInterpreted;
+		render->programTraceMode = traceMode;
+		render->needPruneUniformTextures = true;
+	}
+	//Drops textures of objects the current program didn't bind on its first fill
+	void PruneUniformTextures(Render* render)
+	{
+		auto& textures = render->uniformTextures;
+		for (const auto& texture : textures)
+		{
+			if (!texture.isBound)
+			{
+				glDeleteTextures(1, &texture.texture);
+			}
+		}
+		std::erase_if(textures, [](const auto& texture)
+		{
+			return !texture.isBound;
+		});
+	}
+
 	Render* RenderInit()
 	{
 		auto* render = new Render();
@@ -226,26 +701,54 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 		render->needRebuildTargets = true;
 		render->needRebuildTraceProgram = true;
 		{
+#ifndef __EMSCRIPTEN__
+			GLint binaryFormatCount = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCount);
+			render->programBinarySupported = binaryFormatCount > 0;
+#endif
+			auto* vendor = (const char*)glGetString(GL_VENDOR);
+			auto* renderer = (const char*)glGetString(GL_RENDERER);
+			auto* version = (const char*)glGetString(GL_VERSION);
+			render->driverHash = HashString(fmt::format("{}|{}|{}", vendor ? vendor : "", renderer ? renderer : "", version ? version : ""));
+
+			glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &render->maxTextureUnits);
+
+			GLint extensionCount = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+			for (int i = 0; i < extensionCount; ++i)
+			{
+				auto* name = (const char*)glGetStringi(GL_EXTENSIONS, GLuint(i));
+				if (name && std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0)
+				{
+					render->parallelCompileSupported = true;
+				}
+			}
+		}
+		{
 			auto fsQuadVertexSrc = PlatformGetFile("fsquad_vert.glsl");
 			auto traceFragSrc = PlatformGetFile("trace_frag.glsl");
 			auto presentFragSrc = PlatformGetFile("present_tex_frag.glsl");
 			auto accumulateFragSrc = PlatformGetFile("accumulate_tex_frag.glsl");
+			auto tileStatsFragSrc = PlatformGetFile("tile_stats_frag.glsl");
 
 			traceFragSrc = PatchTraceShader(render, traceFragSrc);
 
 			auto fsQuad = CompileShader(fsQuadVertexSrc.c_str(), GL_VERTEX_SHADER);
-			auto traceFrag = CompileShader(traceFragSrc.c_str(), GL_FRAGMENT_SHADER);
 			auto presentFrag = CompileShader(presentFragSrc.c_str(), GL_FRAGMENT_SHADER);
 			auto accFrag = CompileShader(accumulateFragSrc.c_str(), GL_FRAGMENT_SHADER);
+			auto tileStatsFrag = CompileShader(tileStatsFragSrc.c_str(), GL_FRAGMENT_SHADER);
 
-			render->programTrace = BuildShaderProgram(nullptr, fsQuad, traceFrag);
+			render->programTrace = AcquireTraceProgram(render, fsQuadVertexSrc, traceFragSrc);
+			render->programTraceInterpreted = render->useSceneInterpreter;
+			render->programTraceMode = render->traceMode;
 			render->programPresent = BuildShaderProgram(nullptr, fsQuad, presentFrag);
 			render->programAccumulate = BuildShaderProgram(nullptr, fsQuad, accFrag);
+			render->programTileStats = BuildShaderProgram(nullptr, fsQuad, tileStatsFrag);
 
 			glDeleteShader(fsQuad);
-			glDeleteShader(traceFrag);
 			glDeleteShader(presentFrag);
 			glDeleteShader(accFrag);
+			glDeleteShader(tileStatsFrag);
 		}
 		RenderInvalidateIntegration(render);
 		return render;
@@ -285,13 +788,114 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 		}
 		return tile;
 	}
+	//Repeats bound accumulate pass into few texels, small enough to read back once per step
+	void UpdateSplitRate(Render* render)
+	{
+		glViewport(0, 0, render->splitStatsSize.x, render->splitStatsSize.y);
+		glBindFramebuffer(GL_FRAMEBUFFER, render->splitStatsRT.framebuffer);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		std::vector<glm::vec4> texels(size_t(render->splitStatsSize.x) * render->splitStatsSize.y);
+		glReadPixels(0, 0, render->splitStatsSize.x, render->splitStatsSize.y, GL_RGBA, GL_FLOAT, texels.data());
+		float sum = 0.f;
+		for (const auto& texel : texels)
+		{
+			sum += texel.a;
+		}
+		render->splitRate = sum / float(texels.size());
+	}
+	//Relative error per tile from sums and moments of trace target, see tile_stats_frag.glsl
+	void UpdateTileErrors(Render* render)
+	{
+		auto tileCount = render->tileInfo.tileCount;
+		glViewport(0, 0, tileCount.x, tileCount.y);
+		glBindFramebuffer(GL_FRAMEBUFFER, render->tileStatsRT.framebuffer);
+		auto program = render->programTileStats;
+		glUseProgram(program);
+		glUniform2i(GetUniformLocation(render, program, "u_tile_size"), render->tileInfo.tileSize.x, render->tileInfo.tileSize.y);
+		glUniform1i(GetUniformLocation(render, program, "u_tex0"), 0);
+		glUniform1i(GetUniformLocation(render, program, "u_tex1"), 1);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, render->traceRT.momentsTexture);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, render->traceRT.texture);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		std::vector<glm::vec4> texels(size_t(tileCount.x) * tileCount.y);
+		glReadPixels(0, 0, tileCount.x, tileCount.y, GL_RGBA, GL_FLOAT, texels.data());
+		for (size_t i = 0; i < texels.size() && i < render->tileErrors.size(); ++i)
+		{
+			render->tileErrors[i] = texels[i].r;
+		}
+	}
+	//Error of a tile mean falls with square root of its steps, that gives steps left until threshold
+	int GetTileStepsLeft(const Render* render, int tile)
+	{
+		int steps = render->tileSteps[tile];
+		int left = render->traceStepsTarget - steps;
+		if (!render->adaptiveSampling || left <= 0)
+		{
+			return std::max(left, 0);
+		}
+		if (steps < render->adaptiveMinSteps)
+		{
+			return std::min(render->adaptiveMinSteps - steps, left);
+		}
+		float ratio = render->tileErrors[tile] / std::max(render->noiseThreshold, 1e-6f);
+		if (ratio <= 1.f)
+		{
+			return 0;
+		}
+		return int(std::min(std::ceil(float(steps) * (ratio * ratio - 1.f)), float(left)));
+	}
+	//Next round: every unfinished tile once, noisier ones more often in proportion to their error
+	void ScheduleTiles(Render* render)
+	{
+		render->tileSchedule.clear();
+		int tileCount = int(render->tileSteps.size());
+		float maxError = 0.f;
+		for (int t = 0; t < tileCount; ++t)
+		{
+			if (GetTileStepsLeft(render, t) > 0)
+			{
+				maxError = std::max(maxError, render->tileErrors[t]);
+			}
+		}
+		int stepsLeft = 0;
+		render->tilesActive = 0;
+		for (int t = 0; t < tileCount; ++t)
+		{
+			int left = GetTileStepsLeft(render, t);
+			if (left <= 0)
+			{
+				continue;
+			}
+			stepsLeft += left;
+			render->tilesActive++;
+			int repeats = 1;
+			if (render->adaptiveSampling && render->tileSteps[t] >= render->adaptiveMinSteps && maxError > 0.f)
+			{
+				repeats = std::clamp(int(std::ceil(float(TileStepsPerRoundMax) * render->tileErrors[t] / maxError)), 1, std::min(left, TileStepsPerRoundMax));
+			}
+			for (int i = 0; i < repeats; ++i)
+			{
+				render->tileSchedule.push_back({ t, render->tileSteps[t]++ });
+			}
+		}
+		render->secondsToConvergence = float(stepsLeft) * render->secondsPerTileStep;
+		render->roundStart = std::chrono::steady_clock::now();
+	}
 	void RenderInvalidateIntegration(Render* render)
 	{
 		render->isInPreview = true;
 		render->traceStepsCurrent = 0;
 		render->tilesRendered = 0;
+		int tileCount = render->tileInfo.tileCount.x * render->tileInfo.tileCount.y;
+		render->tileSteps.assign(tileCount, 0);
+		render->tileErrors.assign(tileCount, 0.f);
+		render->tileSchedule.clear();
+		render->tilesActive = tileCount;
 		render->needClearTargets = true;
 		render->currentColor = 0;
+		render->needUploadSceneProgram = true;
 	}
 	void RenderFrame(Render* render)
 	{
@@ -313,69 +917,147 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 
 		if (render-> needRebuildTargets)
 		{
-			BuildRenderTarget(render->traceRT, renderTextureSize, GL_RGBA32F, GL_LINEAR);
-			BuildRenderTarget(render->tracePreviewRT, previewTextureSize, GL_RGBA32F, GL_LINEAR);
+			BuildTraceRenderTarget(render->traceRT, renderTextureSize);
+			BuildTraceRenderTarget(render->tracePreviewRT, previewTextureSize);
 			BuildRenderTarget(render->accumulateRT, render->renderResolution, GL_RGBA32F, GL_LINEAR);
 			BuildRenderTarget(render->presentRT, render->renderResolution, GL_RGBA8, GL_LINEAR);
+			BuildRenderTarget(render->splitStatsRT, render->splitStatsSize, GL_RGBA32F, GL_NEAREST);
 
 			render->tileInfo = GenerateTileGrid(renderTextureSize, render->tileSize);
+			BuildRenderTarget(render->tileStatsRT, render->tileInfo.tileCount, GL_RGBA32F, GL_NEAREST);
 			RenderInvalidateIntegration(render);
 			render->needRebuildTargets = false;
 		}
 		if (render->needRebuildTraceProgram)
 		{
 #ifdef PROJECT_BUILD_DEV
-			GetRender()->shaderBuildErrors.clear();
+			render->shaderBuildErrors.clear();
 #endif
-			RenderInvalidateIntegration(render);
+			CancelPendingTraceProgram(render);
 			auto fsQuadVertexSrc = PlatformGetFile("fsquad_vert.glsl");
 			auto traceFragSrc = PlatformGetFile("trace_frag.glsl");
 			traceFragSrc = PatchTraceShader(render, traceFragSrc);
-			auto fsQuad = CompileShader(fsQuadVertexSrc.c_str(), GL_VERTEX_SHADER);
-			auto traceFrag = CompileShader(traceFragSrc.c_str(), GL_FRAGMENT_SHADER);
-			BuildShaderProgram(&render->programTrace, fsQuad, traceFrag);
-			glDeleteShader(fsQuad);
-			glDeleteShader(traceFrag);
+			auto key = GetTraceProgramKey(render, fsQuadVertexSrc, traceFragSrc);
+			if (auto program = FindCachedTraceProgram(render, key))
+			{
+				SetTraceProgram(render, program, render->useSceneInterpreter, render->traceMode);
+				RenderInvalidateIntegration(render);
+			}
+			else
+			{
+				render->pendingTrace = { key, StartTraceProgramBuild(fsQuadVertexSrc, traceFragSrc), render->useSceneInterpreter, render->traceMode };
+			}
 			render->needRebuildTraceProgram = false;
 		}
+		if (render->pendingTrace.program != 0 && IsProgramLinkDone(render, render->pendingTrace.program))
+		{
+			auto pending = render->pendingTrace;
+			render->pendingTrace = PendingProgram{};
+			if (FinishShaderProgramLink(pending.program))
+			{
+				SetTraceProgram(render, pending.program, pending.isInterpreted, pending.traceMode);
+				SaveProgramBinary(render, pending.key, pending.program);
+				AddCachedTraceProgram(render, pending.key, pending.program);
+				RenderInvalidateIntegration(render);
+			}
+			else
+			{
+				//Broken program never gets installed, last working one keeps rendering
+				DeleteProgram(render, pending.program);
+#ifdef PROJECT_BUILD_DEV
+				render->shaderBuildErrors += "\nTrace program failed to link, keeping previous one";
+#endif
+			}
+		}
+		if (render->programTraceInterpreted && render->needUploadSceneProgram)
+		{
+			if (auto* scene = GetScene())
+			{
+				UploadSceneProgram(render, scene->GetProgram());
+			}
+			render->needUploadSceneProgram = false;
+		}
 
 		bool isInPreview = render->isInPreview;
 		auto& traceRT = isInPreview ? render->tracePreviewRT : render->traceRT;
 		auto renderResolution = isInPreview ? previewTextureSize : renderTextureSize;
 
-		int totalTileCount = render->tileInfo.tileCount.x * render->tileInfo.tileCount.y;
+		//Converged render keeps scheduling, so lowering noise threshold resumes it
+		if (!isInPreview && render->tileSchedule.empty())
+		{
+			ScheduleTiles(render);
+		}
+		int totalTileCount = int(render->tileSchedule.size());
 		int tilesRendered = render->tilesRendered;
 		int tilesToRender = std::min(render->tilesPerFrame, totalTileCount - tilesRendered);
 		int tileStartIdx = tilesRendered;
 		int tileEndIdx = tileStartIdx + tilesToRender;
 
 		bool presentAllowed = isInPreview;
+		bool isRoundDone = false;
 
-		if (render->traceStepsCurrent < render->traceStepsTarget)
+		if (render->traceStepsCurrent < render->traceStepsTarget && (isInPreview || totalTileCount > 0))
 		{
 			{
 				glBindFramebuffer(GL_FRAMEBUFFER, traceRT.framebuffer);
 				auto program = render-> programTrace;
 				glUseProgram(program);
 				{
-					auto loc = glGetUniformLocation(program, "u_random_seed");
-					float v = float(render->traceStepsCurrent) / render->traceStepsTarget;
-					glUniform1f(loc, v);
+					auto loc = GetUniformLocation(render, program, "u_step");
+					glUniform1i(loc, render->traceStepsCurrent);
 				}
 				{
-					auto loc = glGetUniformLocation(program, "u_tex0_size");
+					auto loc = GetUniformLocation(render, program, "u_tex0_size");
 					glUniform2f(loc, renderResolution.x, renderResolution.y);
 				}
 				UniformFillRequest req{};
 				req.program = program;
-				if (auto* scene = GetScene())
+				req.render = render;
+				req.uniforms = &render->uniformTables[program];
+				auto fillStageUniforms = [&](RenderStage stage)
+				{
+					if (stage != RenderStage::Common)
+					{
+						glUniform1i(GetUniformLocation(*req.uniforms, program, "u_channel"), int(stage));
+					}
+					if (render->programTraceInterpreted)
+					{
+						if (stage == RenderStage::Common)
+						{
+							glUniform1i(GetUniformLocation(*req.uniforms, program, "u_scene_program"), 0);
+							glUniform1i(GetUniformLocation(*req.uniforms, program, "u_scene_program_size"), render->sceneProgramSize);
+							glUniform1i(GetUniformLocation(*req.uniforms, program, "u_scene_materials_offset"), render->sceneMaterialsOffset);
+							glActiveTexture(GL_TEXTURE0);
+							glBindTexture(GL_TEXTURE_2D, render->sceneProgramTexture);
+							if (auto* scene = GetScene())
+							{
+								scene->FillLightUniforms(&req);
+							}
+						}
+					}
+					else if (auto* scene = GetScene())
+					{
+						req.stage = stage;
+						scene->FillShaderUniforms(&req);
+					}
+				};
+				bool pruneTextures = render->needPruneUniformTextures;
+				if (pruneTextures)
+				{
+					for (auto& texture : render->uniformTextures)
+					{
+						texture.isBound = false;
+					}
+					render->needPruneUniformTextures = false;
+				}
+				fillStageUniforms(RenderStage::Common);
+				if (pruneTextures)
 				{
-					req.stage = RenderStage::Common;
-					scene->FillShaderUniforms(&req);
+					PruneUniformTextures(render);
 				}
 				if (render->needClearTargets)
 				{
-					glClearColor(0.f, 0.f, 0.f, 1.f);
+					glClearColor(0.f, 0.f, 0.f, 0.f);
 					glClear(GL_COLOR_BUFFER_BIT);
 					glDisable(GL_BLEND);
 					render->needClearTargets = false;
@@ -385,17 +1067,21 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 					glEnable(GL_BLEND);
 					glBlendFunc(GL_ONE, GL_ONE);
 				}
+				//Shared path and spectral modes write all channels and split fraction to alpha in one draw
+				bool isSinglePass = render->programTraceMode != TraceMode::ChannelPasses;
+				int channelPasses = isSinglePass ? 1 : 3;
 				if (isInPreview)
 				{
-					for (int i = 0; i < 3; ++i)
+					for (int i = 0; i < channelPasses; ++i)
 					{
-						if (auto* scene = GetScene())
+						fillStageUniforms(RenderStage(i));
+						//Last channel pass also counts the step in moments alpha
+						GLboolean colorMask[4] = { GL_FALSE, GL_FALSE, GL_FALSE , i == channelPasses - 1 };
+						colorMask[i] = GL_TRUE;
+						if (isSinglePass)
 						{
-							req.stage = RenderStage(i);
-							scene->FillShaderUniforms(&req);
+							std::fill(std::begin(colorMask), std::end(colorMask), GL_TRUE);
 						}
-						GLboolean colorMask[4] = { GL_FALSE, GL_FALSE, GL_FALSE , GL_FALSE };
-						colorMask[i] = GL_TRUE;
 						glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
 						glViewport(0, 0, GLsizei(renderResolution.x), GLsizei(renderResolution.y));
 						glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -404,17 +1090,20 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 				else
 				{
 					int i = render->currentColor;
-					if (auto* scene = GetScene())
+					fillStageUniforms(RenderStage(i));
+					GLboolean colorMask[4] = { GL_FALSE, GL_FALSE, GL_FALSE , i == channelPasses - 1 };
+					colorMask[i] = GL_TRUE;
+					if (isSinglePass)
 					{
-						req.stage = RenderStage(i);
-						scene->FillShaderUniforms(&req);
+						std::fill(std::begin(colorMask), std::end(colorMask), GL_TRUE);
 					}
-					GLboolean colorMask[4] = { GL_FALSE, GL_FALSE, GL_FALSE , GL_FALSE };
-					colorMask[i] = GL_TRUE;
 					glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+					auto stepLoc = GetUniformLocation(render, program, "u_step");
 					for (int t = tileStartIdx; t < tileEndIdx; ++t)
 					{
-						auto tile = GetTile(render->tileInfo, t);
+						const auto& draw = render->tileSchedule[t];
+						auto tile = GetTile(render->tileInfo, draw.tile);
+						glUniform1i(stepLoc, draw.step);
 						glViewport(tile.origin.x, tile.origin.y, tile.size.x, tile.size.y);
 						glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 					}
@@ -429,7 +1118,7 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 				else
 				{
 					render->currentColor++;
-					if (render->currentColor == 3)
+					if (render->currentColor == channelPasses)
 					{
 						render->currentColor = 0;
 						render->tilesRendered += tilesToRender;
@@ -438,6 +1127,7 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 							render->traceStepsCurrent++;
 							render->tilesRendered = 0;
 							presentAllowed = true;
+							isRoundDone = true;
 						}
 					}
 				}
@@ -454,16 +1144,31 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 			auto program = render->programAccumulate;
 			glUseProgram(program);
 			{
-				auto loc = glGetUniformLocation(program, "u_sample_count");
-				glUniform1f(loc, float(std::max(render->traceStepsCurrent, 1)));
+				auto loc = GetUniformLocation(render, program, "u_tex1");
+				glUniform1i(loc, 1);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, traceRT.momentsTexture);
 			}
 			{
-				auto loc = glGetUniformLocation(program, "u_tex0");
+				auto loc = GetUniformLocation(render, program, "u_tex0");
 				glUniform1i(loc, 0);
 				glActiveTexture(GL_TEXTURE0);
 				glBindTexture(GL_TEXTURE_2D, traceRT.texture);
 			}
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			if (render->programTraceMode != TraceMode::ChannelPasses && render->splitRateRequested)
+			{
+				UpdateSplitRate(render);
+				render->splitRateRequested = false;
+			}
+		}
+		if (isRoundDone)
+		{
+			auto roundSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - render->roundStart).count();
+			render->secondsPerTileStep = roundSeconds / float(std::max(totalTileCount, 1));
+			//Errors stay current with adaptive sampling off, so turning it on takes effect right away
+			UpdateTileErrors(render);
+			render->tileSchedule.clear();
 		}
 		if (true)
 		{
@@ -474,18 +1179,18 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 			auto program = render->programPresent;
 			glUseProgram(program);
 			{
-				auto loc = glGetUniformLocation(program, "u_tex0");
+				auto loc = GetUniformLocation(render, program, "u_tex0");
 				glUniform1i(loc, 0);
 				glActiveTexture(GL_TEXTURE0);
 				glBindTexture(GL_TEXTURE_2D, render->accumulateRT.texture);
 				
 			}
 			{
-				auto loc = glGetUniformLocation(program, "u_exposure");
+				auto loc = GetUniformLocation(render, program, "u_exposure");
 				glUniform1f(loc, render->exposure);
 			}
 			{
-				auto loc = glGetUniformLocation(program, "u_gamma");
+				auto loc = GetUniformLocation(render, program, "u_gamma");
 				glUniform1f(loc, render->gamma);
 			}
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -498,10 +1203,28 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 	}
 	void RenderDeinit(Render* render)
 	{
-		glDeleteProgram(render->programTrace);
-		glDeleteProgram(render->programPresent);
-		std::vector<GLuint> textures = { render->traceRT.texture, render->tracePreviewRT.texture, render->presentRT.texture };
-		std::vector<GLuint> fbos = { render->traceRT.framebuffer, render->tracePreviewRT.framebuffer, render->presentRT.framebuffer };
+		CancelPendingTraceProgram(render);
+		SetTraceProgram(render, 0, false, TraceMode::ChannelPasses);
+		for (const auto& entry : render->programCache)
+		{
+			DeleteProgram(render, entry.program);
+		}
+		DeleteProgram(render, render->programPresent);
+		DeleteProgram(render, render->programAccumulate);
+		DeleteProgram(render, render->programTileStats);
+		for (const auto& block : render->uniformBlocks)
+		{
+			glDeleteBuffers(1, &block.buffer);
+		}
+		for (const auto& texture : render->uniformTextures)
+		{
+			glDeleteTextures(1, &texture.texture);
+		}
+		glDeleteTextures(1, &render->sceneProgramTexture);
+		std::vector<GLuint> textures = { render->traceRT.texture, render->traceRT.momentsTexture, render->tracePreviewRT.texture, render->tracePreviewRT.momentsTexture,
+			render->presentRT.texture, render->splitStatsRT.texture, render->tileStatsRT.texture };
+		std::vector<GLuint> fbos = { render->traceRT.framebuffer, render->tracePreviewRT.framebuffer, render->presentRT.framebuffer, render->splitStatsRT.framebuffer,
+			render->tileStatsRT.framebuffer };
 		glDeleteFramebuffers(GLsizei(fbos.size()), fbos.data());
 		glDeleteTextures(GLsizei(textures.size()), textures.data());
 		delete render;
@@ -533,12 +1256,111 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 	void RenderSetShaderContent(Render* render, const std::string& content)
 	{
 		render->shaderContent = content;
-		render->needRebuildTraceProgram = true;
+		if (render->useSceneInterpreter)
+		{
+			RenderInvalidateIntegration(render);
+		}
+		else
+		{
+			render->needRebuildTraceProgram = true;
+		}
 	}
 	RenderStage GetRenderStage(UniformFillRequest* req)
 	{
 		return req->stage;
 	}
+	void FillUniformBlock(UniformFillRequest* req, std::string_view blockName, const void* data, size_t size)
+	{
+		auto& blocks = req->render->uniformBlocks;
+		auto found = std::find_if(blocks.begin(), blocks.end(), [&](const auto& block)
+		{
+			return block.name == blockName;
+		});
+		if (found == blocks.end())
+		{
+			UniformBlockBuffer block{};
+			block.name = blockName;
+			glGenBuffers(1, &block.buffer);
+			found = blocks.insert(blocks.end(), block);
+		}
+		auto binding = GLuint(found - blocks.begin());
+		auto& boundBlocks = req->uniforms->boundBlocks;
+		if (std::find(boundBlocks.begin(), boundBlocks.end(), blockName) == boundBlocks.end())
+		{
+			auto index = glGetUniformBlockIndex(req->program, std::string(blockName).c_str());
+			if (index != GL_INVALID_INDEX)
+			{
+				glUniformBlockBinding(req->program, index, binding);
+			}
+			boundBlocks.emplace_back(blockName);
+		}
+		//Orphans previous storage, stages reupload same block between draws
+		glBindBuffer(GL_UNIFORM_BUFFER, found->buffer);
+		glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(size), data, GL_STREAM_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, found->buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	//Texture units are handed out per program by order of first use, upload runs only when version changes
+	template<class Upload>
+	void BindUniformTexture(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, uint64_t version, Upload&& upload)
+	{
+		auto* render = req->render;
+		auto name = GetUniformName(baseName, objectId);
+		auto& units = req->uniforms->textureUnits;
+		auto foundUnit = std::find(units.begin(), units.end(), name);
+		if (foundUnit == units.end())
+		{
+			foundUnit = units.insert(units.end(), name);
+#ifdef PROJECT_BUILD_DEV
+			if (GLint(units.size()) >= render->maxTextureUnits)
+			{
+				render->shaderBuildErrors += fmt::format("\nOut of texture units for {}, limit is {}", name, render->maxTextureUnits);
+			}
+#endif
+		}
+		auto unit = GLint(foundUnit - units.begin()) + 1;
+		if (unit >= render->maxTextureUnits)
+		{
+			return;
+		}
+		auto& textures = render->uniformTextures;
+		auto found = std::find_if(textures.begin(), textures.end(), [&](const auto& texture)
+		{
+			return texture.name == name;
+		});
+		if (found == textures.end())
+		{
+			UniformTexture texture{};
+			texture.name = name;
+			glGenTextures(1, &texture.texture);
+			texture.version = ~version;
+			found = textures.insert(textures.end(), texture);
+		}
+		found->isBound = true;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		if (found->version != version)
+		{
+			upload(found->texture);
+			found->version = version;
+		}
+		glBindTexture(GL_TEXTURE_2D, found->texture);
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(GetUniformLocation(*req->uniforms, req->program, baseName, objectId), unit);
+	}
+	void FillUniformTexture(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, const std::vector<glm::vec4>& texels, uint64_t version)
+	{
+		BindUniformTexture(req, baseName, objectId, version, [&](GLuint texture)
+		{
+			UploadDataTexture(texture, texels);
+		});
+	}
+	void FillUniformImage(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, glm::ivec2 size, const glm::vec4* texels, uint64_t version)
+	{
+		BindUniformTexture(req, baseName, objectId, version, [&](GLuint texture)
+		{
+			UploadImageTexture(texture, size, texels);
+		});
+	}
 #ifdef PROJECT_BUILD_DEV
 	std::string RenderGetShaderBuildErrors(const Render* render)
 	{
@@ -555,8 +1377,43 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 			render->needRebuildTargets |= ImGui::DragFloat("Render scale", &render->renderScale, 0.1f, 1.f/8.f, 1.f, "%f", ImGuiSliderFlags_AlwaysClamp);
 			render->needRebuildTraceProgram |= ImGui::DragInt("Samples per pixel", &render->samplesPerPixel, 1.f, 1, 8, "%d", ImGuiSliderFlags_AlwaysClamp);
 			render->needRebuildTraceProgram |= ImGui::DragInt("Max rays per sample", &render->maxRaysPerSample, 1.f, 1, 16, "%d", ImGuiSliderFlags_AlwaysClamp);
+			render->needRebuildTraceProgram |= ImGui::Checkbox("Interpreted scene", &render->useSceneInterpreter);
+			auto traceMode = int(render->traceMode);
+			if (ImGui::Combo("Tracing", &traceMode, TraceModeNames, int(std::size(TraceModeNames))))
+			{
+				render->traceMode = TraceMode(traceMode);
+				render->needRebuildTraceProgram = true;
+			}
+			render->needRebuildTraceProgram |= ImGui::Checkbox("Light sampling", &render->nextEventEstimation);
 			ImGui::DragInt("Tiles per frame", &render->tilesPerFrame);
 			ImGui::Text("Steps: %d/%d", render->traceStepsCurrent, render->traceStepsTarget);
+			ImGui::Checkbox("Adaptive sampling", &render->adaptiveSampling);
+			if (render->adaptiveSampling)
+			{
+				ImGui::DragFloat("Noise threshold", &render->noiseThreshold, 0.0005f, 0.0001f, 1.f, "%.4f", ImGuiSliderFlags_AlwaysClamp);
+			}
+			int tileCount = int(render->tileSteps.size());
+			if (render->isInPreview || render->tilesActive > 0)
+			{
+				ImGui::Text("Tiles left: %d/%d, about %.0f s", render->tilesActive, tileCount, render->secondsToConvergence);
+			}
+			else
+			{
+				ImGui::TextUnformatted(render->adaptiveSampling ? "Converged" : "Done");
+			}
+			if (render->programTraceMode != TraceMode::ChannelPasses)
+			{
+				render->splitRateRequested = true;
+				ImGui::Text("Split paths: %.2f%% of samples", render->splitRate * 100.f);
+			}
+			if (render->pendingTrace.program != 0)
+			{
+				ImGui::Text("Compiling trace shader...");
+			}
+			if (render->programTraceInterpreted && render->sceneProgramTooDeep)
+			{
+				ImGui::Text("Scene nests deeper than %d levels, interpreter draws nothing", SceneProgramStackMax);
+			}
 			ImGui::EndTabItem();
 		}
 		return change;
@@ -591,9 +1448,9 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 #undef XXX_GL_IMPL_FN
 
 	template<class T, size_t Components>
-	void FillUniformV(UniformFillRequest* req, const std::string& name, size_t elements, const T* value)
+	void FillUniformV(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, size_t elements, const T* value)
 	{
-		auto location = glGetUniformLocation(req->program, name.c_str());
+		auto location = GetUniformLocation(*req->uniforms, req->program, baseName, objectId);
 		auto count = GLsizei(elements);
 #define XXX_GL_IMPL_FN(Type, ComponentCount, GLPrefix, UniformType) \
 		if constexpr (std::is_same_v<T, Type> && Components == ComponentCount) \
@@ -610,7 +1467,7 @@ TraceResult TraceScene(vec2 pt, vec2 dir)
 	XXX_GL_UNIFORM_TYPE(XXX_GL_INST_FN)
 #undef XXX_GL_INST_FN
 #define XXX_GL_INST_FN(Type, ComponentCount, GLPrefix, UniformType) \
-	template void FillUniformV<Type, ComponentCount>(UniformFillRequest* req, const std::string& name, size_t elements, const Type* value);
+	template void FillUniformV<Type, ComponentCount>(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, size_t elements, const Type* value);
 	XXX_GL_UNIFORM_TYPE(XXX_GL_INST_FN)
 #undef XXX_GL_INST_FN
 
@@ -19,6 +19,20 @@ namespace app
 	void RenderInvalidateIntegration(Render* render);
 	SceneChange RenderOnEditor(Render* render);
 
+	struct Tile
+	{
+		glm::ivec2 origin{};
+		glm::ivec2 size{};
+	};
+	struct TileGridInfo
+	{
+		glm::ivec2 tileCount{};
+		glm::ivec2 padTileSize{};
+		glm::ivec2 tileSize{};
+	};
+	TileGridInfo GenerateTileGrid(glm::ivec2 resolution, glm::ivec2 tileSize);
+	Tile GetTile(const TileGridInfo& tileInfo, int index);
+
 	float RenderGetExposure(const Render* render);
 	void RenderSetExposure(Render* render, float value);
 
@@ -37,20 +51,35 @@ namespace app
 	struct UniformFillRequest;
 	RenderStage GetRenderStage(UniformFillRequest* req);
 
+	//Object uniforms are named u_{baseName}_{objectId}, location is resolved once per program and reused
+	inline constexpr uint32_t UniformNoObject = ~0u;
+	std::string GetUniformName(std::string_view baseName, uint32_t objectId);
+
 	template<class T, size_t Components>
 	const char* GetUniformTypeName();
 	template<class T, size_t Components>
-	extern void FillUniformV(UniformFillRequest* req, const std::string& name, size_t elements, const T* value);
+	extern void FillUniformV(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, size_t elements, const T* value);
 	template<class T>
-	void FillUniform(UniformFillRequest* req, const std::string& name, T value)
+	void FillUniform(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, T value)
 	{
 		if constexpr (glm::type<T>::is_vec)
 		{
-			FillUniformV<typename T::value_type, glm::type<T>::components>(req, name, 1, glm::value_ptr(value));
+			FillUniformV<typename T::value_type, glm::type<T>::components>(req, baseName, objectId, 1, glm::value_ptr(value));
 		}
 		else
 		{
-			FillUniformV<T, 1>(req, name, 1, &value);
+			FillUniformV<T, 1>(req, baseName, objectId, 1, &value);
 		}
 	}
+	template<class T>
+	void FillUniform(UniformFillRequest* req, std::string_view name, T value)
+	{
+		FillUniform(req, name, UniformNoObject, value);
+	}
+	//Uploads whole std140 block, data has to match its declared layout
+	void FillUniformBlock(UniformFillRequest* req, std::string_view blockName, const void* data, size_t size);
+	//Binds RGBA32F data texture to sampler u_{baseName}_{objectId}, texels are uploaded again only when version changes
+	void FillUniformTexture(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, const std::vector<glm::vec4>& texels, uint64_t version);
+	//Binds size.x * size.y RGBA texels as linearly filtered texture to sampler u_{baseName}_{objectId}, same versioning
+	void FillUniformImage(UniformFillRequest* req, std::string_view baseName, uint32_t objectId, glm::ivec2 size, const glm::vec4* texels, uint64_t version);
 }
\ No newline at end of file
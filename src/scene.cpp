@@ -1,6 +1,9 @@
 #include "main.h"
 #include "scene.h"
 #include "editor.h"
+#include "polygon_grid.h"
+#include "distance_field.h"
+#include "scene_optimizer.h"
 #include <imgui.h>
 #include <imgui_internal.h>
 
@@ -10,11 +13,18 @@ namespace app
 	REGISTER_SCENE_OBJECT(SceneObjectCircle, Circle);
 	REGISTER_SCENE_OBJECT(SceneObjectRectangle, Rectangle);
 	REGISTER_SCENE_OBJECT(SceneObjectPolygon, Polygon);
+	REGISTER_SCENE_OBJECT(SceneObjectLargePolygon, LargePolygon);
+	REGISTER_SCENE_OBJECT(SceneObjectDistanceField, DistanceField);
+	REGISTER_SCENE_OBJECT(SceneObjectSegment, Segment);
+	REGISTER_SCENE_OBJECT(SceneObjectArc, Arc);
+	REGISTER_SCENE_OBJECT(SceneObjectEllipse, Ellipse);
+	REGISTER_SCENE_OBJECT(SceneObjectBezier, Bezier);
 	REGISTER_SCENE_OBJECT(SceneObjectUnion, Union);
 	REGISTER_SCENE_OBJECT(SceneObjectDifference, Difference);
 	REGISTER_SCENE_OBJECT(SceneObjectIntersection, Intersection);
 	REGISTER_SCENE_OBJECT(SceneObjectAnnular, Annular);
 	REGISTER_SCENE_OBJECT(SceneObjectMirror, Mirror);
+	REGISTER_SCENE_OBJECT(SceneObjectRepeat, Repeat);
 
 	static const char* SceneObjectDragDropTag = "SCENE_OBJECT_DRAG_DROP";
 
@@ -80,6 +90,19 @@ namespace app
 		}
 		return changed;
 	}
+	bool EditString(const std::string& label, std::string& value)
+	{
+		bool changed = false;
+		std::array<char, 2048> buf{};
+		memset(buf.data(), '\0', buf.size());
+		memcpy(buf.data(), value.c_str(), value.size());
+		if (ImGui::InputText(label.c_str(), buf.data(), buf.size()))
+		{
+			value = std::string(buf.data());
+			changed = true;
+		}
+		return changed;
+	}
 	bool EditMaterialHandle(const std::string& label, SceneMaterial::Handle& thisHandle, Scene& scene)
 	{
 		bool changed = false;
@@ -114,6 +137,113 @@ namespace app
 		}
 	}
 
+	static constexpr float BoundsInfinity = 1e30f;
+	glm::vec4 BoundsEmpty()
+	{
+		return glm::vec4(BoundsInfinity, BoundsInfinity, -BoundsInfinity, -BoundsInfinity);
+	}
+	glm::vec4 BoundsInfinite()
+	{
+		return glm::vec4(-BoundsInfinity, -BoundsInfinity, BoundsInfinity, BoundsInfinity);
+	}
+	bool IsBoundsEmpty(glm::vec4 bounds)
+	{
+		return bounds.x > bounds.z || bounds.y > bounds.w;
+	}
+	glm::vec4 BoundsUnion(glm::vec4 a, glm::vec4 b)
+	{
+		return glm::vec4(glm::min(a.x, b.x), glm::min(a.y, b.y), glm::max(a.z, b.z), glm::max(a.w, b.w));
+	}
+	glm::vec4 BoundsIntersection(glm::vec4 a, glm::vec4 b)
+	{
+		return glm::vec4(glm::max(a.x, b.x), glm::max(a.y, b.y), glm::min(a.z, b.z), glm::min(a.w, b.w));
+	}
+	glm::vec4 BoundsExpand(glm::vec4 bounds, float amount)
+	{
+		if (IsBoundsEmpty(bounds))
+		{
+			return bounds;
+		}
+		return bounds + glm::vec4(-amount, -amount, amount, amount);
+	}
+	glm::vec4 BoundsTransform(glm::vec4 bounds, const glm::mat3& transform)
+	{
+		if (IsBoundsEmpty(bounds))
+		{
+			return bounds;
+		}
+		auto res = BoundsEmpty();
+		for (auto corner : { glm::vec2(bounds.x, bounds.y), glm::vec2(bounds.z, bounds.y), glm::vec2(bounds.x, bounds.w), glm::vec2(bounds.z, bounds.w) })
+		{
+			auto pt = glm::vec2(transform * glm::vec3(corner, 1.f));
+			res = BoundsUnion(res, glm::vec4(pt, pt));
+		}
+		return res;
+	}
+	glm::vec4 GetChildrenBounds(const std::vector<ISceneObject::Handle>& children, const Scene& scene)
+	{
+		auto res = BoundsEmpty();
+		for (auto childHandle : children)
+		{
+			if (auto* child = scene.objects.Get(childHandle))
+			{
+				res = BoundsUnion(res, child->GetBounds(scene));
+			}
+		}
+		return res;
+	}
+	//Negative radius marks empty circle, distance to it is never below any res.dst
+	glm::vec3 CircleEmpty()
+	{
+		return glm::vec3(0.f, 0.f, -BoundsInfinity);
+	}
+	glm::vec3 BoundsToCircle(glm::vec4 bounds)
+	{
+		if (IsBoundsEmpty(bounds))
+		{
+			return CircleEmpty();
+		}
+		auto lo = glm::vec2(bounds.x, bounds.y);
+		auto hi = glm::vec2(bounds.z, bounds.w);
+		return glm::vec3((lo + hi) * 0.5f, glm::length(hi - lo) * 0.5f);
+	}
+	//Smallest circle enclosing both
+	glm::vec3 CircleUnion(glm::vec3 a, glm::vec3 b)
+	{
+		if (a.z < 0.f)
+		{
+			return b;
+		}
+		if (b.z < 0.f)
+		{
+			return a;
+		}
+		auto offset = glm::vec2(b) - glm::vec2(a);
+		auto dst = glm::length(offset);
+		if (dst + b.z <= a.z)
+		{
+			return a;
+		}
+		if (dst + a.z <= b.z)
+		{
+			return b;
+		}
+		auto radius = (dst + a.z + b.z) * 0.5f;
+		return glm::vec3(glm::vec2(a) + offset * ((radius - a.z) / dst), radius);
+	}
+	glm::vec3 GetChildrenBoundingCircle(const std::vector<ISceneObject::Handle>& children, const Scene& scene)
+	{
+		auto res = CircleEmpty();
+		for (auto childHandle : children)
+		{
+			if (auto* child = scene.objects.Get(childHandle))
+			{
+				res = CircleUnion(res, child->GetBoundingCircle(scene));
+			}
+		}
+		return res;
+	}
+
 	SceneChange ISceneObject::OnEditor(Scene& scene)
 	{
 		auto handle = scene.objects.GetHandle(this);
@@ -158,33 +288,71 @@ namespace app
 		}
 		return transform;
 	}
+	glm::vec4 ISceneObject::GetBounds(const Scene& scene) const
+	{
+		return BoundsInfinite();
+	}
+	glm::vec3 ISceneObject::GetBoundingCircle(const Scene& scene) const
+	{
+		return BoundsToCircle(GetBounds(scene));
+	}
 	std::string ISceneObject::GetShaderFunctionName(const Scene& scene) const
 	{
-		return fmt::format("{}_{}", GetName(), scene.objects.GetHandle(this).value);
+		const auto& target = scene.GetCodegenTarget(*this);
+		return fmt::format("{}_{}", target.GetName(), scene.objects.GetHandle(&target).value);
 	}
 
+	uint32_t GetObjectUniformId(const ISceneObject& object, const Scene& scene)
+	{
+		return scene.objects.GetHandle(&object).value;
+	}
 	std::string GetObjectUniformName(const std::string& baseName, const ISceneObject& object, const Scene& scene)
 	{
-		return fmt::format("u_{}_{}", baseName, scene.objects.GetHandle(&object).value);
+		return GetUniformName(baseName, GetObjectUniformId(object, scene));
 	}
 	std::string GetObjectFunctionHeader(const ISceneObject& object, const Scene& scene)
 	{
 		return fmt::format("TraceResult {}(vec2 pt, vec2 d)", object.GetShaderFunctionName(scene));
 	}
+	//Distance only twin of the object function, used while marching, materials are resolved once per hit
+	std::string GetObjectDistanceFunctionName(const ISceneObject& object, const Scene& scene)
+	{
+		return object.GetShaderFunctionName(scene) + "_dst";
+	}
+	std::string GetObjectDistanceFunctionHeader(const ISceneObject& object, const Scene& scene)
+	{
+		return fmt::format("float {}(vec2 pt, vec2 d)", GetObjectDistanceFunctionName(object, scene));
+	}
+	//Child can't win the union once its bounding circle is farther than current best
+	std::string GetBoundedUnionCommand(const ISceneObject& child, const Scene& scene, std::string_view point = "pt")
+	{
+		return fmt::format("if (BoundingCircleDst({0}, {1}) <= res.dst) {{ res = TraceUnion(res, {2}({0}, d)); }}\n",
+			point, GetObjectUniformName("bounding_circle", child, scene), child.GetShaderFunctionName(scene));
+	}
+	std::string GetBoundedMinCommand(const ISceneObject& child, const Scene& scene, std::string_view point = "pt")
+	{
+		return fmt::format("if (BoundingCircleDst({0}, {1}) <= res) {{ res = min(res, {2}({0}, d)); }}\n",
+			point, GetObjectUniformName("bounding_circle", child, scene), GetObjectDistanceFunctionName(child, scene));
+	}
 
 	SceneChange SceneObjectTransform::OnEditorImpl(Scene& scene)
 	{
 		SceneChange change = SceneChange::None;
+		bool wasIdentity = IsIdentity();
 		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Translation", (float*)&translation, 1.f, -1000.f, 1000.f, "%.6f");
 		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Rotation", (float*)&rotation, 1.f, -1000.f, 1000.f, "%.6f");
+		if (IsIdentity() != wasIdentity)
+		{
+			change |= SceneChange::ShaderInvalid;
+		}
 		return change;
 	}
 	std::string SceneObjectTransform::GetShaderDeclarations(const Scene& scene) const
 	{
 		std::string res;
-		res += fmt::format("uniform vec2 {};\n", GetObjectUniformName("translation", *this, scene));
-		res += fmt::format("uniform float {};\n", GetObjectUniformName("rotation", *this, scene));
+		res += fmt::format("uniform vec2 {}[3];\n", GetObjectUniformName("transform", *this, scene));
 		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
 		return res;
 	}
 	std::string SceneObjectTransform::GetShaderCommands(const Scene& scene) const
@@ -192,34 +360,83 @@ namespace app
 		std::string res = R"xxx(
 	{codegen_fn}
 	{
-		pt = pt - {codegen_u_tr};
-		pt = Rotate(pt, {codegen_u_rot});
+		vec2 lp = TransformPoint({codegen_u_transform}, pt);
 		TraceResult res;
 		res.dst = MAX_TRACE_DST;
 		{codegen_children}
 		return res;
 	}	
+	{codegen_dst_fn}
+	{
+		vec2 lp = TransformPoint({codegen_u_transform}, pt);
+		float res = MAX_TRACE_DST;
+		{codegen_dst_children}
+		return res;
+	}	
 )xxx";
+		//Nested transforms fold this one into their own matrix so they take our input point,
+		//everything else gets the local point and its gradient is brought back here
+		auto transformName = GetObjectUniformName("transform", *this, scene);
 		std::string childrenStr{};
-		for (auto childHandle : children)
+		std::string dstChildrenStr{};
+		for (auto childHandle : scene.GetCodegenChildren(*this))
 		{
 			if (auto* child = scene.objects.Get(childHandle))
 			{
-				auto childFn = child->GetShaderFunctionName(scene);
-				childrenStr += fmt::format("res = TraceUnion(res, {}(pt, d));", childFn);
+				auto circle = GetObjectUniformName("bounding_circle", *child, scene);
+				if (IsChainedTransform(scene.GetCodegenTarget(*child), scene))
+				{
+					childrenStr += fmt::format("if (BoundingCircleDst(lp, {}) <= res.dst) {{ res = TraceUnion(res, {}(pt, d)); }}\n",
+						circle, child->GetShaderFunctionName(scene));
+					dstChildrenStr += fmt::format("if (BoundingCircleDst(lp, {}) <= res) {{ res = min(res, {}(pt, d)); }}\n",
+						circle, GetObjectDistanceFunctionName(*child, scene));
+				}
+				else
+				{
+					childrenStr += fmt::format("if (BoundingCircleDst(lp, {}) <= res.dst) {{ TraceResult r = {}(lp, d); r.grad = TransformGradBack({}, r.grad); res = TraceUnion(res, r); }}\n",
+						circle, child->GetShaderFunctionName(scene), transformName);
+					dstChildrenStr += fmt::format("if (BoundingCircleDst(lp, {}) <= res) {{ res = min(res, {}(lp, d)); }}\n",
+						circle, GetObjectDistanceFunctionName(*child, scene));
+				}
 			}
 		}
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
-		ReplaceSubstr(res, "{codegen_u_rot}", GetObjectUniformName("rotation", *this, scene));
-		ReplaceSubstr(res, "{codegen_u_tr}", GetObjectUniformName("translation", *this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_children}", dstChildrenStr);
+		ReplaceSubstr(res, "{codegen_u_transform}", transformName);
 		ReplaceSubstr(res, "{codegen_children}", childrenStr);
 
 		return res;
 	}
 	void SceneObjectTransform::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-		FillUniform(req, GetObjectUniformName("rotation", *this, scene), rotation);
-		FillUniform(req, GetObjectUniformName("translation", *this, scene), translation);
+		//Columns of world to local affine, shader does one mat3x2 multiply and no trig
+		auto local = glm::inverse(GetChainTransform(scene));
+		std::array<glm::vec2, 3> columns{ glm::vec2(local[0]), glm::vec2(local[1]), glm::vec2(local[2]) };
+		FillUniformV<float, 2>(req, "transform", GetObjectUniformId(*this, scene), columns.size(), glm::value_ptr(columns[0]));
+	}
+	void SceneObjectTransform::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::PushTransform, glm::vec4(translation, std::cos(-rotation), std::sin(-rotation)));
+		program.Emit(SceneOp::Empty);
+		for (auto childHandle : children)
+		{
+			if (auto* child = scene.objects.Get(childHandle))
+			{
+				child->GetProgramCommands(program, scene);
+				program.Emit(SceneOp::Union);
+			}
+		}
+		program.Emit(SceneOp::PopPoint);
+	}
+	glm::mat3 SceneObjectTransform::GetChainTransform(const Scene& scene) const
+	{
+		glm::mat3 transform{ 1.f };
+		if (auto* parentTransform = dynamic_cast<const SceneObjectTransform*>(scene.objects.Get(parent)))
+		{
+			transform = parentTransform->GetChainTransform(scene);
+		}
+		return transform * glm::translate(glm::mat3(1.f), translation) * glm::rotate(glm::mat3(1.f), rotation);
 	}
 	glm::mat3 SceneObjectTransform::GetTransform(const Scene& scene) const
 	{
@@ -242,13 +459,33 @@ namespace app
 		left = transform * left;
 		right = transform * right;
 		auto o2 = glm::vec2(origin);
+		bool wasIdentity = IsIdentity();
 		ImGui::PushID(scene.objects.GetHandle(this).value);
 		change |= SceneChange::IntegrationInvalid && GizmoDragPoint(editor, 0, o2, 0.03f);
 		change |= SceneChange::IntegrationInvalid && GizmoRotation(editor, 1, rotation, o2, 0.02f, 0.1f);
 		translation = glm::vec2(iTransform * glm::vec3(o2, 1.f));
+		if (IsIdentity() != wasIdentity)
+		{
+			change |= SceneChange::ShaderInvalid;
+		}
 		ImGui::PopID();
 		return change;
 	}
+	glm::vec3 SceneObjectTransform::GetBoundingCircle(const Scene& scene) const
+	{
+		auto circle = GetChildrenBoundingCircle(children, scene);
+		if (circle.z < 0.f)
+		{
+			return circle;
+		}
+		auto transform = glm::translate(glm::mat3(1.f), translation) * glm::rotate(glm::mat3(1.f), rotation);
+		return glm::vec3(glm::vec2(transform * glm::vec3(glm::vec2(circle), 1.f)), circle.z);
+	}
+	glm::vec4 SceneObjectTransform::GetBounds(const Scene& scene) const
+	{
+		auto transform = glm::translate(glm::mat3(1.f), translation) * glm::rotate(glm::mat3(1.f), rotation);
+		return BoundsTransform(GetChildrenBounds(children, scene), transform);
+	}
 	std::string SceneObjectTransform::Serialize(const Scene& scene) const
 	{
 		std::string res{};
@@ -271,6 +508,7 @@ namespace app
 		res += fmt::format("uniform float {};\n", GetObjectUniformName("radius", *this, scene));
 		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
 		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
 		return res;
 	}
 	std::string SceneObjectCircle::GetShaderCommands(const Scene& scene) const
@@ -279,22 +517,35 @@ namespace app
 	{codegen_fn}
 	{
 		TraceResult res;
-		res.dst = CircleSDF(pt, {codegen_u_rad});
+		vec3 sdf = CircleSDFGrad(pt, {codegen_u_rad});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
 		res.emission = u_materials[{codegen_u_mat_id}].emission;
 		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
 		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
 		return res;
 	}	
+	{codegen_dst_fn}
+	{
+		return CircleSDF(pt, {codegen_u_rad});
+	}	
 )xxx";
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
 		ReplaceSubstr(res, "{codegen_u_rad}", GetObjectUniformName("radius", *this, scene));
 		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
 		return res;
 	}
 	void SceneObjectCircle::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-		FillUniform(req, GetObjectUniformName("radius", *this, scene), radius);
-		FillUniform(req, GetObjectUniformName("material_id", *this, scene), int(material.value));
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "radius", id, radius);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectCircle::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::Circle, glm::vec4(radius, 0.f, 0.f, 0.f), int(material.GetIndex()));
 	}
 	SceneChange SceneObjectCircle::OnGizmos(Scene& scene)
 	{
@@ -311,6 +562,15 @@ namespace app
 		ImGui::PopID();
 		return change;
 	}
+	glm::vec3 SceneObjectCircle::GetBoundingCircle(const Scene& scene) const
+	{
+		return glm::vec3(0.f, 0.f, std::max(radius, 0.f));
+	}
+	glm::vec4 SceneObjectCircle::GetBounds(const Scene& scene) const
+	{
+		auto r = std::max(radius, 0.f);
+		return glm::vec4(-r, -r, r, r);
+	}
 	std::string SceneObjectCircle::Serialize(const Scene& scene) const
 	{
 		std::string res{};
@@ -335,6 +595,7 @@ namespace app
 		res += fmt::format("uniform vec2 {};\n", GetObjectUniformName("halfSize", *this, scene));
 		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
 		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
 		return res;
 	}
 	std::string SceneObjectRectangle::GetShaderCommands(const Scene& scene) const
@@ -343,14 +604,22 @@ namespace app
 	{codegen_fn}
 	{
 		TraceResult res;
-		res.dst = RectangleSDF(pt, {codegen_u_halfSize}, {codegen_u_rounding});
+		vec3 sdf = RectangleSDFGrad(pt, {codegen_u_halfSize}, {codegen_u_rounding});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
 		res.emission = u_materials[{codegen_u_mat_id}].emission;
 		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
 		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
 		return res;
 	}	
+	{codegen_dst_fn}
+	{
+		return RectangleSDF(pt, {codegen_u_halfSize}, {codegen_u_rounding});
+	}	
 )xxx";
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
 		ReplaceSubstr(res, "{codegen_u_halfSize}", GetObjectUniformName("halfSize", *this, scene));
 		ReplaceSubstr(res, "{codegen_u_rounding}", GetObjectUniformName("rounding", *this, scene));
 		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
@@ -358,9 +627,14 @@ namespace app
 	}
 	void SceneObjectRectangle::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-		FillUniform(req, GetObjectUniformName("halfSize", *this, scene), halfSize);
-		FillUniform(req, GetObjectUniformName("rounding", *this, scene), rounding);
-		FillUniform(req, GetObjectUniformName("material_id", *this, scene), int(material.value));
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "halfSize", id, halfSize);
+		FillUniform(req, "rounding", id, rounding);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectRectangle::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::Rectangle, glm::vec4(halfSize, rounding, 0.f), int(material.GetIndex()));
 	}
 	SceneChange SceneObjectRectangle::OnGizmos(Scene& scene)
 	{
@@ -379,6 +653,11 @@ namespace app
 		ImGui::PopID();
 		return change;
 	}
+	glm::vec4 SceneObjectRectangle::GetBounds(const Scene& scene) const
+	{
+		auto h = glm::abs(halfSize) + std::max(rounding, 0.f);
+		return glm::vec4(-h, h);
+	}
 	std::string SceneObjectRectangle::Serialize(const Scene& scene) const
 	{
 		std::string res{};
@@ -389,9 +668,74 @@ namespace app
 		return res;
 	}
 
+	std::vector<glm::vec2> GetPolygonOutline(const std::vector<glm::vec2>& points)
+	{
+		std::vector<glm::vec2> res;
+		for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i, ++i)
+		{
+			if (points[i] != points[j])
+			{
+				res.push_back(points[i]);
+			}
+		}
+		return res;
+	}
+	bool IsConvexPolygon(const std::vector<glm::vec2>& points)
+	{
+		std::vector<glm::vec2> edges;
+		for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i, ++i)
+		{
+			if (points[i] != points[j])
+			{
+				edges.push_back(points[i] - points[j]);
+			}
+		}
+		if (edges.size() < 3)
+		{
+			return false;
+		}
+		float turnSign = 0.f;
+		float turnSum = 0.f;
+		for (size_t i = 0, j = edges.size() - 1; i < edges.size(); j = i, ++i)
+		{
+			float cross = edges[j].x * edges[i].y - edges[j].y * edges[i].x;
+			if (cross != 0.f)
+			{
+				float sign = (cross > 0.f) ? 1.f : -1.f;
+				if (turnSign != 0.f && sign != turnSign)
+				{
+					return false;
+				}
+				turnSign = sign;
+			}
+			turnSum += std::atan2(cross, glm::dot(edges[j], edges[i]));
+		}
+		return std::abs(std::abs(turnSum) - 2.f * std::numbers::pi_v<float>) < 1e-3f;
+	}
+	void GetPolygonEdges(const std::vector<glm::vec2>& outline, std::vector<glm::vec4>& edges, std::vector<glm::vec4>& edgeParams)
+	{
+		//Winding picks the outward side
+		float area = 0.f;
+		for (size_t i = 0, j = outline.size() - 1; i < outline.size(); j = i, ++i)
+		{
+			area += outline[j].x * outline[i].y - outline[i].x * outline[j].y;
+		}
+		float outward = (area >= 0.f) ? 1.f : -1.f;
+		edges.clear();
+		edgeParams.clear();
+		for (size_t i = 0, j = outline.size() - 1; i < outline.size(); j = i, ++i)
+		{
+			auto e = outline[i] - outline[j];
+			float lenSq = glm::dot(e, e);
+			edges.emplace_back(outline[j], e);
+			edgeParams.emplace_back(outward * glm::vec2(e.y, -e.x) / std::sqrt(lenSq), 1.f / lenSq, 0.f);
+		}
+	}
 	SceneChange SceneObjectPolygon::OnEditorImpl(Scene& scene)
 	{
 		SceneChange change = SceneChange::None;
+		bool wasConvex = IsConvexPolygon(points);
+		auto edgeCount = GetPolygonOutline(points).size();
 		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
 		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Rounding", (float*)&rounding, 1.f, 0.f, 1000.f, "%.6f");
 		if (ImGui::CollapsingHeader("Points"))
@@ -413,16 +757,24 @@ namespace app
 				++i;
 			}
 		}
+		//Convex and general outlines use different generated kernels, edge count is baked into both
+		if (IsConvexPolygon(points) != wasConvex || GetPolygonOutline(points).size() != edgeCount)
+		{
+			change |= SceneChange::ShaderInvalid;
+		}
 		return change;
 	}
 	std::string SceneObjectPolygon::GetShaderDeclarations(const Scene& scene) const
 	{
+		//Edge count is baked into generated loop, editing that changes it invalidates shader
+		size_t edgeCount = std::max(GetPolygonOutline(points).size(), size_t(1));
 		std::string res;
 		res += fmt::format("uniform float {};\n", GetObjectUniformName("rounding", *this, scene));
 		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
-		res += fmt::format("uniform vec2 {}[POLYGON_POINTS_MAX];\n", GetObjectUniformName("points", *this, scene));
-		res += fmt::format("uniform int {};\n", GetObjectUniformName("point_count", *this, scene));
+		res += fmt::format("uniform vec4 {}[{}];\n", GetObjectUniformName("edges", *this, scene), edgeCount);
+		res += fmt::format("uniform vec4 {}[{}];\n", GetObjectUniformName("edge_params", *this, scene), edgeCount);
 		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
 		return res;
 	}
 	std::string SceneObjectPolygon::GetShaderCommands(const Scene& scene) const
@@ -431,26 +783,76 @@ namespace app
 	{codegen_fn}
 	{
 		TraceResult res;
-		res.dst = PolygonSDF(pt, {codegen_points_cnt}, {codegen_points}, {codegen_rounding});
+		{codegen_edges_loop}
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
 		res.emission = u_materials[{codegen_u_mat_id}].emission;
 		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
 		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
 		return res;
 	}	
+	{codegen_dst_fn}
+	{
+		{codegen_edges_loop}
+		return sdf.x;
+	}	
 )xxx";
+		std::string loop;
+		if (IsConvexPolygon(points))
+		{
+			loop = R"xxx(float minDst = 1e30;
+		vec2 minPerp = vec2(1.0, 0.0);
+		float plane = -1e30;
+		vec2 planeNormal = vec2(1.0, 0.0);
+		for (int i = 0; i < {codegen_edge_count}; ++i)
+		{
+			ConvexPolygonEdge(pt, {codegen_edges}[i], {codegen_edge_params}[i], minDst, minPerp, plane, planeNormal);
+		}
+		vec3 sdf = ConvexPolygonFinish(minDst, minPerp, plane, planeNormal, {codegen_rounding});)xxx";
+		}
+		else
+		{
+			loop = R"xxx(float minDst = 1e30;
+		vec2 minPerp = vec2(1.0, 0.0);
+		float s = 1.0;
+		for (int i = 0; i < {codegen_edge_count}; ++i)
+		{
+			PolygonEdge(pt, {codegen_edges}[i], {codegen_edge_params}[i], minDst, minPerp, s);
+		}
+		vec3 sdf = PolygonFinish(minDst, minPerp, s, {codegen_rounding});)xxx";
+		}
+		ReplaceSubstr(res, "{codegen_edges_loop}", loop);
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
-		ReplaceSubstr(res, "{codegen_points_cnt}", GetObjectUniformName("point_count", *this, scene));
-		ReplaceSubstr(res, "{codegen_points}", GetObjectUniformName("points", *this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_edge_count}", std::to_string(GetPolygonOutline(points).size()));
+		ReplaceSubstr(res, "{codegen_edges}", GetObjectUniformName("edges", *this, scene));
+		ReplaceSubstr(res, "{codegen_edge_params}", GetObjectUniformName("edge_params", *this, scene));
 		ReplaceSubstr(res, "{codegen_rounding}", GetObjectUniformName("rounding", *this, scene));
 		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
 		return res;
 	}
 	void SceneObjectPolygon::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-		FillUniform(req, GetObjectUniformName("rounding", *this, scene), rounding);
-		FillUniform(req, GetObjectUniformName("material_id", *this, scene), int(material.value));
-		FillUniform(req, GetObjectUniformName("point_count", *this, scene), int(points.size()));
-		FillUniformV<float, 2>(req, GetObjectUniformName("points", *this, scene), points.size(), (float*)points.data());
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "rounding", id, rounding);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+		std::vector<glm::vec4> edges;
+		std::vector<glm::vec4> edgeParams;
+		GetPolygonEdges(GetPolygonOutline(points), edges, edgeParams);
+		if (edges.empty())
+		{
+			return;
+		}
+		FillUniformV<float, 4>(req, "edges", id, edges.size(), (float*)edges.data());
+		FillUniformV<float, 4>(req, "edge_params", id, edgeParams.size(), (float*)edgeParams.data());
+	}
+	void SceneObjectPolygon::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto outline = GetPolygonOutline(points);
+		auto first = float(program.points.size());
+		program.points.insert(program.points.end(), outline.begin(), outline.end());
+		program.Emit(SceneOp::Polygon, glm::vec4(first, float(outline.size()), rounding, 0.f), int(material.GetIndex()));
 	}
 	SceneChange SceneObjectPolygon::OnGizmos(Scene& scene)
 	{
@@ -459,6 +861,8 @@ namespace app
 		ImGui::PushID(scene.objects.GetHandle(this).value);
 		auto transform = GetTransform(scene);
 		auto iTransform = glm::inverse(transform);
+		bool wasConvex = IsConvexPolygon(points);
+		auto edgeCount = GetPolygonOutline(points).size();
 		int pidx = 0;
 		for (auto& p : points)
 		{
@@ -469,9 +873,22 @@ namespace app
 				p = glm::vec2(iTransform * glm::vec3(pt, 1.f));
 			}
 		}
+		if (IsConvexPolygon(points) != wasConvex || GetPolygonOutline(points).size() != edgeCount)
+		{
+			change |= SceneChange::ShaderInvalid;
+		}
 		ImGui::PopID();
 		return change;
 	}
+	glm::vec4 SceneObjectPolygon::GetBounds(const Scene& scene) const
+	{
+		auto res = BoundsEmpty();
+		for (auto pt : points)
+		{
+			res = BoundsUnion(res, glm::vec4(pt, pt));
+		}
+		return BoundsExpand(res, std::max(rounding, 0.f));
+	}
 	std::string SceneObjectPolygon::Serialize(const Scene& scene) const
 	{
 		std::string res{};
@@ -485,90 +902,926 @@ namespace app
 		return res;
 	}
 
-	std::string SceneObjectExactOperator::GetShaderDeclarations(const Scene & scene) const
+	//Versions of baked object data, unique over all objects so uploads keyed by them never mix objects up
+	static uint64_t NextBakedDataVersion()
 	{
-		return GetObjectFunctionHeader(*this, scene) + ";\n";
+		static std::atomic<uint64_t> counter{ 0 };
+		return ++counter;
 	}
-	std::string SceneObjectExactOperator::GetShaderCommands(const Scene& scene) const
+	const std::vector<glm::vec4>* SceneObjectLargePolygon::GetShaderData(uint64_t* version) const
 	{
-		std::string res = R"xxx(
-	{codegen_fn}
+		if (grid.empty() || gridPointsVersion != pointsVersion)
+		{
+			grid = BuildPolygonGrid(points, rounding);
+			gridPointsVersion = pointsVersion;
+			gridVersion = NextBakedDataVersion();
+		}
+		if (version)
+		{
+			*version = gridVersion;
+		}
+		return &grid;
+	}
+	SceneChange SceneObjectLargePolygon::OnEditorImpl(Scene& scene)
 	{
-		TraceResult res;
-		{codegen_children}
-		return res;
-	}	
-)xxx";
-		std::string operatorName = "Trace" + std::string(GetName());
-		std::string childrenStr{};
-		if (children.size() > 0)
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		if (ImGui::DragFloat("Rounding", (float*)&rounding, 1.f, 0.f, 1000.f, "%.6f"))
 		{
-			if (auto* child = scene.objects.Get(children[0]))
-			{
-				auto childFn = child->GetShaderFunctionName(scene);
-				childrenStr += fmt::format("res = {}(pt, d);", childFn);
-			}
-			for (int i = 1; i < int(children.size()); ++i)
+			pointsVersion++;
+			change |= SceneChange::IntegrationInvalid;
+		}
+		ImGui::Text("%d points", int(points.size()));
+		//Any text with x y pairs separated by whitespace or commas, e.g. exported outline
+		if (ImGui::Button("Paste points"))
+		{
+			std::vector<float> values;
+			const char* text = ImGui::GetClipboardText();
+			while (text && *text)
 			{
-				if (auto* child = scene.objects.Get(children[i]))
+				char* end = nullptr;
+				float v = std::strtof(text, &end);
+				if (end == text)
 				{
-					auto childFn = child->GetShaderFunctionName(scene);
-					childrenStr += fmt::format("res = {}(res, {}(pt, d));", operatorName, childFn);
+					text++;
+					continue;
 				}
+				values.push_back(v);
+				text = end;
+			}
+			points.clear();
+			for (size_t i = 0; i + 1 < values.size(); i += 2)
+			{
+				points.emplace_back(values[i], values[i + 1]);
 			}
+			pointsVersion++;
+			change |= SceneChange::IntegrationInvalid;
 		}
-
-
-		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
-		ReplaceSubstr(res, "{codegen_children}", childrenStr);
-
-		return res;
-	}
-	std::string SceneObjectExactOperator::Serialize(const Scene& scene) const
-	{
-		std::string res{};
-		res += fmt::format("auto object = new SceneObject{}();\n", GetName());
-		return res;
-	}
-
-	SceneChange SceneObjectAnnular::OnEditorImpl(Scene& scene)
-	{
-		SceneChange change = SceneChange::None;
-		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Radius", (float*)&radius, 1.f, 0.f, 1000.f, "%.6f");
 		return change;
 	}
-	std::string SceneObjectAnnular::GetShaderDeclarations(const Scene& scene) const
+	std::string SceneObjectLargePolygon::GetShaderDeclarations(const Scene& scene) const
 	{
-		std::string res{};
+		std::string res;
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
 		res += GetObjectFunctionHeader(*this, scene) + ";\n";
-		res += fmt::format("uniform float {};\n", GetObjectUniformName("radius", *this, scene));
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
 		return res;
 	}
-	std::string SceneObjectAnnular::GetShaderCommands(const Scene& scene) const
+	std::string SceneObjectLargePolygon::GetShaderCommands(const Scene& scene) const
 	{
 		std::string res = R"xxx(
 	{codegen_fn}
 	{
 		TraceResult res;
-		res.dst = MAX_TRACE_DST;
-		{codegen_children}
+		vec3 sdf = PolygonGridSDFGrad({codegen_data_offset}, pt);
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
 		return res;
 	}	
+	{codegen_dst_fn}
+	{
+		return PolygonGridSDFGrad({codegen_data_offset}, pt).x;
+	}	
 )xxx";
-		std::string childrenStr{};
-		if (children.size() > 0)
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_data_offset}", GetObjectUniformName("data_offset", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectLargePolygon::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectLargePolygon::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto first = float(program.data.size());
+		const auto& data = *GetShaderData(nullptr);
+		program.data.insert(program.data.end(), data.begin(), data.end());
+		program.Emit(SceneOp::PolygonGrid, glm::vec4(first, 0.f, 0.f, 0.f), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectLargePolygon::OnGizmos(Scene& scene)
+	{
+		//Outline only, points are meant to be imported rather than dragged one by one
+		auto* editor = GetEditor();
+		auto transform = GetTransform(scene);
+		for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i, ++i)
 		{
+			GizmoLine(editor, glm::vec2(transform * glm::vec3(points[j], 1.f)), glm::vec2(transform * glm::vec3(points[i], 1.f)), 0.005f);
+		}
+		return SceneChange::None;
+	}
+	glm::vec4 SceneObjectLargePolygon::GetBounds(const Scene& scene) const
+	{
+		auto res = BoundsEmpty();
+		for (auto pt : points)
+		{
+			res = BoundsUnion(res, glm::vec4(pt, pt));
+		}
+		return BoundsExpand(res, std::max(rounding, 0.f));
+	}
+	std::string SceneObjectLargePolygon::Serialize(const Scene& scene) const
+	{
+		//Chunks keep every string literal well under compiler limits
+		const size_t chunkPoints = 1024;
+		std::string res{};
+		res += "auto object = new SceneObjectLargePolygon();\n";
+		res += fmt::format("object->rounding = {:.6f}f;\n", rounding);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		for (size_t i = 0; i < points.size(); i += chunkPoints)
+		{
+			auto count = std::min(chunkPoints, points.size() - i);
+			res += fmt::format("AppendEncodedPoints(object->points, \"{}\");\n", EncodeBase64(points.data() + i, count * sizeof(glm::vec2)));
+		}
+		return res;
+	}
+	void AppendEncodedPoints(std::vector<glm::vec2>& points, std::string_view encoded)
+	{
+		auto bytes = DecodeBase64(encoded);
+		auto first = points.size();
+		points.resize(first + bytes.size() / sizeof(glm::vec2));
+		std::memcpy(points.data() + first, bytes.data(), (points.size() - first) * sizeof(glm::vec2));
+	}
+
+	const std::vector<glm::vec4>& SceneObjectDistanceField::GetField(uint64_t* version) const
+	{
+		if (field.empty() || fieldMaskVersion != maskVersion)
+		{
+			field = BuildDistanceField(mask, maskSize, width, std::max(int(std::thread::hardware_concurrency()), 1));
+			fieldMaskVersion = maskVersion;
+			fieldVersion = NextBakedDataVersion();
+		}
+		if (version)
+		{
+			*version = fieldVersion;
+		}
+		return field;
+	}
+	SceneChange SceneObjectDistanceField::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		if (ImGui::DragFloat("Width", (float*)&width, 0.01f, 0.001f, 1000.f, "%.6f", ImGuiSliderFlags_AlwaysClamp))
+		{
+			maskVersion++;
+			change |= SceneChange::IntegrationInvalid;
+		}
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Rounding", (float*)&rounding, 1.f, 0.f, 1000.f, "%.6f");
+		ImGui::Text("Mask %dx%d", maskSize.x, maskSize.y);
+		//Netpbm images (pbm, pgm, ppm) from a file or as clipboard text, dark pixels become the shape
+		std::string content;
+		EditString("Mask file", maskPath);
+		if (ImGui::Button("Load"))
+		{
+			if (auto* file = std::fopen(maskPath.c_str(), "rb"))
+			{
+				std::array<char, 4096> buf;
+				size_t count = 0;
+				while ((count = std::fread(buf.data(), 1, buf.size(), file)) > 0)
+				{
+					content.append(buf.data(), count);
+				}
+				std::fclose(file);
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Paste"))
+		{
+			const char* text = ImGui::GetClipboardText();
+			content = text ? text : "";
+		}
+		if (!content.empty() && ParseMaskImage(content, mask, maskSize))
+		{
+			maskVersion++;
+			change |= SceneChange::IntegrationInvalid;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Invert"))
+		{
+			for (auto& pixel : mask)
+			{
+				pixel = pixel ? 0 : 1;
+			}
+			maskVersion++;
+			change |= SceneChange::IntegrationInvalid;
+		}
+		return change;
+	}
+	std::string SceneObjectDistanceField::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res;
+		res += fmt::format("uniform highp sampler2D {};\n", GetObjectUniformName("field", *this, scene));
+		res += fmt::format("uniform vec2 {};\n", GetObjectUniformName("half_size", *this, scene));
+		res += fmt::format("uniform float {};\n", GetObjectUniformName("rounding", *this, scene));
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		return res;
+	}
+	std::string SceneObjectDistanceField::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		vec3 sdf = DistanceFieldSDFGrad({codegen_field}, pt, {codegen_half_size}, {codegen_rounding});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		return DistanceFieldSDFGrad({codegen_field}, pt, {codegen_half_size}, {codegen_rounding}).x;
+	}	
+)xxx";
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_field}", GetObjectUniformName("field", *this, scene));
+		ReplaceSubstr(res, "{codegen_half_size}", GetObjectUniformName("half_size", *this, scene));
+		ReplaceSubstr(res, "{codegen_rounding}", GetObjectUniformName("rounding", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectDistanceField::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		uint64_t version = 0;
+		const auto& data = GetField(&version);
+		FillUniform(req, "half_size", id, glm::vec2(data[0].z, data[0].w));
+		FillUniform(req, "rounding", id, rounding);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+		FillUniformImage(req, "field", id, glm::ivec2(glm::vec2(data[0])), data.data() + 1, version);
+	}
+	void SceneObjectDistanceField::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto first = float(program.data.size());
+		const auto& data = GetField(nullptr);
+		program.data.insert(program.data.end(), data.begin(), data.end());
+		program.Emit(SceneOp::DistanceField, glm::vec4(first, rounding, 0.f, 0.f), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectDistanceField::OnGizmos(Scene& scene)
+	{
+		//Box covered by the mask
+		auto* editor = GetEditor();
+		auto transform = GetTransform(scene);
+		auto b = GetBounds(scene);
+		std::array<glm::vec2, 4> corners{ glm::vec2(b.x, b.y), glm::vec2(b.z, b.y), glm::vec2(b.z, b.w), glm::vec2(b.x, b.w) };
+		for (size_t i = 0, j = corners.size() - 1; i < corners.size(); j = i, ++i)
+		{
+			GizmoLine(editor, glm::vec2(transform * glm::vec3(corners[j], 1.f)), glm::vec2(transform * glm::vec3(corners[i], 1.f)), 0.005f);
+		}
+		return SceneChange::None;
+	}
+	glm::vec4 SceneObjectDistanceField::GetBounds(const Scene& scene) const
+	{
+		const auto& info = GetField(nullptr)[0];
+		auto h = glm::vec2(info.z, info.w) + std::max(rounding, 0.f);
+		return glm::vec4(-h, h);
+	}
+	std::string SceneObjectDistanceField::Serialize(const Scene& scene) const
+	{
+		//Chunks keep every string literal well under compiler limits
+		const size_t chunkBytes = 8192;
+		std::vector<uint8_t> packed((mask.size() + 7) / 8, 0);
+		for (size_t i = 0; i < mask.size(); ++i)
+		{
+			packed[i / 8] |= uint8_t((mask[i] ? 1 : 0) << (7 - i % 8));
+		}
+		std::string res{};
+		res += "auto object = new SceneObjectDistanceField();\n";
+		res += fmt::format("object->width = {:.6f}f;\n", width);
+		res += fmt::format("object->rounding = {:.6f}f;\n", rounding);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		res += fmt::format("object->maskSize = glm::ivec2({}, {});\n", maskSize.x, maskSize.y);
+		for (size_t i = 0; i < packed.size(); i += chunkBytes)
+		{
+			auto count = std::min(chunkBytes, packed.size() - i);
+			res += fmt::format("AppendEncodedMask(object->mask, object->maskSize, \"{}\");\n", EncodeBase64(packed.data() + i, count));
+		}
+		return res;
+	}
+	void AppendEncodedMask(std::vector<uint8_t>& mask, glm::ivec2 size, std::string_view encoded)
+	{
+		auto bytes = DecodeBase64(encoded);
+		size_t pixelCount = size_t(std::max(size.x, 0)) * std::max(size.y, 0);
+		for (size_t i = 0; i < bytes.size() * 8 && mask.size() < pixelCount; ++i)
+		{
+			mask.push_back((bytes[i / 8] >> (7 - i % 8)) & 1);
+		}
+	}
+
+	SceneChange SceneObjectSegment::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Start", (float*)&a, 1.f, -1000.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("End", (float*)&b, 1.f, -1000.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Thickness", (float*)&thickness, 1.f, 0.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		return change;
+	}
+	std::string SceneObjectSegment::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res;
+		res += fmt::format("uniform vec4 {};\n", GetObjectUniformName("points", *this, scene));
+		res += fmt::format("uniform float {};\n", GetObjectUniformName("thickness", *this, scene));
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		return res;
+	}
+	std::string SceneObjectSegment::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		vec3 sdf = SegmentSDFGrad(pt, {codegen_u_points}.xy, {codegen_u_points}.zw, {codegen_u_thickness});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		return SegmentSDFGrad(pt, {codegen_u_points}.xy, {codegen_u_points}.zw, {codegen_u_thickness}).x;
+	}	
+)xxx";
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_u_points}", GetObjectUniformName("points", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_thickness}", GetObjectUniformName("thickness", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectSegment::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "points", id, glm::vec4(a.x, a.y, b.x, b.y));
+		FillUniform(req, "thickness", id, thickness);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectSegment::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto first = float(program.points.size());
+		program.points.push_back(a);
+		program.points.push_back(b);
+		program.Emit(SceneOp::Segment, glm::vec4(first, thickness, 0.f, 0.f), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectSegment::OnGizmos(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		auto* editor = GetEditor();
+		ImGui::PushID(scene.objects.GetHandle(this).value);
+		auto transform = GetTransform(scene);
+		auto iTransform = glm::inverse(transform);
+		int pidx = 0;
+		for (auto* p : { &a, &b })
+		{
+			auto pt = glm::vec2(transform * glm::vec3(*p, 1.f));
+			if (GizmoDragPoint(editor, pidx++, pt, 0.02f))
+			{
+				change |= SceneChange::IntegrationInvalid;
+				*p = glm::vec2(iTransform * glm::vec3(pt, 1.f));
+			}
+		}
+		ImGui::PopID();
+		return change;
+	}
+	glm::vec4 SceneObjectSegment::GetBounds(const Scene& scene) const
+	{
+		return BoundsExpand(glm::vec4(glm::min(a, b), glm::max(a, b)), std::max(thickness, 0.f));
+	}
+	std::string SceneObjectSegment::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += "auto object = new SceneObjectSegment();\n";
+		res += fmt::format("object->a = glm::vec2({:.6f}f, {:.6f}f);\n", a.x, a.y);
+		res += fmt::format("object->b = glm::vec2({:.6f}f, {:.6f}f);\n", b.x, b.y);
+		res += fmt::format("object->thickness = {:.6f}f;\n", thickness);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		return res;
+	}
+
+	SceneChange SceneObjectArc::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Radius", (float*)&radius, 1.f, 0.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Aperture", (float*)&aperture, 1.f, 0.f, std::numbers::pi_v<float>, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Thickness", (float*)&thickness, 1.f, 0.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		return change;
+	}
+	std::string SceneObjectArc::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res;
+		res += fmt::format("uniform vec4 {};\n", GetObjectUniformName("params", *this, scene));
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		return res;
+	}
+	std::string SceneObjectArc::GetShaderCommands(const Scene& scene) const
+	{
+		//Params are (radius, sin, cos, thickness), aperture trig stays on CPU
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		vec3 sdf = ArcSDFGrad(pt, {codegen_u_params}.yz, {codegen_u_params}.x, {codegen_u_params}.w);
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		return ArcSDFGrad(pt, {codegen_u_params}.yz, {codegen_u_params}.x, {codegen_u_params}.w).x;
+	}	
+)xxx";
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_u_params}", GetObjectUniformName("params", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectArc::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "params", id, glm::vec4(radius, std::sin(aperture), std::cos(aperture), thickness));
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectArc::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::Arc, glm::vec4(radius, std::sin(aperture), std::cos(aperture), thickness), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectArc::OnGizmos(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		auto* editor = GetEditor();
+		ImGui::PushID(scene.objects.GetHandle(this).value);
+		auto transform = GetTransform(scene);
+		auto iTransform = glm::inverse(transform);
+		auto toWorld = [&](float angle)
+		{
+			return glm::vec2(transform * glm::vec3(radius * std::sin(angle), radius * std::cos(angle), 1.f));
+		};
+		const int lineCount = 32;
+		for (int i = 0; i < lineCount; ++i)
+		{
+			float t0 = aperture * (2.f * float(i) / lineCount - 1.f);
+			float t1 = aperture * (2.f * float(i + 1) / lineCount - 1.f);
+			GizmoLine(editor, toWorld(t0), toWorld(t1), 0.005f);
+		}
+		//End point sets both radius and aperture
+		auto end = toWorld(aperture);
+		if (GizmoDragPoint(editor, 0, end, 0.02f))
+		{
+			change |= SceneChange::IntegrationInvalid;
+			auto p = glm::vec2(iTransform * glm::vec3(end, 1.f));
+			radius = glm::length(p);
+			aperture = std::atan2(std::abs(p.x), p.y);
+		}
+		ImGui::PopID();
+		return change;
+	}
+	glm::vec4 SceneObjectArc::GetBounds(const Scene& scene) const
+	{
+		float r = std::max(radius, 0.f);
+		float s = std::sin(aperture);
+		float c = std::cos(aperture);
+		//Ends and top, sides once the arc passes them, bottom only for the full circle
+		auto res = BoundsUnion(glm::vec4(-r * s, r * c, r * s, r), glm::vec4(0.f, r * c, 0.f, r * c));
+		if (aperture > std::numbers::pi_v<float> * 0.5f)
+		{
+			res = BoundsUnion(res, glm::vec4(-r, 0.f, r, 0.f));
+		}
+		if (aperture >= std::numbers::pi_v<float>)
+		{
+			res = BoundsUnion(res, glm::vec4(0.f, -r, 0.f, -r));
+		}
+		return BoundsExpand(res, std::max(thickness, 0.f));
+	}
+	std::string SceneObjectArc::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += "auto object = new SceneObjectArc();\n";
+		res += fmt::format("object->radius = {:.6f}f;\n", radius);
+		res += fmt::format("object->aperture = {:.6f}f;\n", aperture);
+		res += fmt::format("object->thickness = {:.6f}f;\n", thickness);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		return res;
+	}
+
+	SceneChange SceneObjectEllipse::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Radii", (float*)&radii, 1.f, 1e-4f, 1000.f, "%.6f", ImGuiSliderFlags_AlwaysClamp);
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		return change;
+	}
+	std::string SceneObjectEllipse::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res;
+		res += fmt::format("uniform vec2 {};\n", GetObjectUniformName("radii", *this, scene));
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		return res;
+	}
+	std::string SceneObjectEllipse::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		vec3 sdf = EllipseSDFGrad(pt, {codegen_u_radii});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		return EllipseSDFGrad(pt, {codegen_u_radii}).x;
+	}	
+)xxx";
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_u_radii}", GetObjectUniformName("radii", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectEllipse::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "radii", id, radii);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectEllipse::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::Ellipse, glm::vec4(radii, 0.f, 0.f), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectEllipse::OnGizmos(Scene& scene)
+	{
+		auto* editor = GetEditor();
+		SceneChange change = SceneChange::None;
+		ImGui::PushID(scene.objects.GetHandle(this).value);
+		auto transform = GetTransform(scene);
+		auto toWorld = [&](float angle)
+		{
+			return glm::vec2(transform * glm::vec3(radii.x * std::cos(angle), radii.y * std::sin(angle), 1.f));
+		};
+		const int lineCount = 48;
+		for (int i = 0; i < lineCount; ++i)
+		{
+			float step = 2.f * std::numbers::pi_v<float> / lineCount;
+			GizmoLine(editor, toWorld(step * float(i)), toWorld(step * float(i + 1)), 0.005f);
+		}
+		auto origin = glm::vec2(transform * glm::vec3(0.f, 0.f, 1.f));
+		auto right = glm::vec2(transform * glm::vec3(1.f, 0.f, 1.f));
+		right = glm::normalize(right - origin);
+		auto top = glm::vec2(transform * glm::vec3(0.f, 1.f, 1.f));
+		top = glm::normalize(top - origin);
+		change |= SceneChange::IntegrationInvalid && GizmoDragRay(editor, 0, radii.x, origin, right, 0.02f, 0.01f);
+		change |= SceneChange::IntegrationInvalid && GizmoDragRay(editor, 1, radii.y, origin, top, 0.02f, 0.01f);
+		//Nearest point iteration divides by radii
+		radii = glm::clamp(radii, glm::vec2(1e-4f), glm::vec2(std::numeric_limits<float>::max()));
+		ImGui::PopID();
+		return change;
+	}
+	glm::vec4 SceneObjectEllipse::GetBounds(const Scene& scene) const
+	{
+		auto h = glm::abs(radii);
+		return glm::vec4(-h, h);
+	}
+	std::string SceneObjectEllipse::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += "auto object = new SceneObjectEllipse();\n";
+		res += fmt::format("object->radii = glm::vec2({:.6f}f, {:.6f}f);\n", radii.x, radii.y);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		return res;
+	}
+
+	SceneChange SceneObjectBezier::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Start", (float*)&a, 1.f, -1000.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Control", (float*)&b, 1.f, -1000.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("End", (float*)&c, 1.f, -1000.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Thickness", (float*)&thickness, 1.f, 0.f, 1000.f, "%.6f");
+		change |= SceneChange::IntegrationInvalid && EditMaterialHandle("Material", material, scene);
+		return change;
+	}
+	std::string SceneObjectBezier::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res;
+		res += fmt::format("uniform vec2 {}[3];\n", GetObjectUniformName("points", *this, scene));
+		res += fmt::format("uniform float {};\n", GetObjectUniformName("thickness", *this, scene));
+		res += fmt::format("uniform int {};\n", GetObjectUniformName("material_id", *this, scene));
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		return res;
+	}
+	std::string SceneObjectBezier::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		vec3 sdf = BezierSDFGrad(pt, {codegen_u_points}[0], {codegen_u_points}[1], {codegen_u_points}[2], {codegen_u_thickness});
+		res.dst = sdf.x;
+		res.grad = sdf.yz;
+		res.emission = u_materials[{codegen_u_mat_id}].emission;
+		res.refractionIndex = u_materials[{codegen_u_mat_id}].refraction;
+		res.absorption = u_materials[{codegen_u_mat_id}].absorption;
+		res.cauchy = u_materials[{codegen_u_mat_id}].cauchy;
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		return BezierSDFGrad(pt, {codegen_u_points}[0], {codegen_u_points}[1], {codegen_u_points}[2], {codegen_u_thickness}).x;
+	}	
+)xxx";
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_u_points}", GetObjectUniformName("points", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_thickness}", GetObjectUniformName("thickness", *this, scene));
+		ReplaceSubstr(res, "{codegen_u_mat_id}", GetObjectUniformName("material_id", *this, scene));
+		return res;
+	}
+	void SceneObjectBezier::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		auto id = GetObjectUniformId(*this, scene);
+		std::array<glm::vec2, 3> points{ a, b, c };
+		FillUniformV<float, 2>(req, "points", id, points.size(), glm::value_ptr(points[0]));
+		FillUniform(req, "thickness", id, thickness);
+		FillUniform(req, "material_id", id, int(material.GetIndex()));
+	}
+	void SceneObjectBezier::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto first = float(program.points.size());
+		program.points.push_back(a);
+		program.points.push_back(b);
+		program.points.push_back(c);
+		program.Emit(SceneOp::Bezier, glm::vec4(first, thickness, 0.f, 0.f), int(material.GetIndex()));
+	}
+	SceneChange SceneObjectBezier::OnGizmos(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		auto* editor = GetEditor();
+		ImGui::PushID(scene.objects.GetHandle(this).value);
+		auto transform = GetTransform(scene);
+		auto iTransform = glm::inverse(transform);
+		//Control polygon
+		auto pa = glm::vec2(transform * glm::vec3(a, 1.f));
+		auto pb = glm::vec2(transform * glm::vec3(b, 1.f));
+		auto pc = glm::vec2(transform * glm::vec3(c, 1.f));
+		GizmoLine(editor, pa, pb, 0.005f);
+		GizmoLine(editor, pb, pc, 0.005f);
+		int pidx = 0;
+		for (auto* p : { &a, &b, &c })
+		{
+			auto pt = glm::vec2(transform * glm::vec3(*p, 1.f));
+			if (GizmoDragPoint(editor, pidx++, pt, 0.02f))
+			{
+				change |= SceneChange::IntegrationInvalid;
+				*p = glm::vec2(iTransform * glm::vec3(pt, 1.f));
+			}
+		}
+		ImGui::PopID();
+		return change;
+	}
+	glm::vec4 SceneObjectBezier::GetBounds(const Scene& scene) const
+	{
+		//Curve stays inside the hull of its control points
+		auto res = glm::vec4(glm::min(glm::min(a, b), c), glm::max(glm::max(a, b), c));
+		return BoundsExpand(res, std::max(thickness, 0.f));
+	}
+	std::string SceneObjectBezier::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += "auto object = new SceneObjectBezier();\n";
+		res += fmt::format("object->a = glm::vec2({:.6f}f, {:.6f}f);\n", a.x, a.y);
+		res += fmt::format("object->b = glm::vec2({:.6f}f, {:.6f}f);\n", b.x, b.y);
+		res += fmt::format("object->c = glm::vec2({:.6f}f, {:.6f}f);\n", c.x, c.y);
+		res += fmt::format("object->thickness = {:.6f}f;\n", thickness);
+		res += fmt::format("object->material = SceneMaterial::Handle({});\n", material.value);
+		return res;
+	}
 
-			for (auto handle : children)
+	std::string SceneObjectExactOperator::GetShaderDeclarations(const Scene & scene) const
+	{
+		return GetObjectFunctionHeader(*this, scene) + ";\n" + GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+	}
+	std::string SceneObjectExactOperator::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		{codegen_children}
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		float res;
+		{codegen_dst_children}
+		return res;
+	}	
+)xxx";
+		std::string operatorName = "Trace" + std::string(GetName());
+		std::string childrenStr{};
+		std::string dstChildrenStr{};
+		const auto& codegenChildren = scene.GetCodegenChildren(*this);
+		if (codegenChildren.size() > 0)
+		{
+			if (auto* child = scene.objects.Get(codegenChildren[0]))
+			{
+				auto childFn = child->GetShaderFunctionName(scene);
+				childrenStr += fmt::format("res = {}(pt, d);", childFn);
+				dstChildrenStr += fmt::format("res = {}(pt, d);\n", GetObjectDistanceFunctionName(*child, scene));
+			}
+			for (int i = 1; i < int(codegenChildren.size()); ++i)
+			{
+				if (auto* child = scene.objects.Get(codegenChildren[i]))
+				{
+					auto childDstFn = GetObjectDistanceFunctionName(*child, scene);
+					if (GetProgramOp() == SceneOp::Union)
+					{
+						childrenStr += GetBoundedUnionCommand(*child, scene);
+						dstChildrenStr += GetBoundedMinCommand(*child, scene);
+					}
+					else
+					{
+						auto childFn = child->GetShaderFunctionName(scene);
+						childrenStr += fmt::format("res = {}(res, {}(pt, d));", operatorName, childFn);
+						if (GetProgramOp() == SceneOp::Difference)
+						{
+							dstChildrenStr += fmt::format("res = max(res, -{}(pt, d));\n", childDstFn);
+						}
+						else
+						{
+							dstChildrenStr += fmt::format("res = max(res, {}(pt, d));\n", childDstFn);
+						}
+					}
+				}
+			}
+		}
+
+
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_children}", childrenStr);
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_children}", dstChildrenStr);
+
+		return res;
+	}
+	void SceneObjectExactOperator::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto* first = children.size() > 0 ? scene.objects.Get(children[0]) : nullptr;
+		if (first)
+		{
+			first->GetProgramCommands(program, scene);
+		}
+		else
+		{
+			program.Emit(SceneOp::Empty);
+		}
+		for (int i = 1; i < int(children.size()); ++i)
+		{
+			if (auto* child = scene.objects.Get(children[i]))
+			{
+				child->GetProgramCommands(program, scene);
+				program.Emit(GetProgramOp());
+			}
+		}
+	}
+	glm::vec4 SceneObjectExactOperator::GetBounds(const Scene& scene) const
+	{
+		auto op = GetProgramOp();
+		if (op == SceneOp::Union)
+		{
+			return GetChildrenBounds(children, scene);
+		}
+		auto* first = children.size() > 0 ? scene.objects.Get(children[0]) : nullptr;
+		if (!first)
+		{
+			return BoundsEmpty();
+		}
+		//Difference never grows past its first operand
+		auto res = first->GetBounds(scene);
+		if (op == SceneOp::Intersection)
+		{
+			for (int i = 1; i < int(children.size()); ++i)
+			{
+				if (auto* child = scene.objects.Get(children[i]))
+				{
+					res = BoundsIntersection(res, child->GetBounds(scene));
+				}
+			}
+		}
+		return res;
+	}
+	glm::vec3 SceneObjectExactOperator::GetBoundingCircle(const Scene& scene) const
+	{
+		auto op = GetProgramOp();
+		if (op == SceneOp::Union)
+		{
+			return GetChildrenBoundingCircle(children, scene);
+		}
+		auto* first = children.size() > 0 ? scene.objects.Get(children[0]) : nullptr;
+		if (!first)
+		{
+			return CircleEmpty();
+		}
+		auto res = first->GetBoundingCircle(scene);
+		if (op == SceneOp::Intersection)
+		{
+			for (int i = 1; i < int(children.size()); ++i)
+			{
+				auto* child = scene.objects.Get(children[i]);
+				auto circle = child ? child->GetBoundingCircle(scene) : res;
+				res = circle.z < res.z ? circle : res;
+			}
+		}
+		return res;
+	}
+	std::string SceneObjectExactOperator::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += fmt::format("auto object = new SceneObject{}();\n", GetName());
+		return res;
+	}
+
+	SceneChange SceneObjectAnnular::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Radius", (float*)&radius, 1.f, 0.f, 1000.f, "%.6f");
+		return change;
+	}
+	std::string SceneObjectAnnular::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res{};
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		res += fmt::format("uniform float {};\n", GetObjectUniformName("radius", *this, scene));
+		return res;
+	}
+	std::string SceneObjectAnnular::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		res.dst = MAX_TRACE_DST;
+		{codegen_children}
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		float res = MAX_TRACE_DST;
+		{codegen_dst_children}
+		return res;
+	}	
+)xxx";
+		std::string childrenStr{};
+		std::string dstChildrenStr{};
+		const auto& codegenChildren = scene.GetCodegenChildren(*this);
+		if (codegenChildren.size() > 0)
+		{
+
+			for (auto handle : codegenChildren)
 			{
 				if (auto* child = scene.objects.Get(handle))
 				{
 					auto childFn = child->GetShaderFunctionName(scene);
 					childrenStr += "{\n";
 					childrenStr += fmt::format("TraceResult r = {}(pt, d);\n", childFn);
+					childrenStr += "r.grad *= (r.dst < 0.0) ? -1.0 : 1.0;\n";
 					childrenStr += fmt::format("r.dst = AnnularSDF(r.dst, {});\n", GetObjectUniformName("radius", *this, scene));
 					childrenStr += "res = TraceUnion(res, r);\n";
 					childrenStr += "}\n";
+					dstChildrenStr += fmt::format("res = min(res, AnnularSDF({}(pt, d), {}));\n",
+						GetObjectDistanceFunctionName(*child, scene), GetObjectUniformName("radius", *this, scene));
 				}
 			}
 		}
@@ -576,12 +1829,41 @@ namespace app
 
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
 		ReplaceSubstr(res, "{codegen_children}", childrenStr);
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_children}", dstChildrenStr);
 
 		return res;
 	}
 	void SceneObjectAnnular::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-		FillUniform(req, GetObjectUniformName("radius", *this, scene), radius);
+		auto id = GetObjectUniformId(*this, scene);
+		FillUniform(req, "radius", id, radius);
+	}
+	void SceneObjectAnnular::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		program.Emit(SceneOp::Empty);
+		for (auto handle : children)
+		{
+			if (auto* child = scene.objects.Get(handle))
+			{
+				child->GetProgramCommands(program, scene);
+				program.Emit(SceneOp::Annular, glm::vec4(radius, 0.f, 0.f, 0.f));
+				program.Emit(SceneOp::Union);
+			}
+		}
+	}
+	glm::vec3 SceneObjectAnnular::GetBoundingCircle(const Scene& scene) const
+	{
+		auto circle = GetChildrenBoundingCircle(children, scene);
+		if (circle.z < 0.f)
+		{
+			return circle;
+		}
+		return circle + glm::vec3(0.f, 0.f, std::max(radius, 0.f));
+	}
+	glm::vec4 SceneObjectAnnular::GetBounds(const Scene& scene) const
+	{
+		return BoundsExpand(GetChildrenBounds(children, scene), std::max(radius, 0.f));
 	}
 	std::string SceneObjectAnnular::Serialize(const Scene& scene) const
 	{
@@ -591,80 +1873,390 @@ namespace app
 		return res;
 	}
 
-	
-	SceneChange SceneObjectMirror::OnEditorImpl(Scene& scene)
+	
+	SceneChange SceneObjectMirror::OnEditorImpl(Scene& scene)
+	{
+		SceneChange change = SceneChange::None;
+		change |= SceneChange::ShaderInvalid && ImGui::Checkbox("X", &mirrorX);
+		change |= SceneChange::ShaderInvalid && ImGui::Checkbox("Y", &mirrorY);
+		return change;
+	}
+	std::string SceneObjectMirror::GetShaderDeclarations(const Scene& scene) const
+	{
+		std::string res{};
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		for (auto handle : children)
+		{
+			if (auto* child = scene.objects.Get(handle))
+			{
+				res += fmt::format("uniform vec2 {};\n", GetObjectUniformName("fold_side", *child, scene));
+			}
+		}
+		return res;
+	}
+	std::string SceneObjectMirror::GetShaderCommands(const Scene& scene) const
+	{
+		std::string res = R"xxx(
+	{codegen_fn}
+	{
+		TraceResult res;
+		res.dst = MAX_TRACE_DST;
+		{codegen_children}
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		float res = MAX_TRACE_DST;
+		{codegen_dst_children}
+		return res;
+	}	
+)xxx";
+		std::string childrenStr{};
+		std::string dstChildrenStr{};
+		const auto& codegenChildren = scene.GetCodegenChildren(*this);
+		if (codegenChildren.size() > 0)
+		{
+
+			for (auto handle : codegenChildren)
+			{
+				if (auto* child = scene.objects.Get(handle))
+				{
+					auto childFn = child->GetShaderFunctionName(scene);
+					auto childDstFn = GetObjectDistanceFunctionName(*child, scene);
+					auto side = GetObjectUniformName("fold_side", *child, scene);
+					//Folded call covers every axis child stays on one side of, reflected calls only run for axes it crosses
+					auto emitCall = [&](const std::string& condition, const char* flip)
+					{
+						auto fold = fmt::format("(f * vec2({}))", flip);
+						childrenStr += fmt::format("if ({}) {{ TraceResult r = {}(pt * {}, d); r.grad *= {}; res = TraceUnion(res, r); }}\n", condition, childFn, fold, fold);
+						dstChildrenStr += fmt::format("if ({}) {{ res = min(res, {}(pt * {}, d)); }}\n", condition, childDstFn, fold);
+					};
+					childrenStr += "{\n";
+					dstChildrenStr += "{\n";
+					childrenStr += fmt::format("vec2 f = MirrorFold(pt, {});\n", side);
+					dstChildrenStr += fmt::format("vec2 f = MirrorFold(pt, {});\n", side);
+					emitCall("true", "1.f, 1.f");
+					if (mirrorX)
+					{
+						emitCall(fmt::format("{}.x == 0.0", side), "-1.f, 1.f");
+					}
+					if (mirrorY)
+					{
+						emitCall(fmt::format("{}.y == 0.0", side), "1.f, -1.f");
+					}
+					if (mirrorX && mirrorY)
+					{
+						emitCall(fmt::format("{0}.x == 0.0 && {0}.y == 0.0", side), "-1.f, -1.f");
+					}
+					childrenStr += "}\n";
+					dstChildrenStr += "}\n";
+				}
+			}
+		}
+		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_children}", childrenStr);
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_children}", dstChildrenStr);
+		return res;
+	}
+	//Union of child and its reflection equals child at folded point when child lies in one half plane,
+	//decided per frame from bounds so dragging across the axis switches back to reflected calls
+	glm::vec2 SceneObjectMirror::GetFoldSide(const ISceneObject& child, const Scene& scene) const
+	{
+		auto b = child.GetBounds(scene);
+		glm::vec2 side{ 0.f };
+		if (IsBoundsEmpty(b))
+		{
+			return glm::vec2(mirrorX ? 1.f : 0.f, mirrorY ? 1.f : 0.f);
+		}
+		if (mirrorX)
+		{
+			side.x = (b.x >= 0.f) ? 1.f : (b.z <= 0.f) ? -1.f : 0.f;
+		}
+		if (mirrorY)
+		{
+			side.y = (b.y >= 0.f) ? 1.f : (b.w <= 0.f) ? -1.f : 0.f;
+		}
+		return side;
+	}
+	void SceneObjectMirror::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	{
+		for (auto handle : children)
+		{
+			if (auto* child = scene.objects.Get(handle))
+			{
+				FillUniform(req, "fold_side", GetObjectUniformId(*child, scene), GetFoldSide(*child, scene));
+			}
+		}
+	}
+	void SceneObjectMirror::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		std::vector<glm::vec2> scales;
+		if (mirrorX)
+		{
+			scales.emplace_back(-1.f, 1.f);
+		}
+		if (mirrorY)
+		{
+			scales.emplace_back(1.f, -1.f);
+		}
+		if (mirrorX && mirrorY)
+		{
+			scales.emplace_back(-1.f, -1.f);
+		}
+		program.Emit(SceneOp::Empty);
+		for (auto handle : children)
+		{
+			if (auto* child = scene.objects.Get(handle))
+			{
+				child->GetProgramCommands(program, scene);
+				program.Emit(SceneOp::Union);
+				for (auto scale : scales)
+				{
+					program.Emit(SceneOp::PushScale, glm::vec4(scale, 0.f, 0.f));
+					child->GetProgramCommands(program, scene);
+					program.Emit(SceneOp::PopPoint);
+					program.Emit(SceneOp::Union);
+				}
+			}
+		}
+	}
+	glm::vec4 SceneObjectMirror::GetBounds(const Scene& scene) const
+	{
+		auto b = GetChildrenBounds(children, scene);
+		auto res = b;
+		if (mirrorX)
+		{
+			res = BoundsUnion(res, glm::vec4(-b.z, b.y, -b.x, b.w));
+		}
+		if (mirrorY)
+		{
+			res = BoundsUnion(res, glm::vec4(b.x, -b.w, b.z, -b.y));
+		}
+		if (mirrorX && mirrorY)
+		{
+			res = BoundsUnion(res, glm::vec4(-b.z, -b.w, -b.x, -b.y));
+		}
+		return res;
+	}
+	std::string SceneObjectMirror::Serialize(const Scene& scene) const
+	{
+		std::string res{};
+		res += "auto object = new SceneObjectMirror();\n";
+		res += fmt::format("object->mirrorX = {};\n", mirrorX);
+		res += fmt::format("object->mirrorY = {};\n", mirrorY);
+		return res;
+	}
+
+	SceneChange SceneObjectRepeat::OnEditorImpl(Scene& scene)
 	{
 		SceneChange change = SceneChange::None;
-		change |= SceneChange::ShaderInvalid && ImGui::Checkbox("X", &mirrorX);
-		change |= SceneChange::ShaderInvalid && ImGui::Checkbox("Y", &mirrorY);
+		change |= SceneChange::ShaderInvalid && ImGui::Checkbox("Polar", &polar);
+		if (polar)
+		{
+			change |= SceneChange::IntegrationInvalid && ImGui::DragInt("Count", &polarCount, 0.1f, 1, 1000);
+			polarCount = std::max(polarCount, 1);
+		}
+		else
+		{
+			change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Spacing", (float*)&spacing, 0.01f, 0.001f, 1000.f, "%.6f");
+			change |= SceneChange::IntegrationInvalid && ImGui::DragInt2("Count (0 endless)", (int*)&count, 0.1f, 0, 1000);
+			spacing = glm::max(spacing, glm::vec2(0.001f));
+			count = glm::max(count, glm::ivec2(0));
+		}
 		return change;
 	}
-	std::string SceneObjectMirror::GetShaderDeclarations(const Scene& scene) const
+	std::string SceneObjectRepeat::GetShaderDeclarations(const Scene& scene) const
 	{
-		return GetObjectFunctionHeader(*this, scene) + ";\n";
+		std::string res{};
+		res += GetObjectFunctionHeader(*this, scene) + ";\n";
+		res += GetObjectDistanceFunctionHeader(*this, scene) + ";\n";
+		if (polar)
+		{
+			res += fmt::format("uniform float {};\n", GetObjectUniformName("polar_count", *this, scene));
+		}
+		else
+		{
+			res += fmt::format("uniform vec4 {};\n", GetObjectUniformName("lattice", *this, scene));
+		}
+		return res;
 	}
-	std::string SceneObjectMirror::GetShaderCommands(const Scene& scene) const
+	std::string SceneObjectRepeat::GetShaderCommands(const Scene& scene) const
 	{
 		std::string res = R"xxx(
 	{codegen_fn}
 	{
 		TraceResult res;
 		res.dst = MAX_TRACE_DST;
-		{codegen_children}
+		for (int cell = 0; cell < {codegen_cells}; ++cell)
+		{
+			{codegen_cell}
+			{codegen_children}
+		}
+		return res;
+	}	
+	{codegen_dst_fn}
+	{
+		float res = MAX_TRACE_DST;
+		for (int cell = 0; cell < {codegen_cells}; ++cell)
+		{
+			{codegen_cell}
+			{codegen_dst_children}
+		}
 		return res;
 	}	
 )xxx";
+		std::string cellStr{};
 		std::string childrenStr{};
-		if (children.size() > 0)
+		std::string dstChildrenStr{};
+		for (auto handle : scene.GetCodegenChildren(*this))
 		{
-
-			for (auto handle : children)
+			if (auto* child = scene.objects.Get(handle))
 			{
-				if (auto* child = scene.objects.Get(handle))
+				if (polar)
 				{
-					auto childFn = child->GetShaderFunctionName(scene);
-					childrenStr += "{\n";
-					childrenStr += fmt::format("TraceResult r = {}(pt, d);\n", childFn);
-					childrenStr += "res = TraceUnion(res, r);\n";
-					childrenStr += "}\n";
-					if (mirrorX)
-					{
-						childrenStr += "{\n";
-						childrenStr += fmt::format("TraceResult r = {}(pt * vec2(-1.f, 1.f), d);\n", childFn);
-						childrenStr += "res = TraceUnion(res, r);\n";
-						childrenStr += "}\n";
-					}
-					if (mirrorY)
-					{
-						childrenStr += "{\n";
-						childrenStr += fmt::format("TraceResult r = {}(pt * vec2(1.f, -1.f), d);\n", childFn);
-						childrenStr += "res = TraceUnion(res, r);\n";
-						childrenStr += "}\n";
-					}
-					if (mirrorX && mirrorY)
-					{
-						childrenStr += "{\n";
-						childrenStr += fmt::format("TraceResult r = {}(pt * vec2(-1.f, -1.f), d);\n", childFn);
-						childrenStr += "res = TraceUnion(res, r);\n";
-						childrenStr += "}\n";
-					}
+					childrenStr += fmt::format("if (BoundingCircleDst(q, {}) <= res.dst) {{ TraceResult r = {}(q, d); r.grad = RotatePoint(r.grad, angle); res = TraceUnion(res, r); }}\n",
+						GetObjectUniformName("bounding_circle", *child, scene), child->GetShaderFunctionName(scene));
+				}
+				else
+				{
+					childrenStr += GetBoundedUnionCommand(*child, scene, "q");
 				}
+				dstChildrenStr += GetBoundedMinCommand(*child, scene, "q");
 			}
 		}
+		if (polar)
+		{
+			cellStr += fmt::format("float angle = RepeatPolarAngle(pt, {}, cell);\n", GetObjectUniformName("polar_count", *this, scene));
+			cellStr += "vec2 q = RotatePoint(pt, -angle);\n";
+		}
+		else
+		{
+			cellStr += fmt::format("vec2 q = RepeatLatticePoint(pt, {}, cell);\n", GetObjectUniformName("lattice", *this, scene));
+		}
 		ReplaceSubstr(res, "{codegen_fn}", GetObjectFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_dst_fn}", GetObjectDistanceFunctionHeader(*this, scene));
+		ReplaceSubstr(res, "{codegen_cells}", std::to_string(polar ? RepeatPolarCells : RepeatLatticeCells));
+		ReplaceSubstr(res, "{codegen_cell}", cellStr);
 		ReplaceSubstr(res, "{codegen_children}", childrenStr);
+		ReplaceSubstr(res, "{codegen_dst_children}", dstChildrenStr);
 		return res;
 	}
-	void SceneObjectMirror::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
+	void SceneObjectRepeat::FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const
 	{
-
+		auto id = GetObjectUniformId(*this, scene);
+		if (polar)
+		{
+			FillUniform(req, "polar_count", id, float(polarCount));
+		}
+		else
+		{
+			FillUniform(req, "lattice", id, glm::vec4(spacing, glm::vec2(count)));
+		}
 	}
-	std::string SceneObjectMirror::Serialize(const Scene& scene) const
+	void SceneObjectRepeat::GetProgramCommands(SceneProgram& program, const Scene& scene) const
+	{
+		auto op = polar ? SceneOp::PushPolar : SceneOp::PushRepeat;
+		auto params = polar ? glm::vec4(float(polarCount), 0.f, 0.f, 0.f) : glm::vec4(spacing, glm::vec2(count));
+		int cells = polar ? RepeatPolarCells : RepeatLatticeCells;
+		program.Emit(SceneOp::Empty);
+		for (int cell = 0; cell < cells; ++cell)
+		{
+			program.Emit(op, params, 0, cell);
+			for (auto handle : children)
+			{
+				if (auto* child = scene.objects.Get(handle))
+				{
+					child->GetProgramCommands(program, scene);
+					program.Emit(SceneOp::Union);
+				}
+			}
+			program.Emit(SceneOp::PopPoint);
+		}
+	}
+	glm::vec4 SceneObjectRepeat::GetBounds(const Scene& scene) const
+	{
+		auto b = GetChildrenBounds(children, scene);
+		if (IsBoundsEmpty(b))
+		{
+			return b;
+		}
+		if (polar)
+		{
+			auto r = std::max(glm::length(glm::vec2(b.x, b.y)), glm::length(glm::vec2(b.z, b.w)));
+			r = std::max(r, std::max(glm::length(glm::vec2(b.x, b.w)), glm::length(glm::vec2(b.z, b.y))));
+			return glm::vec4(-r, -r, r, r);
+		}
+		auto extent = spacing * glm::vec2(glm::max(count - 1, glm::ivec2(0)));
+		b += glm::vec4(glm::min(extent, glm::vec2(0.f)), glm::max(extent, glm::vec2(0.f)));
+		if (count.x == 0)
+		{
+			b.x = -BoundsInfinity;
+			b.z = BoundsInfinity;
+		}
+		if (count.y == 0)
+		{
+			b.y = -BoundsInfinity;
+			b.w = BoundsInfinity;
+		}
+		return b;
+	}
+	glm::vec3 SceneObjectRepeat::GetBoundingCircle(const Scene& scene) const
+	{
+		if (!polar)
+		{
+			return ISceneObject::GetBoundingCircle(scene);
+		}
+		auto circle = GetChildrenBoundingCircle(children, scene);
+		if (circle.z < 0.f)
+		{
+			return circle;
+		}
+		return glm::vec3(0.f, 0.f, glm::length(glm::vec2(circle)) + circle.z);
+	}
+	SceneChange SceneObjectRepeat::OnGizmos(Scene& scene)
+	{
+		auto* editor = GetEditor();
+		SceneChange change = SceneChange::None;
+		ImGui::PushID(scene.objects.GetHandle(this).value);
+		auto transform = GetTransform(scene);
+		auto toWorld = [&](glm::vec2 pt) { return glm::vec2(transform * glm::vec3(pt, 1.f)); };
+		auto origin = toWorld(glm::vec2(0.f));
+		if (polar)
+		{
+			//Sector evaluated for instance zero
+			float halfStep = std::numbers::pi_v<float> / float(polarCount);
+			float radius = std::max(GetBoundingCircle(scene).z, 0.1f);
+			GizmoLine(editor, origin, toWorld(radius * glm::vec2(std::cos(halfStep), std::sin(halfStep))), 0.01f);
+			GizmoLine(editor, origin, toWorld(radius * glm::vec2(std::cos(halfStep), -std::sin(halfStep))), 0.01f);
+		}
+		else
+		{
+			//Cell of instance zero, handles drag spacing
+			auto h = spacing * 0.5f;
+			std::array<glm::vec2, 4> corners{ toWorld({ -h.x, -h.y }), toWorld({ h.x, -h.y }), toWorld({ h.x, h.y }), toWorld({ -h.x, h.y }) };
+			for (int i = 0; i < 4; ++i)
+			{
+				GizmoLine(editor, corners[i], corners[(i + 1) % 4], 0.01f);
+			}
+			auto right = glm::normalize(toWorld({ 1.f, 0.f }) - origin);
+			auto top = glm::normalize(toWorld({ 0.f, 1.f }) - origin);
+			change |= SceneChange::IntegrationInvalid && GizmoDragRay(editor, 0, spacing.x, origin, right, 0.02f, 0.01f);
+			change |= SceneChange::IntegrationInvalid && GizmoDragRay(editor, 1, spacing.y, origin, top, 0.02f, 0.01f);
+			spacing = glm::max(spacing, glm::vec2(0.001f));
+		}
+		ImGui::PopID();
+		return change;
+	}
+	std::string SceneObjectRepeat::Serialize(const Scene& scene) const
 	{
 		std::string res{};
-		res += "auto object = new SceneObjectMirror();\n";
-		res += fmt::format("object->mirrorX = {};\n", mirrorX);
-		res += fmt::format("object->mirrorY = {};\n", mirrorY);
+		res += "auto object = new SceneObjectRepeat();\n";
+		res += fmt::format("object->polar = {};\n", polar);
+		res += fmt::format("object->spacing = glm::vec2({:.6f}f, {:.6f}f);\n", spacing.x, spacing.y);
+		res += fmt::format("object->count = glm::ivec2({}, {});\n", count.x, count.y);
+		res += fmt::format("object->polarCount = {};\n", polarCount);
 		return res;
 	}
 
@@ -689,20 +2281,6 @@ namespace app
 #endif
 	}
 
-	bool EditString(const std::string& label, std::string& value)
-	{
-		bool changed = false;
-		std::array<char, 2048> buf{};
-		memset(buf.data(), '\0', buf.size());
-		memcpy(buf.data(), value.c_str(), value.size());
-		if (ImGui::InputText(label.c_str(), buf.data(), buf.size()))
-		{
-			value = std::string(buf.data());
-			changed = true;
-		}
-		return changed;
-	}
-
 	SceneChange Scene::OnEditor()
 	{
 		SceneChange change = SceneChange::None;
@@ -724,6 +2302,7 @@ namespace app
 					change |= SceneChange::IntegrationInvalid && ImGui::ColorEdit3("Color", (float*)&material->emission, ImGuiColorEditFlags_Float);
 					change |= SceneChange::IntegrationInvalid && ImGui::DragFloat("Intensity", (float*)&material->emission[3], 1.f, 0.f, 1000.f, "%.6f");
 					change |= SceneChange::IntegrationInvalid && ImGui::DragFloat3("Refraction", (float*)&material->refractionIndex, 0.1f, 0.0f, 1000.f, "%.6f");
+					change |= SceneChange::IntegrationInvalid && ImGui::DragFloat2("Cauchy A, B", (float*)&material->cauchy, 0.01f, 0.0f, 1000.f, "%.6f");
 					change |= SceneChange::IntegrationInvalid && ImGui::DragFloat3("Absorption", (float*)&material->absorption, 0.1f, 0.0f, 1000.f, "%.6f");
 					ImGui::TreePop();
 				}
@@ -760,6 +2339,11 @@ namespace app
 			ImGui::PushID(int(rootObjects.size()));
 			change |= SceneChange::ShaderInvalid && OnObjectDragDropTarget(ISceneObject::Handle{}, *this, true);
 			ImGui::PopID();
+			const auto& report = GetOptimizerReport();
+			ImGui::Separator();
+			ImGui::Text("Generated %d of %d objects", report.emittedCount, report.objectCount);
+			ImGui::Text("Unreachable %d, empty %d, flattened %d, collapsed %d",
+				report.unreachableCount, report.emptyCount, report.flattenedCount, report.collapsedCount);
 			ImGui::EndTabItem();
 		}
 		std::erase_if(rootObjects, [this](const auto& handle)
@@ -770,9 +2354,9 @@ namespace app
 			}
 			return true;
 		});
-		std::erase_if(objects.entries, [](const auto& e)
+		objects.RemoveIf([](const ISceneObject& object)
 		{
-			return e.value->state == ISceneObject::State::Deleted;
+			return object.state == ISceneObject::State::Deleted;
 		});
 		return change;
 	}
@@ -785,68 +2369,430 @@ namespace app
 		}
 		return change;
 	}
+	struct BoundsLeaf
+	{
+		const ISceneObject* object = nullptr;
+		glm::vec2 center{};
+	};
+	//Objects sharing one test at the bottom of the hierarchy, box tests are not free when most of them pass
+	static constexpr int BoundsLeafSize = 2;
+	struct BoundsHierarchyCode
+	{
+		std::string declarations;
+		std::string init;
+		std::string code;
+		std::string distanceCode;
+		int nodeCount = 0;
+	};
+	//Median split of root objects along the wider axis, inner node boxes are unions computed once per pixel in SceneBoundsInit
+	std::string EmitBoundsNode(std::vector<BoundsLeaf>::iterator begin, std::vector<BoundsLeaf>::iterator end, const Scene& scene, BoundsHierarchyCode& hierarchy)
+	{
+		if (end - begin <= BoundsLeafSize)
+		{
+			std::string boundsName;
+			std::string calls;
+			std::string distanceCalls;
+			for (auto it = begin; it != end; ++it)
+			{
+				auto objectBounds = GetObjectUniformName("bounds", *it->object, scene);
+				hierarchy.declarations += fmt::format("uniform vec4 {};\n", objectBounds);
+				calls += GetBoundedUnionCommand(*it->object, scene);
+				distanceCalls += GetBoundedMinCommand(*it->object, scene);
+				boundsName = boundsName.empty() ? objectBounds : fmt::format("BoundsUnion({}, {})", boundsName, objectBounds);
+			}
+			if (end - begin > 1)
+			{
+				auto nodeName = fmt::format("g_scene_bounds_{}", hierarchy.nodeCount++);
+				hierarchy.declarations += fmt::format("vec4 {};\n", nodeName);
+				hierarchy.init += fmt::format("{} = {};\n", nodeName, boundsName);
+				boundsName = nodeName;
+			}
+			hierarchy.code += fmt::format("if (DoesRayIntersectAABB(pt, invD, {}))\n{{\n{}}}\n", boundsName, calls);
+			hierarchy.distanceCode += fmt::format("if (DoesRayIntersectAABB(pt, invD, {}))\n{{\n{}}}\n", boundsName, distanceCalls);
+			return boundsName;
+		}
+		glm::vec2 lo{ std::numeric_limits<float>::max() };
+		glm::vec2 hi{ std::numeric_limits<float>::lowest() };
+		for (auto it = begin; it != end; ++it)
+		{
+			lo = glm::min(lo, it->center);
+			hi = glm::max(hi, it->center);
+		}
+		int axis = (hi.x - lo.x >= hi.y - lo.y) ? 0 : 1;
+		auto mid = begin + (end - begin) / 2;
+		std::nth_element(begin, mid, end, [axis](const BoundsLeaf& a, const BoundsLeaf& b)
+		{
+			return a.center[axis] < b.center[axis];
+		});
+
+		auto boundsName = fmt::format("g_scene_bounds_{}", hierarchy.nodeCount++);
+		auto code = std::move(hierarchy.code);
+		auto distanceCode = std::move(hierarchy.distanceCode);
+		hierarchy.code.clear();
+		hierarchy.distanceCode.clear();
+		auto left = EmitBoundsNode(begin, mid, scene, hierarchy);
+		auto right = EmitBoundsNode(mid, end, scene, hierarchy);
+		hierarchy.declarations += fmt::format("vec4 {};\n", boundsName);
+		hierarchy.init += fmt::format("{} = BoundsUnion({}, {});\n", boundsName, left, right);
+		code += fmt::format("if (DoesRayIntersectAABB(pt, invD, {}))\n{{\n{}}}\n", boundsName, hierarchy.code);
+		distanceCode += fmt::format("if (DoesRayIntersectAABB(pt, invD, {}))\n{{\n{}}}\n", boundsName, hierarchy.distanceCode);
+		hierarchy.code = std::move(code);
+		hierarchy.distanceCode = std::move(distanceCode);
+		return boundsName;
+	}
 	std::string Scene::GetShaderContent() const
 	{
+		codegenPlan = OptimizeSceneForCodegen(*this);
+		//Forwarded objects keep their bounding circle, function called in their place comes from target
+		auto isEmitted = [this](ISceneObject::Handle handle)
+		{
+			auto found = codegenPlan.nodes.find(handle.value);
+			return found != codegenPlan.nodes.end() && !found->second.forward.IsValid();
+		};
 		std::string res{};
-		res += fmt::format("uniform Material u_materials[{}];\n", materials.entries.size() + 1);
+		res += fmt::format("layout(std140) uniform MaterialBlock\n{{\n    Material u_materials[{}];\n}};\n", materials.GetSlotCount());
 		for (auto& [objectHandle, object] : objects.entries)
 		{
+			if (!codegenPlan.nodes.contains(objectHandle.value))
+			{
+				continue;
+			}
+			res += fmt::format("uniform vec3 {};\n", GetObjectUniformName("bounding_circle", *object, *this));
+			if (!isEmitted(objectHandle))
+			{
+				continue;
+			}
+			if (object->GetShaderData(nullptr))
+			{
+				res += fmt::format("uniform int {};\n", GetObjectUniformName("data_offset", *object, *this));
+			}
 			res += object->GetShaderDeclarations(*this);
 		}
 		for (auto& [objectHandle, object] : objects.entries)
 		{
-			res += object->GetShaderCommands(*this);
+			if (isEmitted(objectHandle))
+			{
+				res += object->GetShaderCommands(*this);
+			}
 		}
 		std::string mainFN = R"xxx(
-		TraceResult TraceScene(vec2 pt, vec2 d)
+		{codegen_bounds_declarations}
+		void SceneBoundsInit()
+		{
+			{codegen_bounds_init}
+		}
+		float SceneDistance(vec2 pt, vec2 d)
+		{
+			float res = MAX_TRACE_DST;
+			vec2 invD = RayInverseDir(d);
+			{codegen_distance_roots}
+			return res;
+		}
+		TraceResult SceneMaterialAt(vec2 pt, vec2 d)
 		{
 			TraceResult res;
 			res.dst = MAX_TRACE_DST;
+			vec2 invD = RayInverseDir(d);
 			{codegen_roots}
 			return res;
 		}
 )xxx";
-		std::string rootsStr{};
-		for (auto objectHandle : rootObjects)
+		std::vector<BoundsLeaf> leaves;
+		for (auto objectHandle : codegenPlan.roots)
 		{
 			if (auto* object = objects.Get(objectHandle))
 			{
-				rootsStr += fmt::format("res = TraceUnion(res, {}(pt, d));", object->GetShaderFunctionName(*this));
+				auto bounds = object->GetBounds(*this);
+				leaves.push_back({ object, (glm::vec2(bounds.x, bounds.y) + glm::vec2(bounds.z, bounds.w)) * 0.5f });
 			}
 		}
-		ReplaceSubstr(mainFN, "{codegen_roots}", rootsStr);
+		BoundsHierarchyCode hierarchy{};
+		if (!leaves.empty())
+		{
+			EmitBoundsNode(leaves.begin(), leaves.end(), *this, hierarchy);
+		}
+		ReplaceSubstr(mainFN, "{codegen_bounds_declarations}", hierarchy.declarations);
+		ReplaceSubstr(mainFN, "{codegen_bounds_init}", hierarchy.init);
+		ReplaceSubstr(mainFN, "{codegen_roots}", hierarchy.code);
+		ReplaceSubstr(mainFN, "{codegen_distance_roots}", hierarchy.distanceCode);
 		res += mainFN;
 		return res;
 	}
+	const std::vector<ISceneObject::Handle>& Scene::GetCodegenChildren(const ISceneObject& object) const
+	{
+		static const std::vector<ISceneObject::Handle> noChildren;
+		auto found = codegenPlan.nodes.find(objects.GetHandle(&object).value);
+		if (found != codegenPlan.nodes.end())
+		{
+			return found->second.children;
+		}
+		auto* children = object.GetChildren();
+		return children ? *children : noChildren;
+	}
+	const ISceneObject& Scene::GetCodegenTarget(const ISceneObject& object) const
+	{
+		const auto* target = &object;
+		for (;;)
+		{
+			auto found = codegenPlan.nodes.find(objects.GetHandle(target).value);
+			const auto* next = (found != codegenPlan.nodes.end()) ? objects.Get(found->second.forward) : nullptr;
+			if (!next)
+			{
+				return *target;
+			}
+			target = next;
+		}
+	}
+	glm::vec3 GetSpectralBasis(float wavelength)
+	{
+		glm::vec3 g{};
+		for (int i = 0; i < 3; ++i)
+		{
+			float d = (wavelength - SceneChannelWavelengths[i] * 1000.f) / 50.f;
+			g[i] = std::exp(-0.5f * d * d);
+		}
+		return g / (g.r + g.g + g.b);
+	}
+	glm::mat3 GetSpectralToRGB()
+	{
+		//Midpoint rule at 0.1 nm, basis is smooth over that
+		const int steps = 3400;
+		double gram[3][3] = {};
+		for (int s = 0; s < steps; ++s)
+		{
+			auto b = GetSpectralBasis(SceneSpectrumMin + (s + 0.5f) * (SceneSpectrumMax - SceneSpectrumMin) / steps);
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					gram[i][j] += double(b[i]) * b[j] / steps;
+				}
+			}
+		}
+		glm::mat3 res{};
+		for (int i = 0; i < 3; ++i)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				res[i][j] = float(gram[i][j]);
+			}
+		}
+		return glm::inverse(res);
+	}
+	glm::vec3 GetChannelRefractionIndex(const SceneMaterial& material)
+	{
+		if (material.cauchy.x <= 0.f)
+		{
+			return material.refractionIndex;
+		}
+		glm::vec3 res{};
+		for (int i = 0; i < 3; ++i)
+		{
+			res[i] = material.cauchy.x + material.cauchy.y / (SceneChannelWavelengths[i] * SceneChannelWavelengths[i]);
+		}
+		return res;
+	}
+	glm::vec2 GetCauchyCoefficients(const SceneMaterial& material)
+	{
+		if (material.cauchy.x > 0.f)
+		{
+			return material.cauchy;
+		}
+		//Least squares line through (1 / wavelength^2, index) of the channels that refract, others can't be part of one law
+		float count = 0.f;
+		float meanX = 0.f;
+		float meanN = 0.f;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (material.refractionIndex[i] > 0.f)
+			{
+				count += 1.f;
+				meanX += 1.f / (SceneChannelWavelengths[i] * SceneChannelWavelengths[i]);
+				meanN += material.refractionIndex[i];
+			}
+		}
+		if (count == 0.f)
+		{
+			return glm::vec2(0.f);
+		}
+		meanX /= count;
+		meanN /= count;
+		float covariance = 0.f;
+		float variance = 0.f;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (material.refractionIndex[i] > 0.f)
+			{
+				float dx = 1.f / (SceneChannelWavelengths[i] * SceneChannelWavelengths[i]) - meanX;
+				covariance += dx * (material.refractionIndex[i] - meanN);
+				variance += dx * dx;
+			}
+		}
+		//Single channel gives the mean with no dispersion
+		float b = (variance > 0.f) ? covariance / variance : 0.f;
+		return glm::vec2(meanN - b * meanX, b);
+	}
+	SceneProgram Scene::GetProgram() const
+	{
+		SceneProgram program{};
+		program.materials.resize(materials.GetSlotCount());
+		for (auto& [handle, material] : materials.entries)
+		{
+			auto& m = program.materials[handle.GetIndex()];
+			m.emission = glm::vec3(material->emission) * material->emission[3];
+			m.refractionIndex = GetChannelRefractionIndex(*material);
+			m.absorption = material->absorption;
+			m.cauchy = GetCauchyCoefficients(*material);
+		}
+		program.Emit(SceneOp::Empty);
+		for (auto objectHandle : rootObjects)
+		{
+			if (auto* object = objects.Get(objectHandle))
+			{
+				object->GetProgramCommands(program, *this);
+				program.Emit(SceneOp::Union);
+			}
+		}
+		return program;
+	}
+	//Mirrors Material in trace_frag.glsl, std140 array stride is 64 bytes
+	struct MaterialBlockEntry
+	{
+		glm::vec3 emission{ 0.f };
+		float pad0 = 0.f;
+		glm::vec3 refraction{ 1.f };
+		float pad1 = 0.f;
+		glm::vec3 absorption{ 0.f };
+		float pad2 = 0.f;
+		glm::vec2 cauchy{ 1.f, 0.f };
+		glm::vec2 pad3{ 0.f };
+	};
+	static_assert(sizeof(MaterialBlockEntry) == 64);
 	void Scene::FillShaderUniforms(UniformFillRequest* req) const
 	{
+		//Materials carry all channels, per channel stages only switch u_channel
 		auto stage = GetRenderStage(req);
 		if (stage == RenderStage::Common)
 		{
 			for (auto& [objectHandle, object] : objects.entries)
 			{
 				object->FillShaderUniforms(req, *this);
+				FillUniform(req, "bounding_circle", objectHandle.value, object->GetBoundingCircle(*this));
 			}
-		}
-		else
-		{
-			auto iStage = int(stage);
-			for (auto& [handle, material] : materials.entries)
+			FillShaderData(req);
+			for (auto objectHandle : codegenPlan.roots)
 			{
+				if (auto* object = objects.Get(objectHandle))
 				{
-					auto name = fmt::format("u_materials[{}].emission", handle.value);
-					FillUniform(req, name, material->emission[iStage] * material->emission[3]);
-				}
-				{
-					auto name = fmt::format("u_materials[{}].refraction", handle.value);
-					FillUniform(req, name, material->refractionIndex[iStage]);
+					FillUniform(req, "bounds", GetObjectUniformId(*object, *this), object->GetBounds(*this));
 				}
+			}
+			std::vector<MaterialBlockEntry> block(materials.GetSlotCount());
+			for (auto& [handle, material] : materials.entries)
+			{
+				auto& entry = block[handle.GetIndex()];
+				entry.emission = glm::vec3(material->emission) * material->emission[3];
+				entry.refraction = GetChannelRefractionIndex(*material);
+				entry.absorption = material->absorption;
+				entry.cauchy = GetCauchyCoefficients(*material);
+			}
+			FillUniformBlock(req, "MaterialBlock", block.data(), block.size() * sizeof(MaterialBlockEntry));
+			FillLightUniforms(req);
+		}
+	}
+	std::vector<SceneLight> Scene::GetLights() const
+	{
+		std::vector<SceneLight> res;
+		for (auto& [objectHandle, object] : objects.entries)
+		{
+			auto* material = materials.Get(object->GetMaterial());
+			if (!material)
+			{
+				continue;
+			}
+			auto emission = glm::vec3(material->emission) * material->emission[3];
+			float power = (emission.r + emission.g + emission.b) / 3.f;
+			if (power <= 0.f)
+			{
+				continue;
+			}
+			//Mirrors, repeats and annular shells place the object elsewhere or reshape it, topmost one bounds all of that
+			const ISceneObject* source = object.get();
+			const ISceneObject* top = object.get();
+			for (auto* ancestor = objects.Get(object->parent); ancestor; ancestor = objects.Get(ancestor->parent))
+			{
+				if (!dynamic_cast<const SceneObjectTransform*>(ancestor) && !dynamic_cast<const SceneObjectExactOperator*>(ancestor))
 				{
-					auto name = fmt::format("u_materials[{}].absorption", handle.value);
-					FillUniform(req, name, material->absorption[iStage]);
+					source = ancestor;
 				}
+				top = ancestor;
+			}
+			if (std::find(rootObjects.begin(), rootObjects.end(), objects.GetHandle(top)) == rootObjects.end())
+			{
+				continue;
+			}
+			auto circle = source->GetBoundingCircle(*this);
+			if (circle.z < 0.f || circle.z > BoundsInfinity * 0.5f)
+			{
+				continue;
+			}
+			auto center = glm::vec2(source->GetTransform(*this) * glm::vec3(glm::vec2(circle), 1.f));
+			res.push_back({ glm::vec3(center, circle.z), power });
+		}
+		std::sort(res.begin(), res.end(), [](const SceneLight& a, const SceneLight& b)
+		{
+			return a.power > b.power;
+		});
+		if (res.size() > size_t(SceneLightsMax))
+		{
+			res.resize(SceneLightsMax);
+		}
+		return res;
+	}
+	void Scene::FillLightUniforms(UniformFillRequest* req) const
+	{
+		auto lights = GetLights();
+		std::vector<glm::vec4> packed;
+		for (const auto& light : lights)
+		{
+			packed.emplace_back(light.circle, light.power);
+		}
+		if (!packed.empty())
+		{
+			FillUniformV<float, 4>(req, "u_lights", UniformNoObject, packed.size(), glm::value_ptr(packed[0]));
+		}
+		FillUniform(req, "u_light_count", int(packed.size()));
+	}
+	void Scene::FillShaderData(UniformFillRequest* req) const
+	{
+		std::vector<const std::vector<glm::vec4>*> parts;
+		uint64_t version = 0;
+		int offset = 0;
+		for (auto& [objectHandle, object] : objects.entries)
+		{
+			uint64_t objectVersion = 0;
+			if (const auto* data = object->GetShaderData(&objectVersion))
+			{
+				FillUniform(req, "data_offset", objectHandle.value, offset);
+				version = HashString(std::string_view(reinterpret_cast<const char*>(&objectVersion), sizeof(objectVersion)), version ^ uint64_t(offset));
+				offset += int(data->size());
+				parts.push_back(data);
 			}
 		}
+		if (parts.empty())
+		{
+			return;
+		}
+		if (version != shaderDataVersion || shaderData.size() != size_t(offset))
+		{
+			shaderData.clear();
+			for (const auto* data : parts)
+			{
+				shaderData.insert(shaderData.end(), data->begin(), data->end());
+			}
+			shaderDataVersion = version;
+		}
+		FillUniformTexture(req, "u_scene_data", UniformNoObject, shaderData, shaderDataVersion);
 	}
 	std::string Scene::Serialize() const
 	{
@@ -865,10 +2811,13 @@ namespace app
 				material->refractionIndex.x, material->refractionIndex.y, material->refractionIndex.z);
 			res += fmt::format("material->absorption = glm::vec3({:.6f}f, {:.6f}f, {:.6f}f);\n",
 				material->absorption.x, material->absorption.y, material->absorption.z);
+			if (material->cauchy.x > 0.f)
+			{
+				res += fmt::format("material->cauchy = glm::vec2({:.6f}f, {:.6f}f);\n", material->cauchy.x, material->cauchy.y);
+			}
 			res += fmt::format("materials.Add(SceneMaterial::Handle({}), material);\n", handle.value);
 			res += "}\n";
 		}
-		res += fmt::format("materials.nextFreeHandleValue = {};\n", materials.nextFreeHandleValue);
 		for (const auto& [handle, object] : objects.entries)
 		{
 			res += "{\n";
@@ -884,29 +2833,30 @@ namespace app
 			res += fmt::format("objects.Add(ISceneObject::Handle({}), object);\n", handle.value);
 			res += "}\n";
 		}
-		res += fmt::format("objects.nextFreeHandleValue = {};\n", objects.nextFreeHandleValue);
 		for (const auto& handle : rootObjects)
 		{
 			res += fmt::format("rootObjects.push_back(ISceneObject::Handle({}));\n", handle.value);
 		}
+		auto sceneExposure = exposure;
 		if (auto* render = GetRender())
 		{
-			res += fmt::format("if (GetRender()) RenderSetExposure(GetRender(), {:.6f}f);\n", RenderGetExposure(render));
+			sceneExposure = RenderGetExposure(render);
 		}
+		res += fmt::format("exposure = {:.6f}f;\n", sceneExposure);
+		res += "if (GetRender()) RenderSetExposure(GetRender(), exposure);\n";
 		res += "});\n";
 		return res;
 	}
 
 	void Scene::Reset()
 	{
-		objects.entries.clear();
-		objects.nextFreeHandleValue = 1;
-		materials.entries.clear();
-		materials.nextFreeHandleValue = 1;
+		objects.Clear();
+		materials.Clear();
 		rootObjects.clear();
+		exposure = 1.f;
 		if (auto* render = GetRender())
 		{
-			RenderSetExposure(render, 1.f);
+			RenderSetExposure(render, exposure);
 		}
 	}
 
@@ -991,9 +2941,8 @@ namespace app
 		material->absorption = absColor * absStr;
 		auto refractionBase = glm::linearRand(1.f, 2.2f);
 		auto refractionDiv = glm::linearRand(0.f, 0.05f);
-		material->refractionIndex.r = refractionBase + refractionDiv / (0.7f * 0.7f);
-		material->refractionIndex.g = refractionBase + refractionDiv / (0.55f * 0.55f);
-		material->refractionIndex.b = refractionBase + refractionDiv / (0.45f * 0.45f);
+		material->cauchy = glm::vec2(refractionBase, refractionDiv);
+		material->refractionIndex = GetChannelRefractionIndex(*material);
 		if (glow)
 		{
 			material->emission = glm::vec4(glm::vec3(1.f) - absColor, glm::linearRand(0.0f, 0.5f));
@@ -3,6 +3,7 @@
 #include "utils.h"
 #include "render.h"
 #include "scene_change.h"
+#include "scene_program.h"
 
 namespace app
 {
@@ -38,12 +39,28 @@ namespace app
 	struct SceneHandle
 	{
 		inline static constexpr uint32_t InvalidValue = 0;
+		//Low bits are the storage slot, high bits count reuses of that slot so stale handles stop resolving
+		inline static constexpr uint32_t IndexBits = 20;
+		inline static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+		inline static constexpr uint32_t GenerationMax = ~0u >> IndexBits;
 		SceneHandle() : value(InvalidValue) {}
 		SceneHandle(uint32_t value_) : value(value_) {}
+		static SceneHandle Make(uint32_t index, uint32_t generation)
+		{
+			return SceneHandle((generation << IndexBits) | index);
+		}
 		bool IsValid() const
 		{
 			return value != InvalidValue;
 		}
+		uint32_t GetIndex() const
+		{
+			return value & IndexMask;
+		}
+		uint32_t GetGeneration() const
+		{
+			return value >> IndexBits;
+		}
 		bool operator == (const SceneHandle& other) const
 		{
 			return value == other.value;
@@ -54,6 +71,8 @@ namespace app
 		}
 		uint32_t value = InvalidValue;
 	};
+	//Generational slot map, Get and GetHandle are O(1)
+	//entries stay dense and keep insertion order, removal compacts them in place
 	template<class T>
 	struct SceneHandleStorage
 	{
@@ -62,28 +81,93 @@ namespace app
 			SceneHandle<T> handle{};
 			std::unique_ptr<T> value = nullptr;
 		};
+		struct Slot
+		{
+			uint32_t generation = 0;
+			uint32_t entryIndex = InvalidEntry;
+		};
+		inline static constexpr uint32_t InvalidEntry = ~0u;
 
 		using ContainedType = T;
 		SceneHandle<T> Add(T* value)
 		{
-			auto handle = SceneHandle<T>(nextFreeHandleValue++);
-			auto& w = entries.emplace_back();
-			w.handle = handle;
-			w.value.reset(value);
+			uint32_t index = 0;
+			if (!freeSlots.empty())
+			{
+				index = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			else
+			{
+				index = uint32_t(slots.size());
+				slots.emplace_back();
+			}
+			auto handle = SceneHandle<T>::Make(index, slots[index].generation);
+			Insert(handle, value);
 			return handle;
 		}
+		//Places value under a known handle, used by serialized variants
 		void Add(typename T::Handle handle, T* value)
 		{
-			auto& w = entries.emplace_back();
-			w.handle = handle;
-			w.value.reset(value);
+			auto index = handle.GetIndex();
+			if (index >= slots.size())
+			{
+				for (auto i = uint32_t(slots.size()); i < index; ++i)
+				{
+					freeSlots.push_back(i);
+				}
+				slots.resize(index + 1);
+			}
+			else
+			{
+				if (slots[index].entryIndex != InvalidEntry)
+				{
+					Remove(SceneHandle<T>::Make(index, slots[index].generation));
+				}
+				std::erase(freeSlots, index);
+			}
+			slots[index].generation = handle.GetGeneration();
+			Insert(handle, value);
 		}
 		void Remove(SceneHandle<T> handle)
 		{
-			std::erase_if(entries, [handle](const auto& other)
+			if (const auto* value = Get(handle))
 			{
-				return handle == other.handle;
-			});
+				RemoveIf([value](const T& other)
+				{
+					return value == &other;
+				});
+			}
+		}
+		template<class Pred>
+		void RemoveIf(Pred pred)
+		{
+			uint32_t kept = 0;
+			for (uint32_t i = 0; i < uint32_t(entries.size()); ++i)
+			{
+				auto& w = entries[i];
+				if (pred(std::as_const(*w.value)))
+				{
+					Release(w.handle);
+					entryByValue.erase(w.value.get());
+					continue;
+				}
+				if (kept != i)
+				{
+					entries[kept] = std::move(w);
+					slots[entries[kept].handle.GetIndex()].entryIndex = kept;
+					entryByValue[entries[kept].value.get()] = kept;
+				}
+				kept++;
+			}
+			entries.resize(kept);
+		}
+		void Clear()
+		{
+			entries.clear();
+			slots.assign(1, Slot{});
+			freeSlots.clear();
+			entryByValue.clear();
 		}
 		T* Get(SceneHandle<T> handle)
 		{
@@ -91,37 +175,62 @@ namespace app
 		}
 		const T* Get(SceneHandle<T> handle) const
 		{
-			auto found = std::find_if(entries.begin(), entries.end(), [handle](const auto& other)
-			{
-				return handle == other.handle;
-			});
-			if (found != entries.end())
+			auto index = handle.GetIndex();
+			if (index >= slots.size())
 			{
-				return found->value.get();
+				return nullptr;
 			}
-			else
+			const auto& slot = slots[index];
+			if (slot.entryIndex == InvalidEntry || slot.generation != handle.GetGeneration())
 			{
 				return nullptr;
 			}
+			return entries[slot.entryIndex].value.get();
 		}
 		SceneHandle<T> GetHandle(const T* value) const
 		{
-			auto found = std::find_if(entries.begin(), entries.end(), [value](const auto& other)
-			{
-				return value == other.value.get();
-			});
-			if (found != entries.end())
+			auto found = entryByValue.find(value);
+			if (found != entryByValue.end())
 			{
-				return found->handle;
+				return entries[found->second].handle;
 			}
 			else
 			{
 				return SceneHandle<T>();
 			}
 		}
+		//Upper bound of GetIndex over all live handles, slot 0 is reserved for the invalid handle
+		uint32_t GetSlotCount() const
+		{
+			return uint32_t(slots.size());
+		}
+
+		void Insert(SceneHandle<T> handle, T* value)
+		{
+			auto entryIndex = uint32_t(entries.size());
+			slots[handle.GetIndex()].entryIndex = entryIndex;
+			entryByValue[value] = entryIndex;
+			auto& w = entries.emplace_back();
+			w.handle = handle;
+			w.value.reset(value);
+		}
+		void Release(SceneHandle<T> handle)
+		{
+			auto index = handle.GetIndex();
+			auto& slot = slots[index];
+			slot.entryIndex = InvalidEntry;
+			//Exhausted slots are retired rather than wrapped to an old generation
+			if (slot.generation < SceneHandle<T>::GenerationMax)
+			{
+				slot.generation++;
+				freeSlots.push_back(index);
+			}
+		}
 
-		uint32_t nextFreeHandleValue = SceneHandle<T>::InvalidValue + 1;
 		std::vector<Wrapper> entries;
+		std::vector<Slot> slots = std::vector<Slot>(1);
+		std::vector<uint32_t> freeSlots;
+		std::unordered_map<const T*, uint32_t> entryByValue;
 	};
 
 	struct SceneMaterial
@@ -131,7 +240,21 @@ namespace app
 		glm::vec4 emission{};
 		glm::vec3 refractionIndex{};
 		glm::vec3 absorption{};
+		//Cauchy dispersion law A + B / wavelength^2 in micrometers, replaces refractionIndex when A is above zero
+		glm::vec2 cauchy{};
 	};
+	//Wavelengths in micrometers that red, green and blue channels stand for
+	inline constexpr float SceneChannelWavelengths[3] = { 0.7f, 0.55f, 0.45f };
+	//Range in nanometers that spectral trace mode samples, same as SPECTRUM_MIN and SPECTRUM_MAX in trace_frag.glsl
+	inline constexpr float SceneSpectrumMin = 380.f;
+	inline constexpr float SceneSpectrumMax = 720.f;
+	//Partition of unity peaking at channel wavelengths, same as SpectralBasis in trace_frag.glsl
+	glm::vec3 GetSpectralBasis(float wavelength);
+	//Inverse Gram matrix of the basis averaged over the spectrum, upsampled RGB maps back to itself
+	glm::mat3 GetSpectralToRGB();
+	glm::vec3 GetChannelRefractionIndex(const SceneMaterial& material);
+	//Own law or one fitted through indices of the channels that refract, zero when none of them does
+	glm::vec2 GetCauchyCoefficients(const SceneMaterial& material);
 
 	struct Scene;
 	struct ISceneObject
@@ -152,10 +275,19 @@ namespace app
 		virtual std::string GetShaderDeclarations(const Scene& scene) const = 0;
 		virtual std::string GetShaderCommands(const Scene& scene) const = 0;
 		virtual void FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const = 0;
+		virtual void GetProgramCommands(SceneProgram& program, const Scene& scene) const = 0;
 
 		virtual std::string Serialize(const Scene& scene) const { return {}; }
+		//Texels the object reads at u_data_offset_{id} through SceneDataFetch, version changes with content
+		virtual const std::vector<glm::vec4>* GetShaderData(uint64_t* version) const { return nullptr; }
 
 		virtual glm::mat3 GetTransform(const Scene& scene) const;
+		//Conservative AABB (min.xy, max.xy) in parent space, min > max when object never hits anything
+		virtual glm::vec4 GetBounds(const Scene& scene) const;
+		//Circle (center.xy, radius) in parent space, distance to it is a lower bound of object SDF
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const;
+		//Invalid for objects that only combine or place their children
+		virtual SceneMaterial::Handle GetMaterial() const { return {}; }
 
 		virtual const std::vector<ISceneObject::Handle>* GetChildren() const { return nullptr; };
 		std::vector<ISceneObject::Handle>* GetChildren() 
@@ -176,14 +308,21 @@ namespace app
 	virtual std::string GetShaderDeclarations(const Scene& scene) const override; \
 	virtual std::string GetShaderCommands(const Scene& scene) const override; \
 	virtual void FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const override; \
-	virtual std::string Serialize(const Scene& scene) const override;
+	virtual void GetProgramCommands(SceneProgram& program, const Scene& scene) const override; \
+	virtual std::string Serialize(const Scene& scene) const override; \
+	virtual glm::vec4 GetBounds(const Scene& scene) const override;
 
 	struct SceneObjectTransform : public ISceneObject
 	{
 		SCENE_OBJECT_BOILERPLATE(SceneObjectTransform, Transform);
 		virtual const std::vector<ISceneObject::Handle>* GetChildren() const override { return &children; }
 		virtual glm::mat3 GetTransform(const Scene& scene) const override;
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const override;
 		virtual SceneChange OnGizmos(Scene& scene) override;
+		//Own transform composed with directly enclosing transforms, generated code applies it in one step
+		glm::mat3 GetChainTransform(const Scene& scene) const;
+		//Identity transforms are left out of generated code, flipping this needs new shader
+		bool IsIdentity() const { return translation == glm::vec2(0.f) && rotation == 0.f; }
 		glm::vec2 translation{0.f, 0.f};
 		float rotation = 0.f;
 		std::vector<ISceneObject::Handle> children;
@@ -191,8 +330,10 @@ namespace app
 	struct SceneObjectCircle : public ISceneObject
 	{
 		SCENE_OBJECT_BOILERPLATE(SceneObjectCircle, Circle);
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const override;
 		virtual SceneChange OnGizmos(Scene& scene) override;
 		float radius = 0.1f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
 		SceneMaterial::Handle material;
 	};
 	struct SceneObjectRectangle : public ISceneObject
@@ -201,6 +342,7 @@ namespace app
 		virtual SceneChange OnGizmos(Scene& scene) override;
 		glm::vec2 halfSize{ 0.1, 0.1f };
 		float rounding = 0.0f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
 		SceneMaterial::Handle material;
 	};
 	struct SceneObjectPolygon : public ISceneObject
@@ -209,6 +351,102 @@ namespace app
 		virtual SceneChange OnGizmos(Scene& scene) override;
 		std::vector<glm::vec2> points;
 		float rounding = 0.0f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+	};
+	//Points without repeats of their predecessor, repeated points would give zero length edges with no normal
+	std::vector<glm::vec2> GetPolygonOutline(const std::vector<glm::vec2>& points);
+	//Turns all go the same way and add up to one full turn, so self intersecting stars don't pass
+	bool IsConvexPolygon(const std::vector<glm::vec2>& points);
+	//Edge j -> i of outline as (start, direction) and (outward normal, 1 / squared length), read by PolygonEdge in trace_frag.glsl
+	void GetPolygonEdges(const std::vector<glm::vec2>& outline, std::vector<glm::vec4>& edges, std::vector<glm::vec4>& edgeParams);
+	//Polygon without point limit, distance query walks cells of an edge grid instead of every edge
+	struct SceneObjectLargePolygon : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectLargePolygon, LargePolygon);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		//BuildPolygonGrid blob, rebuilt when pointsVersion changes
+		virtual const std::vector<glm::vec4>* GetShaderData(uint64_t* version) const override;
+		std::vector<glm::vec2> points;
+		float rounding = 0.0f;
+		//Bumped wherever points or rounding of an existing object get edited
+		uint64_t pointsVersion = 0;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+	private:
+		mutable std::vector<glm::vec4> grid;
+		mutable uint64_t gridPointsVersion = 0;
+		mutable uint64_t gridVersion = 0;
+	};
+	//Serialized points of SceneObjectLargePolygon are base64 of raw float pairs
+	void AppendEncodedPoints(std::vector<glm::vec2>& points, std::string_view encoded);
+	//Shape from a bitmap mask, baked to a distance field texture so any outline costs one fetch per step
+	struct SceneObjectDistanceField : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectDistanceField, DistanceField);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		//BuildDistanceField blob, baked again when maskVersion changes
+		const std::vector<glm::vec4>& GetField(uint64_t* version) const;
+		//One byte per pixel, rows from the top, nonzero is inside
+		std::vector<uint8_t> mask;
+		glm::ivec2 maskSize{ 0 };
+		//Scene units across the whole mask
+		float width = 1.f;
+		float rounding = 0.0f;
+		//Bumped wherever mask, mask size or width of an existing object get edited
+		uint64_t maskVersion = 0;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+		//Editor state, not serialized
+		std::string maskPath;
+	private:
+		mutable std::vector<glm::vec4> field;
+		mutable uint64_t fieldMaskVersion = 0;
+		mutable uint64_t fieldVersion = 0;
+	};
+	//Serialized mask of SceneObjectDistanceField is base64 of pixels packed eight per byte, extra bits past size are dropped
+	void AppendEncodedMask(std::vector<uint8_t>& mask, glm::ivec2 size, std::string_view encoded);
+	//Open curves below are stroked, thickness is half of the stroke width
+	struct SceneObjectSegment : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectSegment, Segment);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		glm::vec2 a{ -0.1f, 0.f };
+		glm::vec2 b{ 0.1f, 0.f };
+		float thickness = 0.01f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+	};
+	//Circular arc centered at origin and symmetric around +y axis
+	struct SceneObjectArc : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectArc, Arc);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		float radius = 0.1f;
+		//Half of the covered angle in radians, pi closes the circle
+		float aperture = 1.f;
+		float thickness = 0.01f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+	};
+	struct SceneObjectEllipse : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectEllipse, Ellipse);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		glm::vec2 radii{ 0.2f, 0.1f };
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
+		SceneMaterial::Handle material;
+	};
+	//Quadratic Bezier curve, b is the control point
+	struct SceneObjectBezier : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectBezier, Bezier);
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		glm::vec2 a{ -0.1f, 0.f };
+		glm::vec2 b{ 0.f, 0.1f };
+		glm::vec2 c{ 0.1f, 0.f };
+		float thickness = 0.01f;
+		virtual SceneMaterial::Handle GetMaterial() const override { return material; }
 		SceneMaterial::Handle material;
 	};
 	struct SceneObjectExactOperator : public ISceneObject
@@ -217,6 +455,10 @@ namespace app
 		virtual std::string GetShaderDeclarations(const Scene& scene) const override;
 		virtual std::string GetShaderCommands(const Scene& scene) const override;
 		virtual void FillShaderUniforms(UniformFillRequest* req, const Scene& scene) const override {}
+		virtual void GetProgramCommands(SceneProgram& program, const Scene& scene) const override;
+		virtual SceneOp GetProgramOp() const = 0;
+		virtual glm::vec4 GetBounds(const Scene& scene) const override;
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const override;
 		const std::vector<ISceneObject::Handle>* GetChildren() const override { return &children; }
 		virtual std::string Serialize(const Scene& scene) const override;
 		std::vector<ISceneObject::Handle> children;
@@ -225,20 +467,24 @@ namespace app
 	{
 		inline static ISceneObject* Create() { return new SceneObjectUnion(); }
 		virtual const char* GetName() const override { return "Union"; }
+		virtual SceneOp GetProgramOp() const override { return SceneOp::Union; }
 	};
 	struct SceneObjectDifference : public SceneObjectExactOperator
 	{
 		inline static ISceneObject* Create() { return new SceneObjectDifference(); }
 		virtual const char* GetName() const override { return "Difference"; }
+		virtual SceneOp GetProgramOp() const override { return SceneOp::Difference; }
 	};
 	struct SceneObjectIntersection : public SceneObjectExactOperator
 	{
 		inline static ISceneObject* Create() { return new SceneObjectIntersection(); }
 		virtual const char* GetName() const override { return "Intersection"; }
+		virtual SceneOp GetProgramOp() const override { return SceneOp::Intersection; }
 	};
 	struct SceneObjectAnnular : public ISceneObject
 	{
 		SCENE_OBJECT_BOILERPLATE(SceneObjectAnnular, Annular);
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const override;
 		const std::vector<ISceneObject::Handle>* GetChildren() const override { return &children; }
 		std::vector<ISceneObject::Handle> children;
 		float radius = 0.1f;
@@ -247,10 +493,68 @@ namespace app
 	{
 		SCENE_OBJECT_BOILERPLATE(SceneObjectMirror, Mirror);
 		const std::vector<ISceneObject::Handle>* GetChildren() const override { return &children; }
+		//Per axis half plane child stays in (1 or -1), 0 when it crosses the axis or axis isn't mirrored
+		glm::vec2 GetFoldSide(const ISceneObject& child, const Scene& scene) const;
 		std::vector<ISceneObject::Handle> children;
 		bool mirrorX = false;
 		bool mirrorY = false;;
 	};
+	//Instances children on a lattice or around origin, generated code evaluates nearest cell and its neighbours only
+	struct SceneObjectRepeat : public ISceneObject
+	{
+		SCENE_OBJECT_BOILERPLATE(SceneObjectRepeat, Repeat);
+		virtual glm::vec3 GetBoundingCircle(const Scene& scene) const override;
+		virtual SceneChange OnGizmos(Scene& scene) override;
+		const std::vector<ISceneObject::Handle>* GetChildren() const override { return &children; }
+		std::vector<ISceneObject::Handle> children;
+		bool polar = false;
+		//Instance zero cell is centred on origin and children should fit inside it, others go at spacing * index
+		glm::vec2 spacing{ 0.5f, 0.5f };
+		//0 repeats forever along that axis
+		glm::ivec2 count{ 4, 4 };
+		int polarCount = 6;
+	};
+
+	//What optimizer passes did to the graph before the last codegen
+	struct SceneOptimizerReport
+	{
+		int objectCount = 0;
+		int emittedCount = 0;
+		//Not reachable from root objects
+		int unreachableCount = 0;
+		//In subtrees that can never hit anything
+		int emptyCount = 0;
+		//Operators and identity transforms whose children moved into the parent
+		int flattenedCount = 0;
+		//Single child operators and transforms replaced by a call to the child
+		int collapsedCount = 0;
+	};
+	//Codegen view of the scene graph, objects keep their own uniforms and only the set of
+	//generated functions and which of them get called changes
+	struct SceneCodegenPlan
+	{
+		struct Node
+		{
+			std::vector<ISceneObject::Handle> children;
+			//Object whose function is called instead of this one
+			ISceneObject::Handle forward{};
+		};
+		//Every object generated code refers to, forwarded ones only for their bounding circle
+		std::unordered_map<uint32_t, Node> nodes;
+		std::vector<ISceneObject::Handle> roots;
+		SceneOptimizerReport report;
+	};
+
+	//Emissive object seen from outside, light sampling aims at its bounding circle
+	struct SceneLight
+	{
+		//Root space (center.xy, radius), covers every copy made by mirrors and repeats above the object
+		glm::vec3 circle{};
+		//Mean emission over channels
+		float power = 0.f;
+	};
+	//Length of u_lights in trace_frag.glsl, strongest lights are kept
+	inline constexpr int SceneLightsMax = 16;
 
 	struct Scene
 	{
@@ -258,7 +562,15 @@ namespace app
 		SceneChange OnEditor();
 		SceneChange OnGizmos();
 		std::string GetShaderContent() const;
+		SceneProgram GetProgram() const;
 		void FillShaderUniforms(UniformFillRequest* req) const;
+		std::vector<SceneLight> GetLights() const;
+		//u_lights and u_light_count, interpreted scene needs them too
+		void FillLightUniforms(UniformFillRequest* req) const;
+		//Children and call targets as seen by last codegen, objects outside of it fall back to their own
+		const std::vector<ISceneObject::Handle>& GetCodegenChildren(const ISceneObject& object) const;
+		const ISceneObject& GetCodegenTarget(const ISceneObject& object) const;
+		const SceneOptimizerReport& GetOptimizerReport() const { return codegenPlan.report; }
 
 		void Reset();
 		void LoadVariant(const std::string& name);
@@ -274,10 +586,17 @@ namespace app
 		SceneHandleStorage<SceneMaterial> materials{};
 		SceneHandleStorage<ISceneObject> objects{};
 		std::vector<ISceneObject::Handle> rootObjects{};
+		float exposure = 1.f;
 
 		inline static const char* empyVariantName = "new";
 		std::vector<std::string> variantNames;
 		std::vector<std::function<void()>> variantLoaders;
 		std::string currentVariant = "sandbox";
+	private:
+		void FillShaderData(UniformFillRequest* req) const;
+		//Shader data of all objects back to back, rebuilt when any of them changes
+		mutable std::vector<glm::vec4> shaderData;
+		mutable uint64_t shaderDataVersion = 0;
+		mutable SceneCodegenPlan codegenPlan;
 	};
 }
\ No newline at end of file
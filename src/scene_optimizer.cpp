@@ -0,0 +1,223 @@
+#include "scene_optimizer.h"
+
+namespace app
+{
+	bool IsChainedTransform(const ISceneObject& object, const Scene& scene)
+	{
+		return dynamic_cast<const SceneObjectTransform*>(&object) && dynamic_cast<const SceneObjectTransform*>(scene.objects.Get(object.parent));
+	}
+	//Transforms union their children like Union does
+	SceneOp GetCodegenOp(const ISceneObject* object)
+	{
+		if (auto* op = dynamic_cast<const SceneObjectExactOperator*>(object))
+		{
+			return op->GetProgramOp();
+		}
+		return SceneOp::Union;
+	}
+	bool IsIdentityTransform(const ISceneObject* object)
+	{
+		auto* transform = dynamic_cast<const SceneObjectTransform*>(object);
+		return transform && transform->IsIdentity();
+	}
+	int CountSubtree(const SceneCodegenPlan& plan, ISceneObject::Handle handle)
+	{
+		int count = 1;
+		for (auto child : plan.nodes.at(handle.value).children)
+		{
+			count += CountSubtree(plan, child);
+		}
+		return count;
+	}
+
+	void CollectReachable(const Scene& scene, ISceneObject::Handle handle, SceneCodegenPlan& plan)
+	{
+		auto* object = scene.objects.Get(handle);
+		if (!object || plan.nodes.contains(handle.value))
+		{
+			return;
+		}
+		auto& node = plan.nodes[handle.value];
+		if (auto* children = object->GetChildren())
+		{
+			for (auto child : *children)
+			{
+				if (scene.objects.Get(child))
+				{
+					node.children.push_back(child);
+				}
+			}
+		}
+		for (auto child : node.children)
+		{
+			CollectReachable(scene, child, plan);
+		}
+	}
+	//Operator with nothing left in it gives MAX_TRACE_DST everywhere, so parents drop it like it was never there
+	bool FoldEmptySubtrees(const Scene& scene, ISceneObject::Handle handle, SceneCodegenPlan& plan)
+	{
+		auto* object = scene.objects.Get(handle);
+		if (!object->GetChildren())
+		{
+			return false;
+		}
+		auto& children = plan.nodes.at(handle.value).children;
+		std::vector<bool> isEmpty;
+		for (auto child : children)
+		{
+			isEmpty.push_back(FoldEmptySubtrees(scene, child, plan));
+		}
+		auto op = GetCodegenOp(object);
+		if (op == SceneOp::Intersection)
+		{
+			return children.empty() || std::find(isEmpty.begin(), isEmpty.end(), true) != isEmpty.end();
+		}
+		if (op == SceneOp::Difference && (children.empty() || isEmpty[0]))
+		{
+			return true;
+		}
+		std::vector<ISceneObject::Handle> kept;
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			if (isEmpty[i])
+			{
+				plan.report.emptyCount += CountSubtree(plan, children[i]);
+			}
+			else
+			{
+				kept.push_back(children[i]);
+			}
+		}
+		children = std::move(kept);
+		return children.empty();
+	}
+	//Child brings its own children into the parent list when both combine them the same way in the same space
+	bool CanSplice(const ISceneObject* parent, const ISceneObject* child, bool isFirst)
+	{
+		//Root list is a union too
+		bool isParentUnion = !parent || dynamic_cast<const SceneObjectUnion*>(parent);
+		if (IsIdentityTransform(child))
+		{
+			//Nested transforms still find identity in their chain and take the point parent transform got
+			return isParentUnion || dynamic_cast<const SceneObjectTransform*>(parent);
+		}
+		if (dynamic_cast<const SceneObjectUnion*>(child))
+		{
+			//Not into transforms, those would hand transform children of the union their own input instead of union space point
+			return isParentUnion;
+		}
+		if (dynamic_cast<const SceneObjectIntersection*>(child))
+		{
+			return dynamic_cast<const SceneObjectIntersection*>(parent);
+		}
+		if (dynamic_cast<const SceneObjectDifference*>(child))
+		{
+			//(a - b) - c is a - b - c, subtracted differences don't open up
+			return dynamic_cast<const SceneObjectDifference*>(parent) && isFirst;
+		}
+		return false;
+	}
+	void FlattenChildren(const Scene& scene, const ISceneObject* parent, std::vector<ISceneObject::Handle>& children, SceneCodegenPlan& plan)
+	{
+		std::vector<ISceneObject::Handle> flat;
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			auto* child = scene.objects.Get(children[i]);
+			auto& childChildren = plan.nodes.at(children[i].value).children;
+			FlattenChildren(scene, child, childChildren, plan);
+			if (CanSplice(parent, child, i == 0))
+			{
+				plan.report.flattenedCount++;
+				flat.insert(flat.end(), childChildren.begin(), childChildren.end());
+			}
+			else
+			{
+				flat.push_back(children[i]);
+			}
+		}
+		children = std::move(flat);
+	}
+	//Object with one child left only passes it through, calls go straight to the child
+	void CollapsePassthrough(const Scene& scene, SceneCodegenPlan& plan)
+	{
+		for (auto& [value, node] : plan.nodes)
+		{
+			auto* object = scene.objects.Get(ISceneObject::Handle(value));
+			if (node.children.size() != 1)
+			{
+				continue;
+			}
+			auto* child = scene.objects.Get(node.children[0]);
+			bool isPassthrough = dynamic_cast<const SceneObjectExactOperator*>(object) != nullptr;
+			if (dynamic_cast<const SceneObjectTransform*>(object))
+			{
+				//Chained child already applies this transform, only our bounding circle stays in front of it
+				isPassthrough = IsIdentityTransform(object) || IsChainedTransform(*child, scene);
+			}
+			if (isPassthrough)
+			{
+				node.forward = node.children[0];
+				plan.report.collapsedCount++;
+			}
+		}
+	}
+	void CollectLive(ISceneObject::Handle handle, const SceneCodegenPlan& plan, SceneCodegenPlan& live)
+	{
+		if (live.nodes.contains(handle.value))
+		{
+			return;
+		}
+		const auto& node = plan.nodes.at(handle.value);
+		live.nodes[handle.value] = node;
+		for (auto child : node.children)
+		{
+			CollectLive(child, plan, live);
+		}
+	}
+
+	SceneCodegenPlan OptimizeSceneForCodegen(const Scene& scene)
+	{
+		SceneCodegenPlan plan{};
+		plan.report.objectCount = int(scene.objects.entries.size());
+		for (auto handle : scene.rootObjects)
+		{
+			if (scene.objects.Get(handle))
+			{
+				plan.roots.push_back(handle);
+				CollectReachable(scene, handle, plan);
+			}
+		}
+		plan.report.unreachableCount = plan.report.objectCount - int(plan.nodes.size());
+
+		std::vector<ISceneObject::Handle> roots;
+		for (auto handle : plan.roots)
+		{
+			if (FoldEmptySubtrees(scene, handle, plan))
+			{
+				plan.report.emptyCount += CountSubtree(plan, handle);
+			}
+			else
+			{
+				roots.push_back(handle);
+			}
+		}
+		plan.roots = std::move(roots);
+
+		FlattenChildren(scene, nullptr, plan.roots, plan);
+
+		//Spliced and folded objects are left behind, keep only what generated code refers to
+		SceneCodegenPlan live{};
+		live.roots = plan.roots;
+		live.report = plan.report;
+		for (auto handle : live.roots)
+		{
+			CollectLive(handle, plan, live);
+		}
+		CollapsePassthrough(scene, live);
+		for (const auto& [value, node] : live.nodes)
+		{
+			live.report.emittedCount += node.forward.IsValid() ? 0 : 1;
+		}
+		return live;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "scene.h"
+
+namespace app
+{
+	//Passes over the graph under root objects, in order: unreachable object elimination, empty subtree folding,
+	//flattening of nested operators and identity transforms, collapsing of single child operators and transform chains
+	SceneCodegenPlan OptimizeSceneForCodegen(const Scene& scene);
+	//Transform folding enclosing transforms into its matrix, called with the point they got instead of their local one
+	bool IsChainedTransform(const ISceneObject& object, const Scene& scene);
+}
\ No newline at end of file
@@ -0,0 +1,554 @@
+#include "scene_program.h"
+#include "polygon_grid.h"
+#include "distance_field.h"
+
+namespace app
+{
+	void SceneProgram::Emit(SceneOp op, glm::vec4 params, int material, int arg)
+	{
+		auto& ins = instructions.emplace_back();
+		ins.op = op;
+		ins.params = params;
+		ins.material = material;
+		ins.arg = arg;
+		switch (op)
+		{
+		case SceneOp::Empty:
+		case SceneOp::Circle:
+		case SceneOp::Rectangle:
+		case SceneOp::Polygon:
+		case SceneOp::PolygonGrid:
+		case SceneOp::DistanceField:
+		case SceneOp::Segment:
+		case SceneOp::Arc:
+		case SceneOp::Ellipse:
+		case SceneOp::Bezier:
+			resultDepth++;
+			break;
+		case SceneOp::Union:
+		case SceneOp::Difference:
+		case SceneOp::Intersection:
+			resultDepth--;
+			break;
+		case SceneOp::PushTransform:
+		case SceneOp::PushScale:
+		case SceneOp::PushRepeat:
+		case SceneOp::PushPolar:
+			pointDepth++;
+			break;
+		case SceneOp::PopPoint:
+			pointDepth--;
+			break;
+		default:
+			break;
+		}
+		maxResultDepth = std::max(maxResultDepth, resultDepth);
+		maxPointDepth = std::max(maxPointDepth, pointDepth);
+	}
+	bool SceneProgram::IsValid() const
+	{
+		return maxResultDepth <= SceneProgramStackMax && maxPointDepth <= SceneProgramStackMax;
+	}
+
+	float CircleSDF(glm::vec2 pt, float circleRadius)
+	{
+		return glm::length(pt) - circleRadius;
+	}
+	float RectangleSDF(glm::vec2 pt, glm::vec2 halfSize, float rounding)
+	{
+		auto pa = glm::abs(pt);
+		auto ph = pa - halfSize;
+		auto d = glm::max(ph, glm::vec2(0.f));
+		return glm::length(d) + std::min(std::max(ph.x, ph.y), 0.f) - rounding;
+	}
+	float PolygonSDF(glm::vec2 pt, int ptsCount, const glm::vec2* pts, float rounding)
+	{
+		float minDst = 1000.f;
+		float s = 1.f;
+		for (int i = 0, j = ptsCount - 1; i < ptsCount; j = i, ++i)
+		{
+			auto e = pts[i] - pts[j];
+			auto p = pt - pts[j];
+			auto perp = p - e * glm::clamp(glm::dot(p, e) / glm::dot(e, e), 0.f, 1.f);
+			minDst = std::min(glm::dot(perp, perp), minDst);
+			bool c0 = pt.y >= pts[j].y;
+			bool c1 = pt.y < pts[i].y;
+			bool c2 = e.x * p.y - e.y * p.x > 0.f;
+			if ((c0 && c1 && c2) || (!c0 && !c1 && !c2))
+			{
+				s *= -1.f;
+			}
+		}
+		return s * std::sqrt(minDst) - rounding;
+	}
+	float SegmentSDF(glm::vec2 pt, glm::vec2 a, glm::vec2 b, float thickness)
+	{
+		auto e = b - a;
+		auto p = pt - a;
+		float ee = glm::dot(e, e);
+		auto perp = p - e * (ee > 0.f ? glm::clamp(glm::dot(p, e) / ee, 0.f, 1.f) : 0.f);
+		return glm::length(perp) - thickness;
+	}
+	float ArcSDF(glm::vec2 pt, glm::vec2 sc, float radius, float thickness)
+	{
+		glm::vec2 p{ std::abs(pt.x), pt.y };
+		float l = (sc.y * p.x > sc.x * p.y) ? glm::length(p - sc * radius) : std::abs(glm::length(p) - radius);
+		return l - thickness;
+	}
+	//Same iteration and stopping rule as EllipseSDFGrad in trace_frag.glsl
+	float EllipseSDF(glm::vec2 pt, glm::vec2 radii)
+	{
+		auto pa = glm::abs(pt);
+		glm::vec2 t{ std::numbers::sqrt2_v<float> * 0.5f };
+		float k = radii.x * radii.x - radii.y * radii.y;
+		for (int i = 0; i < EllipseIterationsMax; ++i)
+		{
+			auto e = glm::vec2(k, -k) * t * t * t / radii;
+			auto n = radii * t;
+			auto q = pa - e;
+			float lq = glm::length(q);
+			float lr = glm::length(n - e);
+			auto prev = t;
+			t = glm::clamp(pa - q * (glm::dot(pa - n, pa + n - 2.f * e) / std::max(lq * (lq + lr), 1e-30f)), glm::vec2(0.f), radii) / radii;
+			t /= std::max(glm::length(t), 1e-12f);
+			if (std::abs(t.x - prev.x) + std::abs(t.y - prev.y) < EllipseTolerance)
+			{
+				break;
+			}
+		}
+		float l = glm::length(pa - radii * t);
+		return glm::dot(pa / radii, pa / radii) < 1.f ? -l : l;
+	}
+	//Same closed form cubic as BezierSDFGrad in trace_frag.glsl
+	float BezierSDF(glm::vec2 pt, glm::vec2 A, glm::vec2 B, glm::vec2 C, float thickness)
+	{
+		auto a = B - A;
+		auto b = A - 2.f * B + C;
+		auto c = a * 2.f;
+		auto d = A - pt;
+		float bb = glm::dot(b, b);
+		if (bb < 1e-10f)
+		{
+			return SegmentSDF(pt, A, C, thickness);
+		}
+		float kk = 1.f / bb;
+		float kx = kk * glm::dot(a, b);
+		float ky = kk * (2.f * glm::dot(a, a) + glm::dot(d, b)) / 3.f;
+		float kz = kk * glm::dot(d, a);
+		float p = ky - kx * kx;
+		float q = kx * (2.f * kx * kx - 3.f * ky) + kz;
+		float h = q * q + 4.f * p * p * p;
+		auto dst2 = [&](float t)
+		{
+			auto perp = d + (c + b * t) * t;
+			return glm::dot(perp, perp);
+		};
+		float res = 0.f;
+		if (h >= 0.f)
+		{
+			h = std::sqrt(h);
+			float t = std::cbrt((h - q) * 0.5f) + std::cbrt((-h - q) * 0.5f) - kx;
+			res = dst2(std::clamp(t, 0.f, 1.f));
+		}
+		else
+		{
+			float z = std::sqrt(-p);
+			float v = std::acos(q / (p * z * 2.f)) / 3.f;
+			float m = std::cos(v);
+			float n = std::sin(v) * std::numbers::sqrt3_v<float>;
+			res = std::min(dst2(std::clamp((m + m) * z - kx, 0.f, 1.f)), dst2(std::clamp((-n - m) * z - kx, 0.f, 1.f)));
+		}
+		return std::sqrt(res) - thickness;
+	}
+
+	glm::vec2 RepeatLatticePoint(glm::vec2 pt, glm::vec4 lattice, int cell)
+	{
+		glm::vec2 spacing{ lattice.x, lattice.y };
+		glm::vec2 lo{ lattice.z == 0.f ? -1e30f : 0.f, lattice.w == 0.f ? -1e30f : 0.f };
+		glm::vec2 hi{ lattice.z == 0.f ? 1e30f : lattice.z - 1.f, lattice.w == 0.f ? 1e30f : lattice.w - 1.f };
+		glm::vec2 id{ std::round(pt.x / spacing.x), std::round(pt.y / spacing.y) };
+		id = glm::clamp(id, lo, hi);
+		glm::vec2 o{ pt.x >= spacing.x * id.x ? 1.f : -1.f, pt.y >= spacing.y * id.y ? 1.f : -1.f };
+		id = glm::clamp(id + o * glm::vec2(float(cell & 1), float(cell >> 1)), lo, hi);
+		return pt - spacing * id;
+	}
+	float RepeatPolarAngle(glm::vec2 pt, float count, int cell)
+	{
+		float step = 2.f * std::numbers::pi_v<float> / count;
+		float angle = std::atan2(pt.y, pt.x);
+		float sector = std::round(angle / step);
+		float o = angle >= sector * step ? 1.f : -1.f;
+		return (sector + o * float(cell)) * step;
+	}
+	glm::vec2 RepeatPolarPoint(glm::vec2 pt, float count, int cell)
+	{
+		float angle = -RepeatPolarAngle(pt, count, cell);
+		float c = std::cos(angle);
+		float s = std::sin(angle);
+		return { c * pt.x - s * pt.y, s * pt.x + c * pt.y };
+	}
+
+	SceneProgramResult EvaluateSceneProgram(const SceneProgram& program, glm::vec2 pt, float missDst)
+	{
+		std::array<SceneProgramResult, SceneProgramStackMax> results;
+		std::array<glm::vec2, SceneProgramStackMax> points;
+		int resultTop = 0;
+		int pointTop = 0;
+		for (const auto& ins : program.instructions)
+		{
+			const auto& p = ins.params;
+			switch (ins.op)
+			{
+			case SceneOp::Empty:
+				results[resultTop++] = { missDst, 0 };
+				break;
+			case SceneOp::Circle:
+				results[resultTop++] = { CircleSDF(pt, p.x), ins.material };
+				break;
+			case SceneOp::Rectangle:
+				results[resultTop++] = { RectangleSDF(pt, glm::vec2(p.x, p.y), p.z), ins.material };
+				break;
+			case SceneOp::Polygon:
+				results[resultTop++] = { PolygonSDF(pt, int(p.y), program.points.data() + int(p.x), p.z), ins.material };
+				break;
+			case SceneOp::PolygonGrid:
+				results[resultTop++] = { PolygonGridSDF(program.data.data() + int(p.x), pt), ins.material };
+				break;
+			case SceneOp::Segment:
+				results[resultTop++] = { SegmentSDF(pt, program.points[int(p.x)], program.points[int(p.x) + 1], p.y), ins.material };
+				break;
+			case SceneOp::Arc:
+				results[resultTop++] = { ArcSDF(pt, glm::vec2(p.y, p.z), p.x, p.w), ins.material };
+				break;
+			case SceneOp::Ellipse:
+				results[resultTop++] = { EllipseSDF(pt, glm::vec2(p.x, p.y)), ins.material };
+				break;
+			case SceneOp::Bezier:
+			{
+				const auto* pts = program.points.data() + int(p.x);
+				results[resultTop++] = { BezierSDF(pt, pts[0], pts[1], pts[2], p.y), ins.material };
+				break;
+			}
+			case SceneOp::DistanceField:
+				results[resultTop++] = { DistanceFieldSDF(program.data.data() + int(p.x), pt) - p.y, ins.material };
+				break;
+			case SceneOp::Union:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				a = (a.dst < b.dst) ? a : b;
+				break;
+			}
+			case SceneOp::Difference:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				b.dst = -b.dst;
+				a = (a.dst >= b.dst) ? a : b;
+				break;
+			}
+			case SceneOp::Intersection:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				a = (a.dst >= b.dst) ? a : b;
+				break;
+			}
+			case SceneOp::Annular:
+			{
+				auto& a = results[resultTop - 1];
+				a.dst = std::abs(a.dst) - p.x;
+				break;
+			}
+			case SceneOp::PushTransform:
+			{
+				points[pointTop++] = pt;
+				auto tp = pt - glm::vec2(p.x, p.y);
+				pt.x = p.z * tp.x - p.w * tp.y;
+				pt.y = p.w * tp.x + p.z * tp.y;
+				break;
+			}
+			case SceneOp::PushScale:
+				points[pointTop++] = pt;
+				pt *= glm::vec2(p.x, p.y);
+				break;
+			case SceneOp::PushRepeat:
+				points[pointTop++] = pt;
+				pt = RepeatLatticePoint(pt, p, ins.arg);
+				break;
+			case SceneOp::PushPolar:
+				points[pointTop++] = pt;
+				pt = RepeatPolarPoint(pt, p.x, ins.arg);
+				break;
+			case SceneOp::PopPoint:
+				pt = points[--pointTop];
+				break;
+			}
+		}
+		if (resultTop > 0)
+		{
+			return results[resultTop - 1];
+		}
+		return { missDst, 0 };
+	}
+
+	FloatPack CircleSDF(FloatPack x, FloatPack y, float circleRadius)
+	{
+		return PackSqrt(x * x + y * y) - PackSet(circleRadius);
+	}
+	FloatPack RectangleSDF(FloatPack x, FloatPack y, glm::vec2 halfSize, float rounding)
+	{
+		auto zero = PackSet(0.f);
+		auto phx = PackAbs(x) - PackSet(halfSize.x);
+		auto phy = PackAbs(y) - PackSet(halfSize.y);
+		auto dx = PackMax(phx, zero);
+		auto dy = PackMax(phy, zero);
+		return PackSqrt(dx * dx + dy * dy) + PackMin(PackMax(phx, phy), zero) - PackSet(rounding);
+	}
+	FloatPack PolygonSDF(FloatPack x, FloatPack y, int ptsCount, const glm::vec2* pts, float rounding)
+	{
+		auto zero = PackSet(0.f);
+		auto one = PackSet(1.f);
+		auto minDst = PackSet(1000.f);
+		auto s = one;
+		for (int i = 0, j = ptsCount - 1; i < ptsCount; j = i, ++i)
+		{
+			auto e = pts[i] - pts[j];
+			auto ex = PackSet(e.x);
+			auto ey = PackSet(e.y);
+			auto px = x - PackSet(pts[j].x);
+			auto py = y - PackSet(pts[j].y);
+			auto h = PackClamp((px * ex + py * ey) / PackSet(glm::dot(e, e)), zero, one);
+			auto perpX = px - ex * h;
+			auto perpY = py - ey * h;
+			minDst = PackMin(perpX * perpX + perpY * perpY, minDst);
+			auto c0 = y >= PackSet(pts[j].y);
+			auto c1 = PackSet(pts[i].y) > y;
+			auto c2 = ex * py - ey * px > zero;
+			//All three set or all three clear flips the sign
+			s = PackSelect((c0 == c1) & (c1 == c2), -s, s);
+		}
+		return s * PackSqrt(minDst) - PackSet(rounding);
+	}
+	FloatPack SegmentSDF(FloatPack x, FloatPack y, glm::vec2 a, glm::vec2 b, float thickness)
+	{
+		auto e = b - a;
+		float ee = glm::dot(e, e);
+		auto ex = PackSet(e.x);
+		auto ey = PackSet(e.y);
+		auto px = x - PackSet(a.x);
+		auto py = y - PackSet(a.y);
+		auto h = ee > 0.f ? PackClamp((px * ex + py * ey) / PackSet(ee), PackSet(0.f), PackSet(1.f)) : PackSet(0.f);
+		auto perpX = px - ex * h;
+		auto perpY = py - ey * h;
+		return PackSqrt(perpX * perpX + perpY * perpY) - PackSet(thickness);
+	}
+	FloatPack ArcSDF(FloatPack x, FloatPack y, glm::vec2 sc, float radius, float thickness)
+	{
+		auto px = PackAbs(x);
+		auto qx = px - PackSet(sc.x * radius);
+		auto qy = y - PackSet(sc.y * radius);
+		auto toEnd = PackSqrt(qx * qx + qy * qy);
+		auto toCircle = PackAbs(PackSqrt(px * px + y * y) - PackSet(radius));
+		return PackSelect(PackSet(sc.y) * px > PackSet(sc.x) * y, toEnd, toCircle) - PackSet(thickness);
+	}
+	FloatPack EllipseSDF(FloatPack x, FloatPack y, glm::vec2 radii)
+	{
+		auto zero = PackSet(0.f);
+		auto ax = PackSet(radii.x);
+		auto ay = PackSet(radii.y);
+		auto pax = PackAbs(x);
+		auto pay = PackAbs(y);
+		auto tx = PackSet(std::numbers::sqrt2_v<float> * 0.5f);
+		auto ty = tx;
+		auto kx = PackSet((radii.x * radii.x - radii.y * radii.y) / radii.x);
+		auto ky = PackSet((radii.y * radii.y - radii.x * radii.x) / radii.y);
+		//Lanes have no early out, converged ones sit at the fixed point for the remaining iterations
+		for (int i = 0; i < EllipseIterationsMax; ++i)
+		{
+			auto ex = kx * tx * tx * tx;
+			auto ey = ky * ty * ty * ty;
+			auto nx = ax * tx;
+			auto ny = ay * ty;
+			auto rx = nx - ex;
+			auto ry = ny - ey;
+			auto qx = pax - ex;
+			auto qy = pay - ey;
+			auto lq = PackSqrt(qx * qx + qy * qy);
+			auto lr = PackSqrt(rx * rx + ry * ry);
+			auto step = ((pax - nx) * (pax + nx - ex - ex) + (pay - ny) * (pay + ny - ey - ey)) / PackMax(lq * (lq + lr), PackSet(1e-30f));
+			tx = PackClamp(pax - qx * step, zero, ax) / ax;
+			ty = PackClamp(pay - qy * step, zero, ay) / ay;
+			auto lt = PackMax(PackSqrt(tx * tx + ty * ty), PackSet(1e-12f));
+			tx = tx / lt;
+			ty = ty / lt;
+		}
+		auto vx = pax - ax * tx;
+		auto vy = pay - ay * ty;
+		auto l = PackSqrt(vx * vx + vy * vy);
+		auto ux = pax / ax;
+		auto uy = pay / ay;
+		return PackSelect(ux * ux + uy * uy < PackSet(1.f), -l, l);
+	}
+
+	SceneProgramPacketResult EvaluateSceneProgramPacket(const SceneProgram& program, FloatPack x, FloatPack y, float missDst)
+	{
+		std::array<SceneProgramPacketResult, SceneProgramStackMax> results;
+		std::array<FloatPack, SceneProgramStackMax> pointsX;
+		std::array<FloatPack, SceneProgramStackMax> pointsY;
+		int resultTop = 0;
+		int pointTop = 0;
+		for (const auto& ins : program.instructions)
+		{
+			const auto& p = ins.params;
+			auto material = PackSet(float(ins.material));
+			switch (ins.op)
+			{
+			case SceneOp::Empty:
+				results[resultTop++] = { PackSet(missDst), PackSet(0.f) };
+				break;
+			case SceneOp::Circle:
+				results[resultTop++] = { CircleSDF(x, y, p.x), material };
+				break;
+			case SceneOp::Rectangle:
+				results[resultTop++] = { RectangleSDF(x, y, glm::vec2(p.x, p.y), p.z), material };
+				break;
+			case SceneOp::Polygon:
+				results[resultTop++] = { PolygonSDF(x, y, int(p.y), program.points.data() + int(p.x), p.z), material };
+				break;
+			case SceneOp::PolygonGrid:
+			{
+				//Cell lists differ per lane, done per lane
+				std::array<float, FloatPack::Width> lx;
+				std::array<float, FloatPack::Width> ly;
+				PackStore(lx.data(), x);
+				PackStore(ly.data(), y);
+				for (int i = 0; i < FloatPack::Width; ++i)
+				{
+					lx[i] = PolygonGridSDF(program.data.data() + int(p.x), { lx[i], ly[i] });
+				}
+				results[resultTop++] = { PackLoad(lx.data()), material };
+				break;
+			}
+			case SceneOp::Segment:
+				results[resultTop++] = { SegmentSDF(x, y, program.points[int(p.x)], program.points[int(p.x) + 1], p.y), material };
+				break;
+			case SceneOp::Arc:
+				results[resultTop++] = { ArcSDF(x, y, glm::vec2(p.y, p.z), p.x, p.w), material };
+				break;
+			case SceneOp::Ellipse:
+				results[resultTop++] = { EllipseSDF(x, y, glm::vec2(p.x, p.y)), material };
+				break;
+			case SceneOp::Bezier:
+			{
+				//Root selection branches per lane, done per lane
+				const auto* pts = program.points.data() + int(p.x);
+				std::array<float, FloatPack::Width> lx;
+				std::array<float, FloatPack::Width> ly;
+				PackStore(lx.data(), x);
+				PackStore(ly.data(), y);
+				for (int i = 0; i < FloatPack::Width; ++i)
+				{
+					lx[i] = BezierSDF({ lx[i], ly[i] }, pts[0], pts[1], pts[2], p.y);
+				}
+				results[resultTop++] = { PackLoad(lx.data()), material };
+				break;
+			}
+			case SceneOp::DistanceField:
+			{
+				//Samples sit at different texels per lane, done per lane
+				std::array<float, FloatPack::Width> lx;
+				std::array<float, FloatPack::Width> ly;
+				PackStore(lx.data(), x);
+				PackStore(ly.data(), y);
+				for (int i = 0; i < FloatPack::Width; ++i)
+				{
+					lx[i] = DistanceFieldSDF(program.data.data() + int(p.x), { lx[i], ly[i] }) - p.y;
+				}
+				results[resultTop++] = { PackLoad(lx.data()), material };
+				break;
+			}
+			case SceneOp::Union:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				auto mask = a.dst < b.dst;
+				a = { PackSelect(mask, a.dst, b.dst), PackSelect(mask, a.material, b.material) };
+				break;
+			}
+			case SceneOp::Difference:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				b.dst = -b.dst;
+				auto mask = a.dst >= b.dst;
+				a = { PackSelect(mask, a.dst, b.dst), PackSelect(mask, a.material, b.material) };
+				break;
+			}
+			case SceneOp::Intersection:
+			{
+				auto b = results[--resultTop];
+				auto& a = results[resultTop - 1];
+				auto mask = a.dst >= b.dst;
+				a = { PackSelect(mask, a.dst, b.dst), PackSelect(mask, a.material, b.material) };
+				break;
+			}
+			case SceneOp::Annular:
+			{
+				auto& a = results[resultTop - 1];
+				a.dst = PackAbs(a.dst) - PackSet(p.x);
+				break;
+			}
+			case SceneOp::PushTransform:
+			{
+				pointsX[pointTop] = x;
+				pointsY[pointTop++] = y;
+				auto tx = x - PackSet(p.x);
+				auto ty = y - PackSet(p.y);
+				auto c = PackSet(p.z);
+				auto s = PackSet(p.w);
+				x = c * tx - s * ty;
+				y = s * tx + c * ty;
+				break;
+			}
+			case SceneOp::PushScale:
+				pointsX[pointTop] = x;
+				pointsY[pointTop++] = y;
+				x = x * PackSet(p.x);
+				y = y * PackSet(p.y);
+				break;
+			case SceneOp::PushRepeat:
+			case SceneOp::PushPolar:
+			{
+				pointsX[pointTop] = x;
+				pointsY[pointTop++] = y;
+				//Cell lookup needs round and atan2, done per lane
+				std::array<float, FloatPack::Width> lx;
+				std::array<float, FloatPack::Width> ly;
+				PackStore(lx.data(), x);
+				PackStore(ly.data(), y);
+				for (int i = 0; i < FloatPack::Width; ++i)
+				{
+					glm::vec2 lp{ lx[i], ly[i] };
+					lp = (ins.op == SceneOp::PushRepeat) ? RepeatLatticePoint(lp, p, ins.arg) : RepeatPolarPoint(lp, p.x, ins.arg);
+					lx[i] = lp.x;
+					ly[i] = lp.y;
+				}
+				x = PackLoad(lx.data());
+				y = PackLoad(ly.data());
+				break;
+			}
+			case SceneOp::PopPoint:
+				--pointTop;
+				x = pointsX[pointTop];
+				y = pointsY[pointTop];
+				break;
+			}
+		}
+		if (resultTop > 0)
+		{
+			return results[resultTop - 1];
+		}
+		return { PackSet(missDst), PackSet(0.f) };
+	}
+}
\ No newline at end of file
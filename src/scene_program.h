@@ -0,0 +1,103 @@
+#pragma once
+
+#include "simd.h"
+
+namespace app
+{
+	inline constexpr int SceneProgramStackMax = 32;
+
+	enum class SceneOp : uint32_t
+	{
+		Empty,
+		Circle,
+		Rectangle,
+		Polygon,
+		Union,
+		Difference,
+		Intersection,
+		Annular,
+		PushTransform,
+		PushScale,
+		PopPoint,
+		PushRepeat,
+		PushPolar,
+		PolygonGrid,
+		DistanceField,
+		Segment,
+		Arc,
+		Ellipse,
+		Bezier,
+	};
+	//Cells checked per repeat, nearest one plus neighbours towards the point
+	inline constexpr int RepeatLatticeCells = 4;
+	inline constexpr int RepeatPolarCells = 2;
+	//Nearest point iterations on an ellipse stop once the parameter moves less than tolerance, same numbers as EllipseSDFGrad in trace_frag.glsl
+	inline constexpr int EllipseIterationsMax = 10;
+	inline constexpr float EllipseTolerance = 1e-6f;
+
+	//Single step of the flattened scene, params layout depends on op:
+	//Circle: x - radius
+	//Rectangle: xy - half size, z - rounding
+	//Polygon: x - first point, y - point count, z - rounding
+	//Annular: x - radius
+	//PushTransform: xy - translation, zw - cos/sin of negated rotation
+	//PushScale: xy - scale
+	//PushRepeat: xy - spacing, zw - count (0 is endless), arg - cell
+	//PushPolar: x - count, arg - cell
+	//PolygonGrid: x - first texel of BuildPolygonGrid blob in data
+	//DistanceField: x - first texel of BuildDistanceField blob in data, y - rounding
+	//Segment: x - first of two points, y - thickness
+	//Arc: x - radius, yz - sin/cos of aperture, w - thickness
+	//Ellipse: xy - radii
+	//Bezier: x - first of three control points, y - thickness
+	struct SceneInstruction
+	{
+		SceneOp op = SceneOp::Empty;
+		int material = 0;
+		int arg = 0;
+		glm::vec4 params{};
+	};
+	struct SceneProgramMaterial
+	{
+		glm::vec3 emission{};
+		glm::vec3 refractionIndex{};
+		glm::vec3 absorption{};
+		glm::vec2 cauchy{};
+	};
+	struct SceneProgramResult
+	{
+		float dst = 0.f;
+		int material = 0;
+	};
+	//Material index is kept in float lanes, exact for any realistic handle value
+	struct SceneProgramPacketResult
+	{
+		FloatPack dst;
+		FloatPack material;
+	};
+
+	//Stack machine form of the scene graph, evaluated the same way as codegen output of Scene::GetShaderContent
+	struct SceneProgram
+	{
+		void Emit(SceneOp op, glm::vec4 params = {}, int material = 0, int arg = 0);
+		bool IsValid() const;
+
+		std::vector<SceneInstruction> instructions;
+		std::vector<glm::vec2> points;
+		std::vector<glm::vec4> data;
+		std::vector<SceneProgramMaterial> materials;
+
+		int resultDepth = 0;
+		int pointDepth = 0;
+		int maxResultDepth = 0;
+		int maxPointDepth = 0;
+	};
+
+	//Shared by both evaluators, same math as RepeatLatticePoint and RepeatPolarAngle in trace_frag.glsl
+	glm::vec2 RepeatLatticePoint(glm::vec2 pt, glm::vec4 lattice, int cell);
+	float RepeatPolarAngle(glm::vec2 pt, float count, int cell);
+
+	SceneProgramResult EvaluateSceneProgram(const SceneProgram& program, glm::vec2 pt, float missDst);
+	//Evaluates FloatPack::Width points at once, every lane runs the whole program
+	SceneProgramPacketResult EvaluateSceneProgramPacket(const SceneProgram& program, FloatPack x, FloatPack y, float missDst);
+}
\ No newline at end of file
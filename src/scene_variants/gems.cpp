@@ -29,7 +29,6 @@ material->refractionIndex = glm::vec3(1.500000f, 1.550000f, 1.600000f);
 material->absorption = glm::vec3(0.000000f, 36.632000f, 2.900000f);
 materials.Add(SceneMaterial::Handle(4), material);
 }
-materials.nextFreeHandleValue = 5;
 {
 auto object = new SceneObjectTransform();
 object->translation = glm::vec2(1.580939f, 1.210194f);
@@ -98,10 +97,10 @@ object->points.push_back(glm::vec2(0.207052f, -0.694936f));
 object->parent = ISceneObject::Handle(10);
 objects.Add(ISceneObject::Handle(11), object);
 }
-objects.nextFreeHandleValue = 12;
 rootObjects.push_back(ISceneObject::Handle(1));
 rootObjects.push_back(ISceneObject::Handle(4));
 rootObjects.push_back(ISceneObject::Handle(5));
 rootObjects.push_back(ISceneObject::Handle(10));
-if (GetRender()) RenderSetExposure(GetRender(), 2.800000f);
+exposure = 2.800000f;
+if (GetRender()) RenderSetExposure(GetRender(), exposure);
 });
@@ -22,7 +22,6 @@ material->refractionIndex = glm::vec3(1.650000f, 1.750000f, 1.850000f);
 material->absorption = glm::vec3(0.000000f, 0.000000f, 0.000000f);
 materials.Add(SceneMaterial::Handle(3), material);
 }
-materials.nextFreeHandleValue = 4;
 {
 auto object = new SceneObjectTransform();
 object->translation = glm::vec2(-1.504749f, 0.025950f);
@@ -132,10 +131,10 @@ object->material = SceneMaterial::Handle(0);
 object->parent = ISceneObject::Handle(13);
 objects.Add(ISceneObject::Handle(14), object);
 }
-objects.nextFreeHandleValue = 15;
 rootObjects.push_back(ISceneObject::Handle(1));
 rootObjects.push_back(ISceneObject::Handle(7));
 rootObjects.push_back(ISceneObject::Handle(8));
 rootObjects.push_back(ISceneObject::Handle(12));
-if (GetRender()) RenderSetExposure(GetRender(), 8.000000f);
+exposure = 8.000000f;
+if (GetRender()) RenderSetExposure(GetRender(), exposure);
 });
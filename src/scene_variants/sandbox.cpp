@@ -15,7 +15,6 @@ material->refractionIndex = glm::vec3(1.631000f, 1.412000f, 1.330000f);
 material->absorption = glm::vec3(0.000000f, 0.000000f, 0.000000f);
 materials.Add(SceneMaterial::Handle(2), material);
 }
-materials.nextFreeHandleValue = 3;
 {
 auto object = new SceneObjectTransform();
 object->translation = glm::vec2(0.796850f, 0.544949f);
@@ -49,6 +48,6 @@ object->children.push_back(ISceneObject::Handle(3));
 object->parent = ISceneObject::Handle(0);
 objects.Add(ISceneObject::Handle(4), object);
 }
-objects.nextFreeHandleValue = 5;
-rootObjects.push_back(ISceneObject::Handle(1));rootObjects.push_back(ISceneObject::Handle(4));if (GetRender()) RenderSetExposure(GetRender(), 2.062000f);
+rootObjects.push_back(ISceneObject::Handle(1));rootObjects.push_back(ISceneObject::Handle(4));exposure = 2.062000f;
+if (GetRender()) RenderSetExposure(GetRender(), exposure);
 });
@@ -0,0 +1,128 @@
+#pragma once
+
+//PROJECT_SIMD_SCALAR forces the portable path, handy for comparing against the vector ones
+#if defined(PROJECT_SIMD_SCALAR)
+#elif defined(__AVX2__)
+#define PROJECT_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROJECT_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace app
+{
+	//Fixed width float lanes, picks widest instruction set enabled at compile time, single plain float otherwise
+#if defined(PROJECT_SIMD_AVX2)
+	struct FloatPack
+	{
+		inline static constexpr int Width = 8;
+		inline static const char* IsaName = "AVX2";
+		__m256 v;
+	};
+	struct MaskPack
+	{
+		__m256 v;
+	};
+	inline FloatPack PackSet(float s) { return { _mm256_set1_ps(s) }; }
+	inline FloatPack PackLoad(const float* src) { return { _mm256_loadu_ps(src) }; }
+	inline void PackStore(float* dst, FloatPack a) { _mm256_storeu_ps(dst, a.v); }
+	inline FloatPack operator+(FloatPack a, FloatPack b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline FloatPack operator-(FloatPack a, FloatPack b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline FloatPack operator*(FloatPack a, FloatPack b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline FloatPack operator/(FloatPack a, FloatPack b) { return { _mm256_div_ps(a.v, b.v) }; }
+	inline FloatPack operator-(FloatPack a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)) }; }
+	inline FloatPack PackMin(FloatPack a, FloatPack b) { return { _mm256_min_ps(a.v, b.v) }; }
+	inline FloatPack PackMax(FloatPack a, FloatPack b) { return { _mm256_max_ps(a.v, b.v) }; }
+	inline FloatPack PackAbs(FloatPack a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v) }; }
+	inline FloatPack PackSqrt(FloatPack a) { return { _mm256_sqrt_ps(a.v) }; }
+	inline MaskPack operator<(FloatPack a, FloatPack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline MaskPack operator>(FloatPack a, FloatPack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline MaskPack operator>=(FloatPack a, FloatPack b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline MaskPack operator&(MaskPack a, MaskPack b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline MaskPack operator|(MaskPack a, MaskPack b) { return { _mm256_or_ps(a.v, b.v) }; }
+	inline MaskPack operator==(MaskPack a, MaskPack b) { return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_castps_si256(a.v), _mm256_castps_si256(b.v))) }; }
+	inline FloatPack PackSelect(MaskPack m, FloatPack a, FloatPack b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+#elif defined(PROJECT_SIMD_SSE2)
+	struct FloatPack
+	{
+		inline static constexpr int Width = 4;
+		inline static const char* IsaName = "SSE2";
+		__m128 v;
+	};
+	struct MaskPack
+	{
+		__m128 v;
+	};
+	inline FloatPack PackSet(float s) { return { _mm_set1_ps(s) }; }
+	inline FloatPack PackLoad(const float* src) { return { _mm_loadu_ps(src) }; }
+	inline void PackStore(float* dst, FloatPack a) { _mm_storeu_ps(dst, a.v); }
+	inline FloatPack operator+(FloatPack a, FloatPack b) { return { _mm_add_ps(a.v, b.v) }; }
+	inline FloatPack operator-(FloatPack a, FloatPack b) { return { _mm_sub_ps(a.v, b.v) }; }
+	inline FloatPack operator*(FloatPack a, FloatPack b) { return { _mm_mul_ps(a.v, b.v) }; }
+	inline FloatPack operator/(FloatPack a, FloatPack b) { return { _mm_div_ps(a.v, b.v) }; }
+	inline FloatPack operator-(FloatPack a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.f)) }; }
+	inline FloatPack PackMin(FloatPack a, FloatPack b) { return { _mm_min_ps(a.v, b.v) }; }
+	inline FloatPack PackMax(FloatPack a, FloatPack b) { return { _mm_max_ps(a.v, b.v) }; }
+	inline FloatPack PackAbs(FloatPack a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+	inline FloatPack PackSqrt(FloatPack a) { return { _mm_sqrt_ps(a.v) }; }
+	inline MaskPack operator<(FloatPack a, FloatPack b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline MaskPack operator>(FloatPack a, FloatPack b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline MaskPack operator>=(FloatPack a, FloatPack b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline MaskPack operator&(MaskPack a, MaskPack b) { return { _mm_and_ps(a.v, b.v) }; }
+	inline MaskPack operator|(MaskPack a, MaskPack b) { return { _mm_or_ps(a.v, b.v) }; }
+	inline MaskPack operator==(MaskPack a, MaskPack b) { return { _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(a.v), _mm_castps_si128(b.v))) }; }
+	inline FloatPack PackSelect(MaskPack m, FloatPack a, FloatPack b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+#else
+	struct FloatPack
+	{
+		inline static constexpr int Width = 1;
+		inline static const char* IsaName = "Scalar";
+		std::array<float, Width> v;
+	};
+	struct MaskPack
+	{
+		std::array<bool, FloatPack::Width> v;
+	};
+	template<class Fn>
+	inline FloatPack PackApply(Fn fn)
+	{
+		FloatPack res;
+		for (int i = 0; i < FloatPack::Width; ++i)
+		{
+			res.v[i] = fn(i);
+		}
+		return res;
+	}
+	template<class Fn>
+	inline MaskPack MaskApply(Fn fn)
+	{
+		MaskPack res;
+		for (int i = 0; i < FloatPack::Width; ++i)
+		{
+			res.v[i] = fn(i);
+		}
+		return res;
+	}
+	inline FloatPack PackSet(float s) { return PackApply([&](int i) { return s; }); }
+	inline FloatPack PackLoad(const float* src) { return PackApply([&](int i) { return src[i]; }); }
+	inline void PackStore(float* dst, FloatPack a) { std::copy(a.v.begin(), a.v.end(), dst); }
+	inline FloatPack operator+(FloatPack a, FloatPack b) { return PackApply([&](int i) { return a.v[i] + b.v[i]; }); }
+	inline FloatPack operator-(FloatPack a, FloatPack b) { return PackApply([&](int i) { return a.v[i] - b.v[i]; }); }
+	inline FloatPack operator*(FloatPack a, FloatPack b) { return PackApply([&](int i) { return a.v[i] * b.v[i]; }); }
+	inline FloatPack operator/(FloatPack a, FloatPack b) { return PackApply([&](int i) { return a.v[i] / b.v[i]; }); }
+	inline FloatPack operator-(FloatPack a) { return PackApply([&](int i) { return -a.v[i]; }); }
+	inline FloatPack PackMin(FloatPack a, FloatPack b) { return PackApply([&](int i) { return std::min(a.v[i], b.v[i]); }); }
+	inline FloatPack PackMax(FloatPack a, FloatPack b) { return PackApply([&](int i) { return std::max(a.v[i], b.v[i]); }); }
+	inline FloatPack PackAbs(FloatPack a) { return PackApply([&](int i) { return std::abs(a.v[i]); }); }
+	inline FloatPack PackSqrt(FloatPack a) { return PackApply([&](int i) { return std::sqrt(a.v[i]); }); }
+	inline MaskPack operator<(FloatPack a, FloatPack b) { return MaskApply([&](int i) { return a.v[i] < b.v[i]; }); }
+	inline MaskPack operator>(FloatPack a, FloatPack b) { return MaskApply([&](int i) { return a.v[i] > b.v[i]; }); }
+	inline MaskPack operator>=(FloatPack a, FloatPack b) { return MaskApply([&](int i) { return a.v[i] >= b.v[i]; }); }
+	inline MaskPack operator&(MaskPack a, MaskPack b) { return MaskApply([&](int i) { return a.v[i] && b.v[i]; }); }
+	inline MaskPack operator|(MaskPack a, MaskPack b) { return MaskApply([&](int i) { return a.v[i] || b.v[i]; }); }
+	inline MaskPack operator==(MaskPack a, MaskPack b) { return MaskApply([&](int i) { return a.v[i] == b.v[i]; }); }
+	inline FloatPack PackSelect(MaskPack m, FloatPack a, FloatPack b) { return PackApply([&](int i) { return m.v[i] ? a.v[i] : b.v[i]; }); }
+#endif
+	inline FloatPack PackClamp(FloatPack a, FloatPack lo, FloatPack hi) { return PackMin(PackMax(a, lo), hi); }
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 300 es
+
+precision highp float;
+
+//Trace target sum and moments, see outMoments in trace_frag.glsl
+uniform sampler2D u_tex0;
+uniform sampler2D u_tex1;
+uniform ivec2 u_tile_size;
+
+out vec4 outColor;
+
+//One texel per tile: standard error of pixel means over mean pixel value, channels are treated as independent
+void main()
+{
+	ivec2 size = textureSize(u_tex0, 0);
+	ivec2 origin = ivec2(gl_FragCoord.xy) * u_tile_size;
+	float meanSum = 0.0;
+	float errorSum = 0.0;
+	float pixels = 0.0;
+	for (int y = 0; y < u_tile_size.y; ++y)
+	{
+		for (int x = 0; x < u_tile_size.x; ++x)
+		{
+			ivec2 p = origin + ivec2(x, y);
+			if (p.x >= size.x || p.y >= size.y)
+			{
+				continue;
+			}
+			vec4 moments = texelFetch(u_tex1, p, 0);
+			float n = moments.a;
+			if (n < 2.0)
+			{
+				continue;
+			}
+			vec3 mean = texelFetch(u_tex0, p, 0).rgb / n;
+			vec3 variance = max(moments.rgb / n - mean * mean, vec3(0.0)) / (n - 1.0);
+			meanSum += mean.r + mean.g + mean.b;
+			errorSum += variance.r + variance.g + variance.b;
+			pixels += 1.0;
+		}
+	}
+	//Floor keeps black tiles from dividing by zero, they have no variance either
+	float error = (pixels > 0.0) ? sqrt(errorSum / pixels) / (meanSum / pixels + 0.001) : 0.0;
+	outColor = vec4(error, 0.0, 0.0, 1.0);
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #version 300 es
 
 precision highp float;
+precision highp int;
 
 #define PI 3.1415926538
 
@@ -9,15 +10,31 @@ precision highp float;
 #define MAX_TRACE_DST {codegen_miss_dst}
 #define TRACE_HIT_EPS {codegen_hit_dst}
 #define MAX_TRACE_RAYS {codegen_max_rays_per_sample}
-#define POLYGON_POINTS_MAX 16
+#define SCENE_INTERPRETER {codegen_scene_interpreter}
+#define SCENE_STACK_MAX {codegen_scene_stack_max}
+#define TRACE_MODE {codegen_trace_mode}
+#define TRACE_MODE_CHANNEL_PASSES 0
+#define TRACE_MODE_SHARED_PATH 1
+#define TRACE_MODE_SPECTRAL 2
+#define NEXT_EVENT_ESTIMATION {codegen_next_event_estimation}
+#define LIGHTS_MAX {codegen_lights_max}
+#define SPECTRAL_TO_RGB {codegen_spectral_to_rgb}
 
-uniform float u_random_seed;
+//Accumulation step, picks which part of every pixel's sample sequence gets traced
+uniform int u_step;
 uniform vec2 u_tex0_size;
+//Traced color channel when channels get separate passes
+uniform int u_channel;
+//Emissive objects as root space bounding circle and mean emission, strongest first
+uniform vec4 u_lights[LIGHTS_MAX];
+uniform int u_light_count;
 
 {codegen_uniforms}
 
 in vec2 uv;
-out vec4 outColor;
+layout(location = 0) out vec4 outColor;
+//Per channel squared step value and step count, blended into moments of trace target
+layout(location = 1) out vec4 outMoments;
 
 struct Ray
 {
@@ -25,24 +42,122 @@ struct Ray
 	vec2 d;
 };
 
+//All three channels, padded to keep std140 layout free of vec3 packing quirks
 struct Material
 {
-    float emission;
-    float refraction;
-    float absorption;
+    vec3 emission;
     float pad0;
+    vec3 refraction;
+    float pad1;
+    vec3 absorption;
+    float pad2;
+    vec2 cauchy;
+    vec2 pad3;
 };
 
 struct TraceResult
 {
 	float dst;
-	float emission;
-	float refractionIndex;
-    float absorption;
+	vec3 emission;
+	vec3 refractionIndex;
+    vec3 absorption;
+    vec2 cauchy;
+    vec2 grad;
 };
 
-float rand(vec2 uv) {
-	return fract(sin(dot(uv, vec2(12.9898, 78.233))) * 43758.5453);
+//Sampler: every pixel walks its own Owen scrambled Sobol sequence, sample index is step * NUM_SAMPLES + sample,
+//each dimension gets independently shuffled points so dimensions don't correlate with each other
+#define SAMPLE_DIM_PIXEL 0u
+#define SAMPLE_DIM_DIRECTION 1u
+#define SAMPLE_DIM_WAVELENGTH 2u
+#define SAMPLE_DIM_LIGHT_SELECT 3u
+#define SAMPLE_DIM_LIGHT_DIRECTION 4u
+//Two dimensions per ray of the path: Fresnel choice and lane split
+#define SAMPLE_DIM_BOUNCE 5u
+
+struct SampleStream
+{
+    uint seed;
+    uint index;
+};
+
+uint HashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint ReverseBits(uint x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+//Laine-Karras hash, each bit depends only on itself and lower bits
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+//Second Sobol dimension, first one is plain bit reversal
+uint SobolDimension1(uint index)
+{
+    uint v = 0x80000000u;
+    uint x = 0u;
+    for (; index != 0u; index >>= 1, v ^= v >> 1)
+    {
+        if ((index & 1u) != 0u)
+        {
+            x ^= v;
+        }
+    }
+    return x;
+}
+
+float UintToUnitFloat(uint x)
+{
+    return float(x >> 8) * (1.0 / 16777216.0);
+}
+
+SampleStream MakeSampleStream(uvec2 pixel, int sampleIdx)
+{
+    SampleStream stream;
+    stream.seed = HashUint(pixel.x ^ HashUint(pixel.y));
+    stream.index = uint(u_step * NUM_SAMPLES + sampleIdx);
+    return stream;
+}
+
+vec2 Sample2D(SampleStream stream, uint dimension)
+{
+    uint seed = HashUint(stream.seed ^ HashUint(dimension));
+    uint index = NestedUniformScramble(stream.index, seed);
+    uint x = NestedUniformScramble(ReverseBits(index), HashUint(seed + 1u));
+    uint y = NestedUniformScramble(SobolDimension1(index), HashUint(seed + 2u));
+    return vec2(UintToUnitFloat(x), UintToUnitFloat(y));
+}
+
+float Sample1D(SampleStream stream, uint dimension)
+{
+    uint seed = HashUint(stream.seed ^ HashUint(dimension));
+    uint index = NestedUniformScramble(stream.index, seed);
+    return UintToUnitFloat(NestedUniformScramble(ReverseBits(index), HashUint(seed + 1u)));
 }
 
 float Reflectance(vec2 i, vec2 normal, float n1n2)
@@ -67,7 +182,7 @@ float Reflectance(vec2 i, vec2 normal, float n1n2)
 	}
 }
 
-float BeerLambert(float absorption, float dst)
+vec4 BeerLambert(vec4 absorption, float dst)
 {
     return exp(-absorption * dst);
 }
@@ -85,33 +200,304 @@ float RectangleSDF(vec2 pt, vec2 halfSize, float rounding)
 	return length(d) + min(max(ph.x, ph.y), 0.0) - rounding;
 }
 
-float PolygonSDF(vec2 pt, int ptsCount, vec2[POLYGON_POINTS_MAX] pts, float rounding)
+//SDF with its gradient packed as (dst, grad.xy)
+vec3 CircleSDFGrad(vec2 pt, float circleRadius)
 {
-    int i = 0;
-    int j = ptsCount - 1;
+    float l = length(pt);
+    //Any direction is a valid gradient at the center
+    return vec3(l - circleRadius, (l > 0.0) ? pt / l : vec2(1.0, 0.0));
+}
 
-    float minDst = 1000.f;
-    float s = 1.0;
+vec3 RectangleSDFGrad(vec2 pt, vec2 halfSize, float rounding)
+{
+    vec2 w = abs(pt) - halfSize;
+    vec2 s = vec2(pt.x < 0.0 ? -1.0 : 1.0, pt.y < 0.0 ? -1.0 : 1.0);
+    float g = max(w.x, w.y);
+    vec2 q = max(w, 0.0);
+    float l = length(q);
+    vec2 grad = (g > 0.0) ? q / l : ((w.x > w.y) ? vec2(1.0, 0.0) : vec2(0.0, 1.0));
+    return vec3(((g > 0.0) ? l : g) - rounding, s * grad);
+}
 
-    while (i < ptsCount)
+//Open curves are stroked, thickness is half of the stroke width
+vec3 SegmentSDFGrad(vec2 pt, vec2 a, vec2 b, float thickness)
+{
+    vec2 e = b - a;
+    vec2 p = pt - a;
+    float ee = dot(e, e);
+    vec2 perp = p - e * (ee > 0.0 ? clamp(dot(p, e) / ee, 0.0, 1.0) : 0.0);
+    float l = length(perp);
+    return vec3(l - thickness, l > 0.0 ? perp / l : vec2(1.0, 0.0));
+}
+
+//Arc around +y axis spanning aperture to both sides, sc is (sin, cos) of aperture
+vec3 ArcSDFGrad(vec2 pt, vec2 sc, float radius, float thickness)
+{
+    vec2 p = vec2(abs(pt.x), pt.y);
+    float sx = pt.x < 0.0 ? -1.0 : 1.0;
+    vec2 grad;
+    float l;
+    if (sc.y * p.x > sc.x * p.y)
+    {
+        vec2 q = p - sc * radius;
+        l = length(q);
+        grad = l > 0.0 ? q / l : sc;
+    }
+    else
     {
-        vec2 e = pts[i] - pts[j];
-        vec2 p = pt - pts[j];
+        float r = length(p);
+        l = abs(r - radius);
+        grad = (r > 0.0 ? p / r : vec2(0.0, 1.0)) * (r < radius ? -1.0 : 1.0);
+    }
+    return vec3(l - thickness, vec2(sx * grad.x, grad.y));
+}
+
+//Nearest point from trig free iterations on the quarter ellipse, elongated ones need more of them to converge
+//Step is written relative to pt since evolute point e grows with eccentricity and would cancel out precision
+vec3 EllipseSDFGrad(vec2 pt, vec2 radii)
+{
+    vec2 pa = abs(pt);
+    vec2 t = vec2(0.70710678);
+    float k = radii.x * radii.x - radii.y * radii.y;
+    for (int i = 0; i < 10; ++i)
+    {
+        vec2 e = vec2(k, -k) * t * t * t / radii;
+        vec2 n = radii * t;
+        vec2 q = pa - e;
+        float lq = length(q);
+        float lr = length(n - e);
+        vec2 prev = t;
+        t = clamp(pa - q * (dot(pa - n, pa + n - 2.0 * e) / max(lq * (lq + lr), 1e-30)), vec2(0.0), radii) / radii;
+        t /= max(length(t), 1e-12);
+        if (abs(t.x - prev.x) + abs(t.y - prev.y) < 1e-6)
+        {
+            break;
+        }
+    }
+    vec2 n = radii * t;
+    vec2 v = pa - n;
+    float l = length(v);
+    float s = dot(pa / radii, pa / radii) < 1.0 ? -1.0 : 1.0;
+    vec2 grad = l > 0.0 ? s * v / l : normalize(n / (radii * radii));
+    return vec3(s * l, sign(pt + vec2(1e-30)) * grad);
+}
+
+//Closest parameter from the cubic of d/dt |B(t) - pt|^2 = 0, solved in closed form
+vec3 BezierSDFGrad(vec2 pt, vec2 A, vec2 B, vec2 C, float thickness)
+{
+    vec2 a = B - A;
+    vec2 b = A - 2.0 * B + C;
+    vec2 c = a * 2.0;
+    vec2 d = A - pt;
+    float bb = dot(b, b);
+    if (bb < 1e-10)
+    {
+        //Control point halfway between the ends makes a straight line
+        return SegmentSDFGrad(pt, A, C, thickness);
+    }
+    float kk = 1.0 / bb;
+    float kx = kk * dot(a, b);
+    float ky = kk * (2.0 * dot(a, a) + dot(d, b)) / 3.0;
+    float kz = kk * dot(d, a);
+    float p = ky - kx * kx;
+    float q = kx * (2.0 * kx * kx - 3.0 * ky) + kz;
+    float h = q * q + 4.0 * p * p * p;
+    vec2 perp;
+    if (h >= 0.0)
+    {
+        h = sqrt(h);
+        vec2 x = (vec2(h, -h) - q) / 2.0;
+        vec2 uv = sign(x) * pow(abs(x), vec2(1.0 / 3.0));
+        float t = clamp(uv.x + uv.y - kx, 0.0, 1.0);
+        perp = d + (c + b * t) * t;
+    }
+    else
+    {
+        //Three real roots, the middle one is never the closest
+        float z = sqrt(-p);
+        float v = acos(q / (p * z * 2.0)) / 3.0;
+        float m = cos(v);
+        float n = sin(v) * 1.732050808;
+        vec2 t = clamp(vec2(m + m, -n - m) * z - kx, 0.0, 1.0);
+        vec2 p0 = d + (c + b * t.x) * t.x;
+        vec2 p1 = d + (c + b * t.y) * t.y;
+        perp = dot(p0, p0) < dot(p1, p1) ? p0 : p1;
+    }
+    float l = length(perp);
+    return vec3(l - thickness, l > 0.0 ? -perp / l : vec2(1.0, 0.0));
+}
+
+//Polygon edges come precomputed from SceneObjectPolygon: edge is (start.xy, end - start), params is (outward normal.xy, 1 / squared length, 0)
+//Generated code runs one of the edge steps over all edges, then the matching finish
+void PolygonEdge(vec2 pt, vec4 edge, vec4 params, inout float minDst, inout vec2 minPerp, inout float s)
+{
+    vec2 e = edge.zw;
+    vec2 p = pt - edge.xy;
+    vec2 perp = p - e * clamp(dot(p, e) * params.z, 0.0, 1.0);
+    float d = dot(perp, perp);
+    if (d < minDst)
+    {
+        minDst = d;
+        minPerp = perp;
+    }
+    bvec3 c = bvec3(pt.y >= edge.y, pt.y < edge.y + e.y, e.x * p.y - e.y * p.x > 0.0);
+    if (all(c) || all(not(c)))
+    {
+        s *= -1.0;
+    }
+}
+
+vec3 PolygonFinish(float minDst, vec2 minPerp, float s, float rounding)
+{
+    float dst = sqrt(minDst);
+    //On the outline itself any direction is a valid gradient
+    return vec3(s * dst - rounding, dst > 0.0 ? s * minPerp / dst : vec2(1.0, 0.0));
+}
+
+//Convex outline needs no crossing count, inside distance is the largest half plane distance
+void ConvexPolygonEdge(vec2 pt, vec4 edge, vec4 params, inout float minDst, inout vec2 minPerp, inout float plane, inout vec2 planeNormal)
+{
+    vec2 e = edge.zw;
+    vec2 p = pt - edge.xy;
+    vec2 perp = p - e * clamp(dot(p, e) * params.z, 0.0, 1.0);
+    float d = dot(perp, perp);
+    if (d < minDst)
+    {
+        minDst = d;
+        minPerp = perp;
+    }
+    float h = dot(p, params.xy);
+    if (h > plane)
+    {
+        plane = h;
+        planeNormal = params.xy;
+    }
+}
+
+vec3 ConvexPolygonFinish(float minDst, vec2 minPerp, float plane, vec2 planeNormal, float rounding)
+{
+    if (plane > 0.0)
+    {
+        float dst = sqrt(minDst);
+        return vec3(dst - rounding, dst > 0.0 ? minPerp / dst : planeNormal);
+    }
+    return vec3(plane - rounding, planeNormal);
+}
+
+//Object data lives in scene program texture for interpreter, in shared scene data texture otherwise
+#if SCENE_INTERPRETER
+uniform highp sampler2D u_scene_program;
+#define SCENE_DATA u_scene_program
+#else
+uniform highp sampler2D u_scene_data;
+#define SCENE_DATA u_scene_data
+#endif
+
+vec4 SceneDataFetch(int idx)
+{
+    int width = textureSize(SCENE_DATA, 0).x;
+    return texelFetch(SCENE_DATA, ivec2(idx % width, idx / width), 0);
+}
+//Edge grid blob written by BuildPolygonGrid in polygon_grid.h, base is its first texel
+vec3 PolygonGridSDFGrad(int base, vec2 pt)
+{
+    vec4 frame = SceneDataFetch(base);
+    vec4 info = SceneDataFetch(base + 1);
+    ivec2 res = ivec2(info.xy);
+    float rounding = info.w;
+    if (res.x == 0)
+    {
+        return vec3(MAX_TRACE_DST, 1.0, 0.0);
+    }
+    vec2 gridMin = frame.xy;
+    vec2 cellSize = frame.zw;
+    vec2 q = pt - clamp(pt, gridMin, gridMin + vec2(res) * cellSize);
+    if (q != vec2(0.0))
+    {
+        float l = length(q);
+        return vec3(l + cellSize.x, q / l);
+    }
+    ivec2 cell = min(ivec2((pt - gridMin) / cellSize), res - 1);
+    vec4 c = SceneDataFetch(base + 2 + cell.y * res.x + cell.x);
+    vec2 center = gridMin + (vec2(cell) + 0.5) * cellSize;
+    vec2 path = pt - center;
+    float s = c.w;
+    int count = int(c.y);
+    if (count == 0)
+    {
+        float l = length(path);
+        return vec3(s * (c.z - l) - rounding, l > 0.0 ? s * path / l : vec2(1.0, 0.0));
+    }
+    int edges = base + 2 + res.x * res.y;
+    int lists = base + int(info.z);
+    int first = int(c.x);
+    float minDst = 1e30;
+    vec2 minPerp = vec2(1.0, 0.0);
+    for (int k = first; k < first + count; ++k)
+    {
+        vec4 ab = SceneDataFetch(edges + int(SceneDataFetch(lists + k / 4)[k % 4]));
+        vec2 e = ab.zw - ab.xy;
+        vec2 p = pt - ab.xy;
         vec2 perp = p - e * clamp(dot(p, e) / dot(e, e), 0.0, 1.0);
         float d = dot(perp, perp);
-        minDst = min(d, minDst);
-        bvec3 c = bvec3(pt.y >= pts[j].y, pt.y < pts[i].y , e.x * p.y - e.y * p.x > 0.0);
-        if (all(c) || all(not(c)) ) 
+        if (d < minDst)
+        {
+            minDst = d;
+            minPerp = perp;
+        }
+        vec2 ca = ab.xy - center;
+        vec2 cb = ab.zw - center;
+        bool splitsEdge = (path.x * ca.y - path.y * ca.x > 0.0) != (path.x * cb.y - path.y * cb.x > 0.0);
+        bool splitsPath = (e.x * -ca.y - e.y * -ca.x > 0.0) != (e.x * p.y - e.y * p.x > 0.0);
+        if (splitsEdge && splitsPath)
         {
-           s*=-1.0;  
+            s = -s;
         }
+    }
+    float dst = sqrt(minDst);
+    return vec3(s * dst - rounding, dst > 0.0 ? s * minPerp / dst : vec2(1.0, 0.0));
+}
 
-        j = i;
-        i++;
+//Sample s of baked field from BuildDistanceField in distance_field.h taken at c, the point clamped to its box
+vec3 DistanceFieldFinish(vec4 s, vec2 pt, vec2 c, float rounding)
+{
+    float gradLength = length(s.yz);
+    vec2 grad = gradLength > 0.0 ? s.yz / gradLength : vec2(1.0, 0.0);
+    vec2 q = pt - c;
+    if (q == vec2(0.0))
+    {
+        return vec3(s.x - rounding, grad);
     }
-    float dstSign = s;
-    return dstSign * sqrt(minDst) - rounding;
+    //Whole shape is inside the box, so the path to it is at least q long plus orthogonal dst at the border
+    float d = max(s.x, 0.0);
+    float l = sqrt(dot(q, q) + d * d);
+    return vec3(l - rounding, (q + d * grad) / l);
 }
+//Linear filtering of the object texture does the bilinear sample in a single fetch
+vec3 DistanceFieldSDFGrad(highp sampler2D field, vec2 pt, vec2 halfSize, float rounding)
+{
+    vec2 c = clamp(pt, -halfSize, halfSize);
+    vec4 s = texture(field, c / (2.0 * halfSize) + 0.5);
+    return DistanceFieldFinish(s, pt, c, rounding);
+}
+//Same field kept in scene data, base is its first texel
+vec3 DistanceFieldDataSDFGrad(int base, vec2 pt, float rounding)
+{
+    vec4 info = SceneDataFetch(base);
+    ivec2 size = ivec2(info.xy);
+    vec2 halfSize = info.zw;
+    vec2 c = clamp(pt, -halfSize, halfSize);
+    vec2 t = (c + halfSize) / (2.0 * halfSize) * vec2(size) - 0.5;
+    vec2 t0 = floor(t);
+    vec2 w = t - t0;
+    ivec2 i0 = clamp(ivec2(t0), ivec2(0), size - 1);
+    ivec2 i1 = clamp(ivec2(t0) + 1, ivec2(0), size - 1);
+    int texels = base + 1;
+    vec4 bottom = mix(SceneDataFetch(texels + i0.y * size.x + i0.x), SceneDataFetch(texels + i0.y * size.x + i1.x), w.x);
+    vec4 top = mix(SceneDataFetch(texels + i1.y * size.x + i0.x), SceneDataFetch(texels + i1.y * size.x + i1.x), w.x);
+    return DistanceFieldFinish(mix(bottom, top, w.y), pt, c, rounding);
+}
+
 float AnnularSDF(float sdf, float radius)
 {
     return abs(sdf) - radius;
@@ -130,13 +516,53 @@ float IntersectionSDF(float a, float b)
     return max(a, b);
 }
 
-vec2 Rotate(vec2 pt, float angle)
+//Per axis multiplier moving pt onto half plane of given side sign, zero side leaves axis untouched
+vec2 MirrorFold(vec2 pt, vec2 side)
 {
-    angle = -angle;
-    vec2 res;
-    res.x = cos(angle) * pt.x - sin(angle) * pt.y;
-    res.y = sin(angle) * pt.x + cos(angle) * pt.y;
-    return res;
+    vec2 s = vec2(pt.x >= 0.0 ? 1.0 : -1.0, pt.y >= 0.0 ? 1.0 : -1.0);
+    return mix(vec2(1.0), s * side, abs(side));
+}
+
+//Lattice (spacing.xy, count.zw), count 0 repeats forever, cell 0 is nearest instance, 1..3 neighbours towards pt
+vec2 RepeatLatticePoint(vec2 pt, vec4 lattice, int cell)
+{
+    vec2 spacing = lattice.xy;
+    bvec2 endless = equal(lattice.zw, vec2(0.0));
+    vec2 lo = mix(vec2(0.0), vec2(-1e30), endless);
+    vec2 hi = mix(lattice.zw - 1.0, vec2(1e30), endless);
+    vec2 id = clamp(round(pt / spacing), lo, hi);
+    vec2 o = mix(vec2(-1.0), vec2(1.0), greaterThanEqual(pt, spacing * id));
+    id = clamp(id + o * vec2(float(cell & 1), float(cell >> 1)), lo, hi);
+    return pt - spacing * id;
+}
+
+//Rotation of nearest polar instance (cell 0) or its neighbour towards pt (cell 1)
+float RepeatPolarAngle(vec2 pt, float count, int cell)
+{
+    float step = 2.0 * PI / count;
+    float angle = atan(pt.y, pt.x);
+    float sector = round(angle / step);
+    float o = (angle >= sector * step) ? 1.0 : -1.0;
+    return (sector + o * float(cell)) * step;
+}
+
+vec2 RotatePoint(vec2 pt, float angle)
+{
+    float c = cos(angle);
+    float s = sin(angle);
+    return vec2(c * pt.x - s * pt.y, s * pt.x + c * pt.y);
+}
+
+//Affine 2x3 stored as three columns, precomputed on CPU
+vec2 TransformPoint(vec2 m[3], vec2 pt)
+{
+    return mat3x2(m[0], m[1], m[2]) * vec3(pt, 1.0);
+}
+
+//Local gradient back to input space, transpose of linear part
+vec2 TransformGradBack(vec2 m[3], vec2 grad)
+{
+    return grad * mat2(m[0], m[1]);
 }
 
 TraceResult TraceUnion(TraceResult a, TraceResult b)
@@ -164,6 +590,7 @@ TraceResult TraceIntersection(TraceResult a, TraceResult b)
 TraceResult TraceDifference(TraceResult a, TraceResult b)
 {
     b.dst = -b.dst;
+    b.grad = -b.grad;
 	if (a.dst >= b.dst)
 	{
 		return a;
@@ -174,32 +601,259 @@ TraceResult TraceDifference(TraceResult a, TraceResult b)
 	}
 }
 
-bool DoesRayIntersectAABB(vec2 origin, vec2 dir, vec4 aabb)
+//Lower bound of SDF of anything inside circle (center.xy, radius)
+float BoundingCircleDst(vec2 pt, vec3 circle)
 {
-    float dx = 1.0 / (dir.x);
-    float tx0 = (aabb.x - origin.x) * dx;
-    float tx1 = (aabb.z - origin.x) * dx;
-    float txmin = min(tx0, tx1);
-    float txmax = max(tx0, tx1);
+    return length(pt - circle.xy) - circle.z;
+}
 
-    float dy = 1.0 / (dir.y);
-    float ty0 = (aabb.y - origin.y) * dy;
-    float ty1 = (aabb.w - origin.y) * dy;
-    float tymin = min(ty0, ty1);
-    float tymax = max(ty0, ty1);
+//Padding keeps hits within TRACE_HIT_EPS and normal taps around them inside the box
+#define BOUNDS_PAD (TRACE_HIT_EPS * 4.0 + 0.0001)
+
+vec4 BoundsUnion(vec4 a, vec4 b)
+{
+    return vec4(min(a.xy, b.xy), max(a.zw, b.zw));
+}
 
-    float tmin = max(txmin, tymin);
-    float tmax = min(txmax, tymax);
+//Axis aligned rays get a huge finite slope instead of a division by zero, which GLSL leaves undefined,
+//so origin on a slab plane gives 0 rather than 0 * inf = NaN
+vec2 RayInverseDir(vec2 dir)
+{
+    return 1.0 / (vec2(dir.x < 0.0 ? -1.0 : 1.0, dir.y < 0.0 ? -1.0 : 1.0) * max(abs(dir), vec2(1e-20)));
+}
 
-    return tmax >= tmin;
+//Half-line from origin, takes 1.0 / dir so callers divide once per ray, empty boxes have min > max
+bool DoesRayIntersectAABB(vec2 origin, vec2 invDir, vec4 aabb)
+{
+    vec4 slabs = (aabb + vec4(-BOUNDS_PAD, -BOUNDS_PAD, BOUNDS_PAD, BOUNDS_PAD) - origin.xyxy) * invDir.xyxy;
+    vec2 tmin2 = min(slabs.xy, slabs.zw);
+    vec2 tmax2 = max(slabs.xy, slabs.zw);
+    float tmin = max(max(tmin2.x, tmin2.y), 0.0);
+    float tmax = min(tmax2.x, tmax2.y);
+    return tmax >= tmin && aabb.x <= aabb.z && aabb.y <= aabb.w;
 }
 
 {codegen_scene}
 
+#if SCENE_INTERPRETER
+//Matches SceneOp in scene_program.h
+#define SCENE_OP_EMPTY 0
+#define SCENE_OP_CIRCLE 1
+#define SCENE_OP_RECTANGLE 2
+#define SCENE_OP_POLYGON 3
+#define SCENE_OP_UNION 4
+#define SCENE_OP_DIFFERENCE 5
+#define SCENE_OP_INTERSECTION 6
+#define SCENE_OP_ANNULAR 7
+#define SCENE_OP_PUSH_TRANSFORM 8
+#define SCENE_OP_PUSH_SCALE 9
+#define SCENE_OP_POP_POINT 10
+#define SCENE_OP_PUSH_REPEAT 11
+#define SCENE_OP_PUSH_POLAR 12
+#define SCENE_OP_POLYGON_GRID 13
+#define SCENE_OP_DISTANCE_FIELD 14
+#define SCENE_OP_SEGMENT 15
+#define SCENE_OP_ARC 16
+#define SCENE_OP_ELLIPSE 17
+#define SCENE_OP_BEZIER 18
+
+//u_scene_program holds two texels per instruction (op, material, arg) and params, then polygon and curve points, then polygon grids and distance fields, then three texels per material with Cauchy coefficients in w of first two
+uniform int u_scene_program_size;
+uniform int u_scene_materials_offset;
+
+float PolygonProgramSDF(vec2 pt, int first, int ptsCount, float rounding)
+{
+    int i = 0;
+    int j = ptsCount - 1;
+
+    float minDst = 1000.f;
+    float s = 1.0;
+
+    while (i < ptsCount)
+    {
+        vec2 pi = SceneDataFetch(first + i).xy;
+        vec2 pj = SceneDataFetch(first + j).xy;
+        vec2 e = pi - pj;
+        vec2 p = pt - pj;
+        vec2 perp = p - e * clamp(dot(p, e) / dot(e, e), 0.0, 1.0);
+        minDst = min(dot(perp, perp), minDst);
+        bvec3 c = bvec3(pt.y >= pj.y, pt.y < pi.y, e.x * p.y - e.y * p.x > 0.0);
+        if (all(c) || all(not(c)))
+        {
+           s *= -1.0;
+        }
+
+        j = i;
+        i++;
+    }
+    return s * sqrt(minDst) - rounding;
+}
+
+TraceResult SceneMaterialAt(vec2 pt, vec2 dir)
+{
+    float dsts[SCENE_STACK_MAX];
+    int materials[SCENE_STACK_MAX];
+    vec2 points[SCENE_STACK_MAX];
+    int top = 0;
+    int pointTop = 0;
+
+    for (int i = 0; i < u_scene_program_size; ++i)
+    {
+        vec4 head = SceneDataFetch(i * 2);
+        vec4 p = SceneDataFetch(i * 2 + 1);
+        int op = int(head.x);
+        int material = int(head.y);
+        int arg = int(head.z);
+        if (op == SCENE_OP_EMPTY)
+        {
+            dsts[top] = MAX_TRACE_DST;
+            materials[top] = 0;
+            top++;
+        }
+        else if (op == SCENE_OP_CIRCLE)
+        {
+            dsts[top] = CircleSDF(pt, p.x);
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_RECTANGLE)
+        {
+            dsts[top] = RectangleSDF(pt, p.xy, p.z);
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_POLYGON)
+        {
+            dsts[top] = PolygonProgramSDF(pt, int(p.x), int(p.y), p.z);
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_POLYGON_GRID)
+        {
+            dsts[top] = PolygonGridSDFGrad(int(p.x), pt).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_DISTANCE_FIELD)
+        {
+            dsts[top] = DistanceFieldDataSDFGrad(int(p.x), pt, p.y).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_SEGMENT)
+        {
+            int first = int(p.x);
+            dsts[top] = SegmentSDFGrad(pt, SceneDataFetch(first).xy, SceneDataFetch(first + 1).xy, p.y).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_ARC)
+        {
+            dsts[top] = ArcSDFGrad(pt, p.yz, p.x, p.w).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_ELLIPSE)
+        {
+            dsts[top] = EllipseSDFGrad(pt, p.xy).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_BEZIER)
+        {
+            int first = int(p.x);
+            dsts[top] = BezierSDFGrad(pt, SceneDataFetch(first).xy, SceneDataFetch(first + 1).xy, SceneDataFetch(first + 2).xy, p.y).x;
+            materials[top] = material;
+            top++;
+        }
+        else if (op == SCENE_OP_UNION || op == SCENE_OP_DIFFERENCE || op == SCENE_OP_INTERSECTION)
+        {
+            top--;
+            float b = dsts[top];
+            float a = dsts[top - 1];
+            bool keepA = false;
+            if (op == SCENE_OP_UNION)
+            {
+                keepA = a < b;
+            }
+            else if (op == SCENE_OP_DIFFERENCE)
+            {
+                b = -b;
+                keepA = a >= b;
+            }
+            else
+            {
+                keepA = a >= b;
+            }
+            if (!keepA)
+            {
+                dsts[top - 1] = b;
+                materials[top - 1] = materials[top];
+            }
+        }
+        else if (op == SCENE_OP_ANNULAR)
+        {
+            dsts[top - 1] = AnnularSDF(dsts[top - 1], p.x);
+        }
+        else if (op == SCENE_OP_PUSH_TRANSFORM)
+        {
+            points[pointTop] = pt;
+            pointTop++;
+            vec2 tp = pt - p.xy;
+            pt = vec2(p.z * tp.x - p.w * tp.y, p.w * tp.x + p.z * tp.y);
+        }
+        else if (op == SCENE_OP_PUSH_SCALE)
+        {
+            points[pointTop] = pt;
+            pointTop++;
+            pt *= p.xy;
+        }
+        else if (op == SCENE_OP_PUSH_REPEAT)
+        {
+            points[pointTop] = pt;
+            pointTop++;
+            pt = RepeatLatticePoint(pt, p, arg);
+        }
+        else if (op == SCENE_OP_PUSH_POLAR)
+        {
+            points[pointTop] = pt;
+            pointTop++;
+            pt = RotatePoint(pt, -RepeatPolarAngle(pt, p.x, arg));
+        }
+        else if (op == SCENE_OP_POP_POINT)
+        {
+            pointTop--;
+            pt = points[pointTop];
+        }
+    }
+
+    TraceResult res;
+    res.dst = MAX_TRACE_DST;
+    res.grad = vec2(0.0);
+    int material = 0;
+    if (top > 0)
+    {
+        res.dst = dsts[top - 1];
+        material = materials[top - 1];
+    }
+    int materialTexel = u_scene_materials_offset + material * 3;
+    res.emission = SceneDataFetch(materialTexel).rgb;
+    res.refractionIndex = SceneDataFetch(materialTexel + 1).rgb;
+    res.absorption = SceneDataFetch(materialTexel + 2).rgb;
+    res.cauchy = vec2(SceneDataFetch(materialTexel).w, SceneDataFetch(materialTexel + 1).w);
+    return res;
+}
+
+float SceneDistance(vec2 pt, vec2 dir)
+{
+    return SceneMaterialAt(pt, dir).dst;
+}
+#endif
+
 float ScenePartDeriv(vec2 pt, vec2 dir, vec2 rayDir)
 {
 	float eps = 0.0001;
-	float res = TraceScene(pt + eps * dir, rayDir).dst - TraceScene(pt - eps * dir, rayDir).dst;
+	float res = SceneDistance(pt + eps * dir, rayDir) - SceneDistance(pt - eps * dir, rayDir);
 	res = res * 0.5 / eps;
 	return res;
 }
@@ -211,42 +865,235 @@ vec2 SceneNormal(vec2 pt, vec2 rayDir)
 	return normalize(vec2(dfdx, dfdy));
 }
 
-float TraceRayCycled(Ray r)
+//Codegen carries analytic gradient along with distance, interpreter still needs extra taps
+vec2 HitNormal(TraceResult hit, vec2 pt, vec2 rayDir)
+{
+#if SCENE_INTERPRETER
+    return SceneNormal(pt, rayDir);
+#else
+    return normalize(hit.grad);
+#endif
+}
+
+#if TRACE_MODE == TRACE_MODE_SPECTRAL
+#define PATH_LANES 4
+#define SPECTRUM_MIN 380.0
+#define SPECTRUM_MAX 720.0
+
+//Partition of unity peaking at channel wavelengths, spreads RGB material values over the spectrum
+vec3 SpectralBasis(float wavelength)
+{
+    vec3 d = (wavelength - vec3(700.0, 550.0, 450.0)) / 50.0;
+    vec3 g = exp(-0.5 * d * d);
+    return g / (g.r + g.g + g.b);
+}
+
+//Inverse of basis Gram matrix from GetSpectralToRGB, constant RGB emitters average back to themselves
+vec3 SpectralToRGB(float wavelength)
+{
+    return SPECTRAL_TO_RGB * SpectralBasis(wavelength);
+}
+
+vec4 SpectralUpsample(vec3 rgb, vec4 wavelengths)
+{
+    return vec4(dot(rgb, SpectralBasis(wavelengths.x)), dot(rgb, SpectralBasis(wavelengths.y)),
+        dot(rgb, SpectralBasis(wavelengths.z)), dot(rgb, SpectralBasis(wavelengths.w)));
+}
+#else
+#define PATH_LANES 3
+#endif
+
+//Path carries a lane per color channel or per sampled wavelength
+vec4 LaneEmission(TraceResult res, vec4 wavelengths)
+{
+#if TRACE_MODE == TRACE_MODE_SPECTRAL
+    return SpectralUpsample(res.emission, wavelengths);
+#else
+    return vec4(res.emission, 0.0);
+#endif
+}
+
+vec4 LaneAbsorption(TraceResult res, vec4 wavelengths)
+{
+#if TRACE_MODE == TRACE_MODE_SPECTRAL
+    return SpectralUpsample(res.absorption, wavelengths);
+#else
+    return vec4(res.absorption, 0.0);
+#endif
+}
+
+//Unused lane repeats the first one, so it never makes refraction look dispersive
+vec4 LaneRefractionIndex(TraceResult res, vec4 wavelengths)
+{
+#if TRACE_MODE == TRACE_MODE_SPECTRAL
+    vec4 um = wavelengths * 0.001;
+    return (res.cauchy.x > 0.0) ? res.cauchy.x + res.cauchy.y / (um * um) : vec4(0.0);
+#else
+    return res.refractionIndex.rgbr;
+#endif
+}
+
+//Light sampling: a light is picked by power times angular size, then a direction uniformly within its cone,
+//primary rays are uniform over the circle with pdf 1 / (2 * PI), both strategies are weighted by balance heuristic
+#define DIRECTION_PDF (0.5 / PI)
+
+float LightConeHalfAngle(vec2 pt, vec4 light)
+{
+    float d = length(light.xy - pt);
+    return (d <= light.z) ? PI : asin(light.z / d);
+}
+
+float LightWeight(vec2 pt, vec4 light)
+{
+    return light.w * LightConeHalfAngle(pt, light);
+}
+
+float LightDirectionPdf(vec2 pt, vec2 dir)
+{
+    float total = 0.0;
+    float pdf = 0.0;
+    for (int i = 0; i < u_light_count; ++i)
+    {
+        vec4 light = u_lights[i];
+        float halfAngle = LightConeHalfAngle(pt, light);
+        float w = light.w * halfAngle;
+        total += w;
+        vec2 toLight = light.xy - pt;
+        float l = length(toLight);
+        bool isInCone = halfAngle >= PI || dot(dir, toLight) >= cos(halfAngle) * l;
+        if (isInCone && w > 0.0)
+        {
+            pdf += w / (2.0 * halfAngle);
+        }
+    }
+    return (total > 0.0) ? pdf / total : 0.0;
+}
+
+//False when no light has weight from pt
+bool SampleLightDirection(vec2 pt, SampleStream stream, out vec2 dir)
+{
+    float total = 0.0;
+    for (int i = 0; i < u_light_count; ++i)
+    {
+        total += LightWeight(pt, u_lights[i]);
+    }
+    dir = vec2(1.0, 0.0);
+    if (total <= 0.0)
+    {
+        return false;
+    }
+    float u = Sample1D(stream, SAMPLE_DIM_LIGHT_SELECT) * total;
+    vec4 light = u_lights[0];
+    for (int i = 0; i < u_light_count; ++i)
+    {
+        float w = LightWeight(pt, u_lights[i]);
+        if (w > 0.0)
+        {
+            light = u_lights[i];
+            if (u < w)
+            {
+                break;
+            }
+            u -= w;
+        }
+    }
+    float halfAngle = LightConeHalfAngle(pt, light);
+    vec2 toLight = light.xy - pt;
+    float base = (halfAngle >= PI) ? 0.0 : atan(toLight.y, toLight.x);
+    float angle = base + (Sample1D(stream, SAMPLE_DIM_LIGHT_DIRECTION) * 2.0 - 1.0) * halfAngle;
+    dir = vec2(cos(angle), sin(angle));
+    return true;
+}
+
+//Shadow ray to the first surface, its emission counts like the first hit of a primary ray in that direction
+vec4 DirectLight(vec2 pt, vec4 laneMask, vec4 wavelengths, SampleStream stream)
+{
+    vec2 dir;
+    if (!SampleLightDirection(pt, stream, dir))
+    {
+        return vec4(0.0);
+    }
+    float t = 0.0;
+    for (int stepIdx = 0; stepIdx < MAX_TRACE_STEPS * MAX_TRACE_RAYS && t < MAX_TRACE_DST; ++stepIdx)
+    {
+        vec2 cp = pt + dir * t;
+        float dst = abs(SceneDistance(cp, dir));
+        if (dst < TRACE_HIT_EPS)
+        {
+            TraceResult res = SceneMaterialAt(cp, dir);
+            float lightPdf = LightDirectionPdf(pt, dir);
+            return LaneEmission(res, wavelengths) * laneMask * (DIRECTION_PDF / (DIRECTION_PDF + lightPdf));
+        }
+        t += dst;
+    }
+    return vec4(0.0);
+}
+
+//Negative lane carries all lanes on one path until the first refraction with differing indices,
+//from there one randomly picked lane goes on with weight of all of them and isSplit is set
+vec4 TraceRayCycled(Ray r, int lane, vec4 wavelengths, SampleStream stream, out float isSplit)
 {
-    float rayPath = 0.f;
 	Ray rc = r;
 	float t = 0.0;
 	TraceResult traceRes;
-	float totalEmission = 0.0;
-	float emissionMult = 1.0;
+	vec4 totalEmission = vec4(0.0);
+	vec4 emissionMult = vec4(lane < 0 ? 1.0 : 0.0);
+    isSplit = 0.0;
+    if (lane >= 0)
+    {
+        emissionMult[lane] = 1.0;
+    }
 
     int rayIdx = 0;
     int stepIdx = 0;
+    //First hit of a ray starting outside of everything is shared with light sampling
+    float primaryWeight = 1.0;
+#if NEXT_EVENT_ESTIMATION
+    if (u_light_count > 0 && SceneDistance(r.o, r.d) >= TRACE_HIT_EPS)
+    {
+        totalEmission += DirectLight(r.o, emissionMult, wavelengths, stream);
+        primaryWeight = DIRECTION_PDF / (DIRECTION_PDF + LightDirectionPdf(r.o, r.d));
+    }
+#endif
 
 	while (rayIdx < MAX_TRACE_RAYS)
 	{
 		while (stepIdx < MAX_TRACE_STEPS && t < MAX_TRACE_DST)
 		{
 			vec2 cp = rc.o + rc.d * t;
-			traceRes = TraceScene(cp, rc.d);
-			float sdfSign = (traceRes.dst >= 0.0) ? 1.0 : -1.0;
-			if (traceRes.dst * sdfSign < TRACE_HIT_EPS)
+			float dst = SceneDistance(cp, rc.d);
+			float sdfSign = (dst >= 0.0) ? 1.0 : -1.0;
+			if (dst * sdfSign < TRACE_HIT_EPS)
 			{
-                totalEmission += traceRes.emission * emissionMult;
+                //Materials and gradient only matter where the ray stops
+                traceRes = SceneMaterialAt(cp, rc.d);
+                totalEmission += LaneEmission(traceRes, wavelengths) * emissionMult * primaryWeight;
+                primaryWeight = 1.0;
                 if (sdfSign < 0.f)
                 {
-                    emissionMult *= BeerLambert(traceRes.absorption, t + traceRes.dst * sdfSign);
+                    emissionMult *= BeerLambert(LaneAbsorption(traceRes, wavelengths), t + dst * sdfSign);
+                }
+                vec4 indices = LaneRefractionIndex(traceRes, wavelengths);
+                if (lane < 0 && any(notEqual(indices, indices.xxxx)))
+                {
+                    float u = Sample1D(stream, SAMPLE_DIM_BOUNCE + uint(rayIdx) * 2u + 1u);
+                    lane = min(int(u * float(PATH_LANES)), PATH_LANES - 1);
+                    vec4 weight = vec4(0.0);
+                    weight[lane] = float(PATH_LANES);
+                    emissionMult *= weight;
+                    isSplit = 1.0;
                 }
-                if (traceRes.refractionIndex > 0.0)
+                float refractionIndex = (lane < 0) ? indices.x : indices[lane];
+                if (refractionIndex > 0.0)
                 {
-                    vec2 normal = SceneNormal(cp, rc.d) * sdfSign;
-                    float n1n2 = (sdfSign > 0.0) ? (1.0 / traceRes.refractionIndex) : traceRes.refractionIndex;
+                    vec2 normal = HitNormal(traceRes, cp, rc.d) * sdfSign;
+                    float n1n2 = (sdfSign > 0.0) ? (1.0 / refractionIndex) : refractionIndex;
                     float reflectance = Reflectance(rc.d, normal, n1n2);
                     vec2 refracted = refract(rc.d, normal, n1n2);
                     //refract
                     if (dot(refracted, refracted) > 0.5)
                     {
-                        if (rand(rc.o + rc.d + u_random_seed) <= (1.0 - reflectance))
+                        if (Sample1D(stream, SAMPLE_DIM_BOUNCE + uint(rayIdx) * 2u) <= (1.0 - reflectance))
 					    {
 						    rc.o = cp;
 						    rc.d = refracted;
@@ -280,7 +1127,7 @@ float TraceRayCycled(Ray r)
 			}
 			else
 			{
-				t += traceRes.dst * sdfSign;
+				t += dst * sdfSign;
                 stepIdx++;
 			}
 		}
@@ -306,25 +1153,42 @@ void main()
     }
 
     outColor = vec4(0, 0, 0, 1);
+#if !SCENE_INTERPRETER
+    SceneBoundsInit();
+#endif
 
-	float v = 0.0;
+	vec4 v = vec4(0.0);
 
-    //TODO: Proper sampling
-	float angularStep = PI * 2.0 / float(NUM_SAMPLES);
     for (int i = 0; i < NUM_SAMPLES; ++i)
     {
-        vec2 offset = vec2(rand(vec2(u_random_seed + float(i), 0.f)), rand(vec2(u_random_seed + float(i), 1.f)));
+        SampleStream stream = MakeSampleStream(uvec2(gl_FragCoord.xy), i);
+        vec2 offset = Sample2D(stream, SAMPLE_DIM_PIXEL);
         offset = offset * 2.f - 1.f;
         vec2 coord = uvc + offset * texelSize * 1.f;
 
         Ray r;
         r.o = coord;
-        float angle = angularStep * (float(i) + rand(uvc + u_random_seed));
+        float angle = PI * 2.0 * Sample1D(stream, SAMPLE_DIM_DIRECTION);
         r.d.x = cos(angle);
         r.d.y = sin(angle);
-        v += TraceRayCycled(r);
+        float isSplit;
+#if TRACE_MODE == TRACE_MODE_SPECTRAL
+        //Hero wavelength and companions evenly spaced over the visible range
+        float hero = Sample1D(stream, SAMPLE_DIM_WAVELENGTH);
+        vec4 wavelengths = SPECTRUM_MIN + fract(hero + vec4(0.0, 0.25, 0.5, 0.75)) * (SPECTRUM_MAX - SPECTRUM_MIN);
+        vec4 radiance = TraceRayCycled(r, -1, wavelengths, stream, isSplit);
+        vec3 color = (radiance.x * SpectralToRGB(wavelengths.x) + radiance.y * SpectralToRGB(wavelengths.y) +
+            radiance.z * SpectralToRGB(wavelengths.z) + radiance.w * SpectralToRGB(wavelengths.w)) * 0.25;
+#elif TRACE_MODE == TRACE_MODE_SHARED_PATH
+        vec3 color = TraceRayCycled(r, -1, vec4(0.0), stream, isSplit).rgb;
+#else
+        vec3 color = TraceRayCycled(r, u_channel, vec4(0.0), stream, isSplit).rgb;
+#endif
+        v += vec4(color, isSplit);
     }
 
+    //Alpha is fraction of samples whose path split by channel or wavelength
 	v /= float(NUM_SAMPLES);
-    outColor.rgb = vec3(v);
+    outColor = v;
+    outMoments = vec4(v.rgb * v.rgb, 1.0);
 }
\ No newline at end of file
@@ -68,6 +68,63 @@ namespace app
 			}
 		}
 	}
+	uint64_t HashString(std::string_view str, uint64_t seed)
+	{
+		uint64_t hash = seed;
+		for (char c : str)
+		{
+			hash ^= uint8_t(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+	inline constexpr std::string_view Base64Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string EncodeBase64(const void* data, size_t size)
+	{
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		std::string res;
+		res.reserve((size + 2) / 3 * 4);
+		for (size_t i = 0; i < size; i += 3)
+		{
+			uint32_t chunk = uint32_t(bytes[i]) << 16;
+			if (i + 1 < size)
+			{
+				chunk |= uint32_t(bytes[i + 1]) << 8;
+			}
+			if (i + 2 < size)
+			{
+				chunk |= uint32_t(bytes[i + 2]);
+			}
+			res += Base64Alphabet[(chunk >> 18) & 63];
+			res += Base64Alphabet[(chunk >> 12) & 63];
+			res += (i + 1 < size) ? Base64Alphabet[(chunk >> 6) & 63] : '=';
+			res += (i + 2 < size) ? Base64Alphabet[chunk & 63] : '=';
+		}
+		return res;
+	}
+	std::vector<uint8_t> DecodeBase64(std::string_view str)
+	{
+		std::vector<uint8_t> res;
+		res.reserve(str.size() / 4 * 3);
+		uint32_t chunk = 0;
+		int bits = 0;
+		for (char c : str)
+		{
+			auto value = Base64Alphabet.find(c);
+			if (value == std::string_view::npos)
+			{
+				break;
+			}
+			chunk = (chunk << 6) | uint32_t(value);
+			bits += 6;
+			if (bits >= 8)
+			{
+				bits -= 8;
+				res.push_back(uint8_t(chunk >> bits));
+			}
+		}
+		return res;
+	}
 
 #ifdef PROJECT_BUILD_DEV
 
@@ -19,6 +19,11 @@ namespace app
 	glm::vec2 LogicalToSurface(glm::vec2 coord, glm::vec2 surfaceSize);
 
 	void ReplaceSubstr(std::string& dst, const std::string& placeholder, const std::string& src);
+	//FNV-1a, pass previous result as seed to chain
+	uint64_t HashString(std::string_view str, uint64_t seed = 14695981039346656037ull);
+	std::string EncodeBase64(const void* data, size_t size);
+	//Stops at first character outside the alphabet, padding included
+	std::vector<uint8_t> DecodeBase64(std::string_view str);
 
 #ifdef PROJECT_BUILD_DEV
 	struct FileWatch
@@ -0,0 +1,209 @@
+#include "main.h"
+#include "scene_program.h"
+
+//Scene math checks that don't need a GL context, run by ctest
+namespace app
+{
+	ViewInfo GetViewInfo()
+	{
+		return ViewInfo{};
+	}
+	TimeInfo GetTimeInfo()
+	{
+		return TimeInfo{};
+	}
+	Scene* GetScene()
+	{
+		return nullptr;
+	}
+	Editor* GetEditor()
+	{
+		return nullptr;
+	}
+	Render* GetRender()
+	{
+		return nullptr;
+	}
+	std::string PlatformGetFile(const std::string& name)
+	{
+		return {};
+	}
+}
+
+namespace
+{
+	int Failures = 0;
+
+	void Check(bool condition, const char* what, int line)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "line %d: %s\n", line, what);
+			++Failures;
+		}
+	}
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+	//Signed distance to ellipse from a dense scan of the quarter arc, refined by ternary search in double
+	double EllipseDistanceReference(glm::vec2 pt, glm::vec2 radii)
+	{
+		double px = std::abs(pt.x);
+		double py = std::abs(pt.y);
+		auto distanceSq = [&](double angle)
+		{
+			double dx = px - radii.x * std::cos(angle);
+			double dy = py - radii.y * std::sin(angle);
+			return dx * dx + dy * dy;
+		};
+		const int samples = 2000;
+		double step = std::numbers::pi / 2.0 / samples;
+		int best = 0;
+		for (int i = 1; i <= samples; ++i)
+		{
+			if (distanceSq(i * step) < distanceSq(best * step))
+			{
+				best = i;
+			}
+		}
+		double lo = std::max(best - 1, 0) * step;
+		double hi = std::min(best + 1, samples) * step;
+		for (int i = 0; i < 100; ++i)
+		{
+			double a = lo + (hi - lo) / 3.0;
+			double b = hi - (hi - lo) / 3.0;
+			if (distanceSq(a) < distanceSq(b))
+			{
+				hi = b;
+			}
+			else
+			{
+				lo = a;
+			}
+		}
+		double l = std::sqrt(distanceSq(lo));
+		return (px * px / (radii.x * radii.x) + py * py / (radii.y * radii.y) < 1.0) ? -l : l;
+	}
+
+	void TestPolygonRepeatedVertex()
+	{
+		//Repeated point in the middle and a closing point equal to the first one
+		std::vector<glm::vec2> points{ { 0.f, 0.f }, { 1.f, 0.f }, { 1.f, 0.f }, { 0.f, 1.f }, { 0.f, 0.f } };
+		auto outline = app::GetPolygonOutline(points);
+		CHECK(outline == std::vector<glm::vec2>({ { 1.f, 0.f }, { 0.f, 1.f }, { 0.f, 0.f } }));
+		CHECK(app::IsConvexPolygon(points));
+		std::vector<glm::vec4> edges;
+		std::vector<glm::vec4> edgeParams;
+		app::GetPolygonEdges(outline, edges, edgeParams);
+		CHECK(edges.size() == 3 && edgeParams.size() == 3);
+		for (const auto& p : edgeParams)
+		{
+			CHECK(std::isfinite(p.z) && std::abs(glm::length(glm::vec2(p)) - 1.f) < 1e-5f);
+		}
+		//Edge 0 closes the outline along the bottom, its outward normal points down for either winding
+		CHECK(glm::distance(glm::vec2(edgeParams[0]), glm::vec2(0.f, -1.f)) < 1e-5f);
+		std::reverse(outline.begin(), outline.end());
+		app::GetPolygonEdges(outline, edges, edgeParams);
+		CHECK(glm::distance(glm::vec2(edgeParams[0]), glm::vec2(0.f, -1.f)) < 1e-5f);
+		//All points equal leave no edges at all
+		CHECK(app::GetPolygonOutline({ { 2.f, 3.f }, { 2.f, 3.f } }).empty());
+	}
+
+	void TestDistanceFieldVersion()
+	{
+		app::SceneObjectDistanceField object;
+		object.maskSize = { 4, 4 };
+		object.mask.assign(16, 0);
+		object.mask[5] = 1;
+		uint64_t first = 0;
+		uint64_t second = 0;
+		object.GetField(&first);
+		object.GetField(&second);
+		CHECK(first == second);
+		//Edits bump maskVersion, field gets baked again under a new version
+		object.mask[6] = 1;
+		object.maskVersion++;
+		object.GetField(&second);
+		CHECK(first != second);
+	}
+
+	void TestElongatedEllipse()
+	{
+		std::vector<glm::vec2> points{ { -0.99791f, 0.0012634f }, { 0.5f, 0.f }, { 0.f, 0.f }, { 1.2f, 0.2f } };
+		std::mt19937 rng(17);
+		std::uniform_real_distribution<float> coord(-1.2f, 1.2f);
+		for (int i = 0; i < 200; ++i)
+		{
+			points.emplace_back(coord(rng), coord(rng) * 0.1f);
+		}
+		for (auto radii : { glm::vec2(1.f, 0.05f), glm::vec2(0.02f, 1.f) })
+		{
+			app::SceneProgram program;
+			program.Emit(app::SceneOp::Ellipse, glm::vec4(radii, 0.f, 0.f));
+			for (auto pt : points)
+			{
+				if (radii.x < radii.y)
+				{
+					pt = glm::vec2(pt.y, pt.x);
+				}
+				double reference = EllipseDistanceReference(pt, radii);
+				CHECK(std::abs(app::EvaluateSceneProgram(program, pt, 1e10f).dst - reference) < 2e-6);
+				std::array<float, app::FloatPack::Width> lanes;
+				app::PackStore(lanes.data(), app::EvaluateSceneProgramPacket(program, app::PackSet(pt.x), app::PackSet(pt.y), 1e10f).dst);
+				CHECK(std::abs(lanes[0] - reference) < 2e-6);
+			}
+		}
+	}
+
+	//Constant RGB emitter upsampled and averaged back over the spectrum like spectral trace mode does, should match what RGB modes show
+	void TestSpectralRoundTrip()
+	{
+		auto toRGB = app::GetSpectralToRGB();
+		for (auto rgb : { glm::vec3(1.f), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 0.f, 1.f), glm::vec3(0.2f, 3.f, 0.7f) })
+		{
+			const int steps = 1000;
+			glm::vec3 sum{ 0.f };
+			for (int s = 0; s < steps; ++s)
+			{
+				float wavelength = app::SceneSpectrumMin + (s + 0.5f) * (app::SceneSpectrumMax - app::SceneSpectrumMin) / steps;
+				auto basis = app::GetSpectralBasis(wavelength);
+				sum += glm::dot(rgb, basis) * (toRGB * basis);
+			}
+			auto spectral = sum / float(steps);
+			CHECK(glm::length(spectral - rgb) < 1e-3f * std::max(glm::length(rgb), 1.f));
+		}
+	}
+
+	void TestCauchyFitSkipsOpaqueChannels()
+	{
+		app::SceneMaterial material;
+		//Line through green and blue only, red doesn't refract
+		auto x = [](int i)
+		{
+			return 1.f / (app::SceneChannelWavelengths[i] * app::SceneChannelWavelengths[i]);
+		};
+		material.refractionIndex = glm::vec3(0.f, 1.5f, 1.6f);
+		auto cauchy = app::GetCauchyCoefficients(material);
+		CHECK(std::abs(cauchy.x + cauchy.y * x(1) - 1.5f) < 1e-5f);
+		CHECK(std::abs(cauchy.x + cauchy.y * x(2) - 1.6f) < 1e-5f);
+		material.refractionIndex = glm::vec3(1.4f, 0.f, 0.f);
+		CHECK(app::GetCauchyCoefficients(material) == glm::vec2(1.4f, 0.f));
+		material.refractionIndex = glm::vec3(0.f);
+		CHECK(app::GetCauchyCoefficients(material) == glm::vec2(0.f));
+	}
+}
+
+int main()
+{
+	TestPolygonRepeatedVertex();
+	TestDistanceFieldVersion();
+	TestElongatedEllipse();
+	TestSpectralRoundTrip();
+	TestCauchyFitSkipsOpaqueChannels();
+	if (Failures > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", Failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
\ No newline at end of file